@@ -0,0 +1,2092 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * ATTiny85 emulator, see avr.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr.h"
+
+// SREG bits
+#define F_C 0x01
+#define F_Z 0x02
+#define F_N 0x04
+#define F_V 0x08
+#define F_S 0x10
+#define F_H 0x20
+#define F_T 0x40
+#define F_I 0x80
+
+// I/O addresses (data space less 0x20)
+#define IO_ADCL   0x04
+#define IO_ADCH   0x05
+#define IO_ADCSRA 0x06
+#define IO_ADMUX  0x07
+#define IO_PCMSK  0x15
+#define IO_PINB   0x16
+#define IO_DDRB   0x17
+#define IO_PORTB  0x18
+#define IO_EECR   0x1C
+#define IO_EEDR   0x1D
+#define IO_EEARL  0x1E
+#define IO_EEARH  0x1F
+#define IO_WDTCR  0x21
+#define IO_OCR0B  0x28
+#define IO_OCR0A  0x29
+#define IO_TCCR0A 0x2A
+#define IO_OCR1B  0x2B
+#define IO_GTCCR  0x2C
+#define IO_OCR1C  0x2D
+#define IO_OCR1A  0x2E
+#define IO_TCNT1  0x2F
+#define IO_TCCR1  0x30
+#define IO_TCNT0  0x32
+#define IO_TCCR0B 0x33
+#define IO_MCUSR  0x34
+#define IO_MCUCR  0x35
+#define IO_TIFR   0x38
+#define IO_TIMSK  0x39
+#define IO_GIFR   0x3A
+#define IO_GIMSK  0x3B
+#define IO_SPL    0x3D
+#define IO_SPH    0x3E
+#define IO_SREG   0x3F
+
+#define IO(a, io) ((a)->data[0x20 + (io)])
+#define SREG(a)   IO(a, IO_SREG)
+
+// Register bits
+#define ADEN  0x80
+#define ADSC  0x40
+#define ADIF  0x10
+#define ADIE  0x08
+#define ADLAR 0x20
+#define EERE  0x01
+#define EEPE  0x02
+#define EEMPE 0x04
+#define EERIE 0x08
+#define WDIF  0x80
+#define WDIE  0x40
+#define WDCE  0x10
+#define WDE   0x08
+#define SE    0x20
+#define PCIE  0x20
+#define PCIF  0x20
+
+#define BUTTON_PIN  0x10    // PB4, ADC2
+#define SLEEP_PD    (1 + 2) // sleeping: power-down
+
+enum {
+    VEC_PCINT0 = 2,
+    VEC_TIM1_COMPA = 3,
+    VEC_TIM1_OVF = 4,
+    VEC_TIM0_OVF = 5,
+    VEC_EE_RDY = 6,
+    VEC_ADC = 8,
+    VEC_TIM1_COMPB = 9,
+    VEC_TIM0_COMPA = 10,
+    VEC_TIM0_COMPB = 11,
+    VEC_WDT = 12,
+};
+
+enum avr_op {
+    OP_ILLEGAL, OP_NOP, OP_MOVW, OP_CPC, OP_SBC, OP_ADD, OP_CPSE, OP_CP,
+    OP_SUB, OP_ADC, OP_AND, OP_EOR, OP_OR, OP_MOV, OP_CPI, OP_SBCI, OP_SUBI,
+    OP_ORI, OP_ANDI, OP_LDD_Y, OP_LDD_Z, OP_STD_Y, OP_STD_Z, OP_LDS,
+    OP_LD_ZP, OP_LD_MZ, OP_LPM, OP_LPM_P, OP_LD_YP, OP_LD_MY, OP_LD_X,
+    OP_LD_XP, OP_LD_MX, OP_POP, OP_STS, OP_ST_ZP, OP_ST_MZ, OP_ST_YP,
+    OP_ST_MY, OP_ST_X, OP_ST_XP, OP_ST_MX, OP_PUSH, OP_COM, OP_NEG, OP_SWAP,
+    OP_INC, OP_ASR, OP_LSR, OP_ROR, OP_DEC, OP_JMP, OP_CALL, OP_BSET,
+    OP_BCLR, OP_RET, OP_RETI, OP_SLEEP, OP_BREAK, OP_WDR, OP_LPM0, OP_IJMP,
+    OP_ICALL, OP_ADIW, OP_SBIW, OP_CBI, OP_SBIC, OP_SBI, OP_SBIS, OP_IN,
+    OP_OUT, OP_RJMP, OP_RCALL, OP_LDI, OP_BRBS, OP_BRBC, OP_BLD, OP_BST,
+    OP_SBRC, OP_SBRS,
+    // Delay loops, run as many turns at a time as fit
+    OP_LOOP_DEC, OP_LOOP_SBIW, OP_LOOP_SUB2, OP_LOOP_SUB3,
+    OP_COUNT
+};
+
+static const char *const op_names[OP_COUNT] = {
+    "?", "nop", "movw", "cpc", "sbc", "add", "cpse", "cp", "sub", "adc",
+    "and", "eor", "or", "mov", "cpi", "sbci", "subi", "ori", "andi", "ldd",
+    "ldd", "std", "std", "lds", "ld", "ld", "lpm", "lpm", "ld", "ld", "ld",
+    "ld", "ld", "pop", "sts", "st", "st", "st", "st", "st", "st", "st",
+    "push", "com", "neg", "swap", "inc", "asr", "lsr", "ror", "dec", "jmp",
+    "call", "bset", "bclr", "ret", "reti", "sleep", "break", "wdr", "lpm",
+    "ijmp", "icall", "adiw", "sbiw", "cbi", "sbic", "sbi", "sbis", "in",
+    "out", "rjmp", "rcall", "ldi", "brbs", "brbc", "bld", "bst", "sbrc",
+    "sbrs",
+};
+
+const char *avr_stop_name(enum avr_stop why)
+{
+    static const char *const names[] = {
+        [AVR_RUNNING] = "running",
+        [AVR_LIMIT] = "cycle limit",
+        [AVR_EXHAUSTED] = "out of samples",
+        [AVR_EXIT] = "exit",
+        [AVR_ASLEEP] = "asleep with nothing to wake it",
+        [AVR_ILLEGAL] = "illegal instruction",
+        [AVR_BREAK] = "break",
+        [AVR_BAD_ADDRESS] = "data access past RAMEND",
+    };
+    return names[why];
+}
+
+static uint64_t ms_cycles(const struct avr *a, uint32_t us)
+{
+    return (uint64_t)us * a->hz / 1000000;
+}
+
+/*
+ * Decoding
+ */
+
+static void decode_word(struct avr *a, uint16_t pc)
+{
+    struct avr_insn *in = &a->code[pc];
+    uint16_t o = a->flash[2 * pc] | a->flash[2 * pc + 1] << 8;
+    uint16_t next = pc + 1 < AVR_FLASH_WORDS ?
+        (a->flash[2 * pc + 2] | a->flash[2 * pc + 3] << 8) : 0;
+    uint8_t d5 = (o >> 4) & 0x1F, r5 = (o & 0x0F) | ((o >> 5) & 0x10);
+    uint8_t d4 = 16 + ((o >> 4) & 0x0F), k8 = (o & 0x0F) | ((o >> 4) & 0xF0);
+    int16_t off;
+
+    memset(in, 0, sizeof(*in));
+    in->words = 1;
+    in->op = OP_ILLEGAL;
+
+    switch (o >> 12) {
+    case 0x0:
+        if (o == 0) {
+            in->op = OP_NOP;
+        } else if ((o & 0xFF00) == 0x0100) {
+            in->op = OP_MOVW;
+            in->d = ((o >> 4) & 0x0F) * 2;
+            in->r = (o & 0x0F) * 2;
+        } else if (o & 0x0C00) {
+            static const uint8_t ops[4] = { 0, OP_CPC, OP_SBC, OP_ADD };
+            in->op = ops[(o >> 10) & 3];
+            in->d = d5;
+            in->r = r5;
+        }
+        // MULS, MULSU, FMUL: not on the ATTiny
+        break;
+    case 0x1:
+    case 0x2: {
+        static const uint8_t ops[8] = {
+            OP_CPSE, OP_CP, OP_SUB, OP_ADC, OP_AND, OP_EOR, OP_OR, OP_MOV,
+        };
+        in->op = ops[((o >> 10) & 3) | ((o >> 11) & 4)];
+        in->d = d5;
+        in->r = r5;
+        break;
+    }
+    case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: {
+        static const uint8_t ops[8] = {
+            0, 0, 0, OP_CPI, OP_SBCI, OP_SUBI, OP_ORI, OP_ANDI,
+        };
+        in->op = ops[o >> 12];
+        in->d = d4;
+        in->k = k8;
+        break;
+    }
+    case 0x8: case 0xA:
+        // LDD/STD Y+q and Z+q, LD/ST Y and Z without a displacement
+        in->d = d5;
+        in->k = (o & 0x07) | ((o >> 7) & 0x18) | ((o >> 8) & 0x20);
+        if (o & 0x0200)
+            in->op = (o & 0x08) ? OP_STD_Y : OP_STD_Z;
+        else
+            in->op = (o & 0x08) ? OP_LDD_Y : OP_LDD_Z;
+        break;
+    case 0x9:
+        in->d = d5;
+        switch ((o >> 9) & 7) {
+        case 0: {   // loads
+            static const uint8_t ops[16] = {
+                OP_LDS, OP_LD_ZP, OP_LD_MZ, 0, OP_LPM, OP_LPM_P, 0, 0,
+                0, OP_LD_YP, OP_LD_MY, 0, OP_LD_X, OP_LD_XP, OP_LD_MX, OP_POP,
+            };
+            in->op = ops[o & 0x0F];
+            if (in->op == OP_LDS) {
+                in->k = next;
+                in->words = 2;
+            }
+            break;
+        }
+        case 1: {   // stores
+            static const uint8_t ops[16] = {
+                OP_STS, OP_ST_ZP, OP_ST_MZ, 0, 0, 0, 0, 0,
+                0, OP_ST_YP, OP_ST_MY, 0, OP_ST_X, OP_ST_XP, OP_ST_MX, OP_PUSH,
+            };
+            in->op = ops[o & 0x0F];
+            if (in->op == OP_STS) {
+                in->k = next;
+                in->words = 2;
+            }
+            break;
+        }
+        case 2: {   // one operand, and the rest
+            static const uint8_t ops[16] = {
+                OP_COM, OP_NEG, OP_SWAP, OP_INC, 0, OP_ASR, OP_LSR, OP_ROR,
+                0, 0, OP_DEC, 0, OP_JMP, OP_JMP, OP_CALL, OP_CALL,
+            };
+            if ((o & 0x0F) == 0x08) {
+                if ((o & 0xFF8F) == 0x9408) {
+                    in->op = OP_BSET;
+                    in->d = (o >> 4) & 7;
+                } else if ((o & 0xFF8F) == 0x9488) {
+                    in->op = OP_BCLR;
+                    in->d = (o >> 4) & 7;
+                } else {
+                    switch (o) {
+                    case 0x9508: in->op = OP_RET; break;
+                    case 0x9518: in->op = OP_RETI; break;
+                    case 0x9588: in->op = OP_SLEEP; break;
+                    case 0x9598: in->op = OP_BREAK; break;
+                    case 0x95A8: in->op = OP_WDR; break;
+                    case 0x95C8: in->op = OP_LPM0; break;
+                    }
+                }
+            } else if (o == 0x9409) {
+                in->op = OP_IJMP;
+            } else if (o == 0x9509) {
+                in->op = OP_ICALL;
+            } else {
+                in->op = ops[o & 0x0F];
+                if (in->op == OP_JMP || in->op == OP_CALL) {
+                    in->k = next & (AVR_FLASH_WORDS - 1);
+                    in->words = 2;
+                }
+            }
+            break;
+        }
+        case 3:     // ADIW, SBIW
+            in->op = (o & 0x0100) ? OP_SBIW : OP_ADIW;
+            in->d = 24 + ((o >> 3) & 0x06);
+            in->k = (o & 0x0F) | ((o >> 2) & 0x30);
+            break;
+        case 4:
+        case 5: {   // CBI, SBIC, SBI, SBIS
+            static const uint8_t ops[4] = { OP_CBI, OP_SBIC, OP_SBI, OP_SBIS };
+            in->op = ops[(o >> 8) & 3];
+            in->d = (o >> 3) & 0x1F;
+            in->r = o & 7;
+            break;
+        }
+        default:
+            break;  // MUL
+        }
+        break;
+    case 0xB:
+        in->op = (o & 0x0800) ? OP_OUT : OP_IN;
+        in->d = d5;
+        in->r = d5;
+        in->k = (o & 0x0F) | ((o >> 5) & 0x30);
+        break;
+    case 0xC:
+    case 0xD:
+        off = (int16_t)(o << 4) >> 4;
+        in->op = (o & 0x1000) ? OP_RCALL : OP_RJMP;
+        in->k = (pc + 1 + off) & (AVR_FLASH_WORDS - 1);
+        break;
+    case 0xE:
+        in->op = OP_LDI;
+        in->d = d4;
+        in->k = k8;
+        break;
+    case 0xF:
+        if (!(o & 0x0800)) {
+            off = (int16_t)(o << 6) >> 9;
+            in->op = (o & 0x0400) ? OP_BRBC : OP_BRBS;
+            in->d = o & 7;
+            in->k = (pc + 1 + off) & (AVR_FLASH_WORDS - 1);
+        } else if (!(o & 0x08)) {
+            static const uint8_t ops[4] = { OP_BLD, OP_BST, OP_SBRC, OP_SBRS };
+            in->op = ops[(o >> 9) & 3];
+            in->d = d5;
+            in->r = o & 7;
+        }
+        break;
+    }
+    in->plain = in->op;
+}
+
+// BRNE back to the start of a loop that ends at word end
+static int brne_to(const struct avr *a, uint16_t end, uint16_t start)
+{
+    const struct avr_insn *in = &a->code[end];
+
+    return end < AVR_FLASH_WORDS && in->op == OP_BRBC && in->d == 1 && in->k == start;
+}
+
+/**
+ * decode_loops()
+ *
+ * \brief Marks the delay loops avr-libc generates, so avr_run() can do their
+ *        turns in bulk:
+ *
+ *          dec rA; brne          _delay_loop_1(), 3 cycles a turn
+ *          sbiw rA, 1; brne      _delay_loop_2(), 4 cycles
+ *          subi rA, 1; sbci rB, 0; brne              4 cycles
+ *          subi rA, 1; sbci rB, 0; sbci rC, 0; brne  5 cycles
+ */
+static void decode_loops(struct avr *a)
+{
+    struct avr_insn *c = a->code, *in;
+    uint16_t pc;
+
+    for (pc = 0; pc + 1 < AVR_FLASH_WORDS; pc++) {
+        in = &c[pc];
+        if (in->op == OP_DEC && brne_to(a, pc + 1, pc)) {
+            in->op = OP_LOOP_DEC;
+        } else if (in->op == OP_SBIW && in->k == 1 && brne_to(a, pc + 1, pc)) {
+            in->op = OP_LOOP_SBIW;
+        } else if (in->op == OP_SUBI && in->k == 1 && pc + 3 < AVR_FLASH_WORDS &&
+                   c[pc + 1].op == OP_SBCI && c[pc + 1].k == 0) {
+            if (brne_to(a, pc + 2, pc)) {
+                in->op = OP_LOOP_SUB2;
+                in->r = c[pc + 1].d;
+            } else if (c[pc + 2].op == OP_SBCI && c[pc + 2].k == 0 &&
+                       brne_to(a, pc + 3, pc)) {
+                in->op = OP_LOOP_SUB3;
+                in->r = c[pc + 1].d;
+            }
+        }
+    }
+}
+
+static void decode(struct avr *a)
+{
+    uint16_t pc;
+
+    for (pc = 0; pc < AVR_FLASH_WORDS; pc++)
+        decode_word(a, pc);
+    decode_loops(a);
+    // Running off the end of the flash stops
+    memset(&a->code[AVR_FLASH_WORDS], 0, sizeof(a->code[0]));
+    a->threaded = 0;
+}
+
+/*
+ * Loading
+ */
+
+static int hex_byte(const char *s)
+{
+    int v;
+
+    if (sscanf(s, "%2x", &v) != 1)
+        return -1;
+    return v;
+}
+
+static int load_hex(struct avr *a, FILE *f, const char *path)
+{
+    char line[600];
+    uint32_t base = 0;
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        int len, type, sum = 0, i, b;
+        uint32_t addr;
+
+        lineno += 1;
+        if (line[0] != ':')
+            continue;
+        len = hex_byte(line + 1);
+        if (len < 0 || strlen(line) < 11 + 2 * (size_t)len)
+            goto bad;
+        for (i = 0; i < len + 5; i++) {
+            if ((b = hex_byte(line + 1 + 2 * i)) < 0)
+                goto bad;
+            sum += b;
+        }
+        if (sum & 0xFF)
+            goto bad;
+        addr = hex_byte(line + 3) << 8 | hex_byte(line + 5);
+        type = hex_byte(line + 7);
+        if (type == 0x01)
+            break;
+        if (type == 0x02) {
+            base = (hex_byte(line + 9) << 8 | hex_byte(line + 11)) << 4;
+            continue;
+        }
+        if (type == 0x04) {
+            base = (hex_byte(line + 9) << 8 | hex_byte(line + 11)) << 16;
+            continue;
+        }
+        if (type != 0x00)
+            continue;
+        for (i = 0; i < len; i++) {
+            if (base + addr + i >= AVR_FLASH_SIZE) {
+                fprintf(stderr, "%s:%d: past the end of the flash\n", path, lineno);
+                return -1;
+            }
+            a->flash[base + addr + i] = hex_byte(line + 9 + 2 * i);
+            if (base + addr + i + 1 > a->flash_used)
+                a->flash_used = base + addr + i + 1;
+        }
+    }
+    return 0;
+bad:
+    fprintf(stderr, "%s:%d: bad record\n", path, lineno);
+    return -1;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+// The loadable segments of an ELF32 image: flash at its load address, and
+// the EEPROM section (0x810000) into the EEPROM
+static int load_elf(struct avr *a, FILE *f, const char *path)
+{
+    uint8_t eh[52], ph[32];
+    uint32_t phoff, paddr, offset, filesz;
+    uint16_t phentsize, phnum, i;
+
+    if (fread(eh, 1, sizeof(eh), f) != sizeof(eh) || eh[4] != 1 || eh[5] != 1 ||
+        le16(eh + 18) != 83) {
+        fprintf(stderr, "%s: not a 32 bit AVR ELF image\n", path);
+        return -1;
+    }
+    phoff = le32(eh + 28);
+    phentsize = le16(eh + 42);
+    phnum = le16(eh + 44);
+    for (i = 0; i < phnum; i++) {
+        uint8_t *dst;
+        uint32_t room;
+
+        if (fseek(f, phoff + (long)i * phentsize, SEEK_SET) ||
+            fread(ph, 1, sizeof(ph), f) != sizeof(ph))
+            goto bad;
+        if (le32(ph) != 1)      // PT_LOAD
+            continue;
+        offset = le32(ph + 4);
+        paddr = le32(ph + 12);
+        filesz = le32(ph + 16);
+        if (!filesz)
+            continue;
+        if (paddr < 0x800000) {
+            dst = a->flash + paddr;
+            room = paddr < AVR_FLASH_SIZE ? AVR_FLASH_SIZE - paddr : 0;
+            if (paddr + filesz > a->flash_used)
+                a->flash_used = paddr + filesz;
+        } else if (paddr >= 0x810000 && paddr < 0x810000 + AVR_EEPROM_SIZE) {
+            dst = a->eeprom + (paddr - 0x810000);
+            room = AVR_EEPROM_SIZE - (paddr - 0x810000);
+        } else {
+            continue;   // .data's run time copy in SRAM, loaded from flash
+        }
+        if (filesz > room) {
+            fprintf(stderr, "%s: segment at 0x%x does not fit\n", path, paddr);
+            return -1;
+        }
+        if (fseek(f, offset, SEEK_SET) || fread(dst, 1, filesz, f) != filesz)
+            goto bad;
+    }
+    return 0;
+bad:
+    fprintf(stderr, "%s: truncated\n", path);
+    return -1;
+}
+
+int avr_symbol(const char *path, const char *name, uint32_t *value, uint32_t *size)
+{
+    uint8_t eh[52], sh[40], sym[16], link[40];
+    uint32_t shoff, off, len, stroff, i, j, found = 0;
+    uint16_t shentsize, shnum;
+    char text[64];
+    FILE *f = fopen(path, "rb");
+
+    if (!f)
+        return -1;
+    if (fread(eh, 1, sizeof(eh), f) != sizeof(eh) || memcmp(eh, "\x7f" "ELF", 4))
+        goto out;
+    shoff = le32(eh + 32);
+    shentsize = le16(eh + 46);
+    shnum = le16(eh + 48);
+    for (i = 0; i < shnum && !found; i++) {
+        if (fseek(f, shoff + i * shentsize, SEEK_SET) || fread(sh, 1, sizeof(sh), f) != sizeof(sh))
+            goto out;
+        if (le32(sh + 4) != 2)      // SHT_SYMTAB
+            continue;
+        off = le32(sh + 16);
+        len = le32(sh + 20);
+        // Its names are in the string table it links to
+        if (fseek(f, shoff + le32(sh + 24) * shentsize, SEEK_SET) ||
+            fread(link, 1, sizeof(link), f) != sizeof(link))
+            goto out;
+        stroff = le32(link + 16);
+        for (j = 0; j + sizeof(sym) <= len && !found; j += sizeof(sym)) {
+            if (fseek(f, off + j, SEEK_SET) || fread(sym, 1, sizeof(sym), f) != sizeof(sym))
+                goto out;
+            if (fseek(f, stroff + le32(sym), SEEK_SET) || !fgets(text, sizeof(text), f))
+                continue;
+            if (!strcmp(text, name)) {
+                *value = le32(sym + 4);
+                if (size)
+                    *size = le32(sym + 8);
+                found = 1;
+            }
+        }
+    }
+out:
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+int avr_load(struct avr *a, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    char magic[4] = { 0 };
+    int err;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(a->flash, 0xFF, sizeof(a->flash));
+    a->flash_used = 0;
+    if (fread(magic, 1, 4, f) == 4 && !memcmp(magic, "\x7f" "ELF", 4)) {
+        rewind(f);
+        err = load_elf(a, f, path);
+    } else {
+        rewind(f);
+        err = load_hex(a, f, path);
+    }
+    fclose(f);
+    if (!err)
+        decode(a);
+    return err;
+}
+
+/*
+ * Peripherals
+ */
+
+static void schedule(struct avr *a);
+static void pin_update(struct avr *a, uint16_t sample);
+
+void avr_stop(struct avr *a, enum avr_stop why)
+{
+    if (a->stop == AVR_RUNNING)
+        a->stop = why;
+    a->next_event = a->cycles;
+}
+
+void avr_request_reset(struct avr *a, uint8_t flags)
+{
+    a->reset_flags |= flags;
+    a->next_event = a->cycles;
+}
+
+static void trace(struct avr *a, enum avr_event event, uint16_t addr, uint8_t value)
+{
+    if (a->trace)
+        a->trace(a->trace_ctx, event, addr, value);
+}
+
+// Store a traced register, reporting it if it changed
+static void traced(struct avr *a, uint8_t io, enum avr_event event, uint8_t v)
+{
+    if (IO(a, io) != v) {
+        IO(a, io) = v;
+        trace(a, event, 0, v);
+    }
+}
+
+static int timer_paused(const struct avr *a, const struct avr_timer *t)
+{
+    return !t->prescale || a->sleeping == SLEEP_PD;
+}
+
+/**
+ * timer_sync()
+ *
+ * \brief Brings a timer's count and flags up to the current cycle. Counts
+ *        run from 0 to top and wrap to 0; a count above top (written by the
+ *        firmware) runs on to 0xFF first.
+ */
+static void timer_sync(struct avr *a, struct avr_timer *t)
+{
+    uint64_t n;
+    uint32_t period = t->top + 1u, pos = t->tcnt, d;
+    int i;
+
+    if (timer_paused(a, t)) {
+        t->base = a->cycles;
+        return;
+    }
+    n = a->cycles / t->prescale - t->base / t->prescale;
+    t->base = a->cycles;
+    if (!n)
+        return;
+    if (pos > t->top) {
+        d = 256 - pos;
+        for (i = 0; i < 2; i++) {
+            if (t->ocr[i] > pos && t->ocr[i] - pos <= n)
+                IO(a, IO_TIFR) |= t->ocf[i];
+        }
+        if (n < d) {
+            t->tcnt = pos + n;
+            return;
+        }
+        IO(a, IO_TIFR) |= t->tov;
+        for (i = 0; i < 2; i++) {
+            if (t->ocr[i] == 0)
+                IO(a, IO_TIFR) |= t->ocf[i];
+        }
+        n -= d;
+        pos = 0;
+    }
+    for (i = 0; i < 2; i++) {
+        if (t->ocr[i] > t->top)
+            continue;
+        d = (t->ocr[i] + period - pos) % period;
+        if (n >= (d ? d : period))
+            IO(a, IO_TIFR) |= t->ocf[i];
+    }
+    if (n >= period - pos && (t->tov_at_top || t->top == 0xFF))
+        IO(a, IO_TIFR) |= t->tov;
+    t->tcnt = (pos + n) % period;
+}
+
+// Counts from pos until the count is next at value, or UINT32_MAX for never
+static uint32_t timer_distance(const struct avr_timer *t, uint32_t value)
+{
+    uint32_t period = t->top + 1u, pos = t->tcnt, d;
+
+    if (pos > t->top) {
+        if (value > pos)
+            return value - pos;
+        if (value > t->top)
+            return UINT32_MAX;
+        return 256 - pos + value;
+    }
+    if (value > t->top)
+        return UINT32_MAX;
+    d = (value + period - pos) % period;
+    return d ? d : period;
+}
+
+static void timer_schedule(struct avr *a, struct avr_timer *t)
+{
+    uint8_t want = IO(a, IO_TIMSK) & ~IO(a, IO_TIFR);
+    uint32_t best = UINT32_MAX, d;
+    int i;
+
+    t->due = AVR_NEVER;
+    if (timer_paused(a, t))
+        return;
+    if (want & t->tov) {
+        if (t->tcnt > t->top)
+            d = 256 - t->tcnt;
+        else if (t->tov_at_top || t->top == 0xFF)
+            d = t->top + 1u - t->tcnt;
+        else
+            d = UINT32_MAX;
+        if (d < best)
+            best = d;
+    }
+    for (i = 0; i < 2; i++) {
+        if ((want & t->ocf[i]) && (d = timer_distance(t, t->ocr[i])) < best)
+            best = d;
+    }
+    if (best != UINT32_MAX)
+        t->due = (t->base / t->prescale + best) * t->prescale;
+}
+
+static void timer0_config(struct avr *a)
+{
+    static const uint16_t prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    struct avr_timer *t = &a->timer[0];
+    uint8_t wgm = (IO(a, IO_TCCR0A) & 3) | ((IO(a, IO_TCCR0B) >> 1) & 4);
+
+    t->prescale = prescale[IO(a, IO_TCCR0B) & 7];
+    t->top = (wgm == 2 || wgm == 5 || wgm == 7) ? IO(a, IO_OCR0A) : 0xFF;
+    t->tov_at_top = wgm != 0 && wgm != 2;
+    t->ocr[0] = IO(a, IO_OCR0A);
+    t->ocr[1] = IO(a, IO_OCR0B);
+    t->tov = 0x02;
+    t->ocf[0] = 0x10;
+    t->ocf[1] = 0x08;
+}
+
+static void timer1_config(struct avr *a)
+{
+    struct avr_timer *t = &a->timer[1];
+    uint8_t cs = IO(a, IO_TCCR1) & 0x0F;
+    int pwm = (IO(a, IO_TCCR1) & 0x40) || (IO(a, IO_GTCCR) & 0x40);
+
+    t->prescale = cs ? 1u << (cs - 1) : 0;
+    t->top = ((IO(a, IO_TCCR1) & 0x80) || pwm) ? IO(a, IO_OCR1C) : 0xFF;
+    t->tov_at_top = pwm;
+    t->ocr[0] = IO(a, IO_OCR1A);
+    t->ocr[1] = IO(a, IO_OCR1B);
+    t->tov = 0x04;
+    t->ocf[0] = 0x40;
+    t->ocf[1] = 0x20;
+}
+
+static void timers_sync(struct avr *a)
+{
+    timer_sync(a, &a->timer[0]);
+    timer_sync(a, &a->timer[1]);
+}
+
+static uint64_t wdt_period(const struct avr *a)
+{
+    uint8_t w = IO(a, IO_WDTCR);
+    uint8_t wdp = (w & 7) | ((w >> 2) & 8);
+
+    if (wdp > 9)
+        wdp = 9;
+    // 2K to 1M cycles of the 128kHz watchdog oscillator
+    return (uint64_t)(2048u << wdp) * a->hz / 128000;
+}
+
+static void wdt_schedule(struct avr *a)
+{
+    if (IO(a, IO_WDTCR) & (WDIE | WDE))
+        a->wdt_due = a->wdt_base + wdt_period(a);
+    else
+        a->wdt_due = AVR_NEVER;
+}
+
+static void wdt_timeout(struct avr *a)
+{
+    uint8_t w = IO(a, IO_WDTCR);
+
+    a->wdt_base = a->wdt_due;
+    if ((w & WDIE) && !((w & WDE) && (w & WDIF)))
+        IO(a, IO_WDTCR) |= WDIF;
+    else if (w & WDE)
+        avr_request_reset(a, AVR_WDRF);
+    wdt_schedule(a);
+}
+
+/**
+ * sample_take()
+ * \param  uint8_t  which  AVR_SAMPLE_ADC for a conversion of ADC2, or
+ *                         AVR_SAMPLE_POLL for a look at the pin asleep.
+ *
+ * \brief One sample from the source. A sample the source ran out on is not
+ *        used but left pending, and avr_run() takes it again first thing
+ *        from whatever source is set by then, e.g. a fork's own.
+ */
+static void sample_take(struct avr *a, uint8_t which)
+{
+    uint16_t value;
+
+    a->sample_pending = 0;
+    if (!a->sample)
+        return;
+    value = a->sample(a->sample_ctx);
+    if (a->stop == AVR_EXHAUSTED) {
+        a->sample_pending = which;
+        return;
+    }
+    if (value > 1023)
+        value = 1023;
+    pin_update(a, value);
+    if (which == AVR_SAMPLE_ADC)
+        a->adc_value = value;
+}
+
+static void adc_start(struct avr *a)
+{
+    static const uint8_t div[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+    uint8_t mux = IO(a, IO_ADMUX) & 0x0F;
+    uint32_t value = 0;
+
+    a->adc_due = a->cycles + (a->adc_first ? 25 : 13) * div[IO(a, IO_ADCSRA) & 7];
+    a->adc_first = 0;
+    if (mux == 0x0C) {
+        // The 1.1V bandgap against VCC
+        value = 1126400UL / (a->vcc_mv ? a->vcc_mv : 3000);
+        if (value > 1023)
+            value = 1023;
+    } else if (mux == 0x02) {
+        a->adc_value = 0;
+        sample_take(a, AVR_SAMPLE_ADC);
+        return;
+    }
+    a->adc_value = value;
+}
+
+static void adc_done(struct avr *a)
+{
+    a->adc_due = AVR_NEVER;
+    IO(a, IO_ADCSRA) = (IO(a, IO_ADCSRA) & ~ADSC) | ADIF;
+}
+
+// The button pin as a digital input follows the ladder's voltage
+static void pin_update(struct avr *a, uint16_t sample)
+{
+    uint8_t level = sample >= 512 ? BUTTON_PIN : 0;
+
+    if (level != a->pin_level && (IO(a, IO_PCMSK) & BUTTON_PIN))
+        IO(a, IO_GIFR) |= PCIF;
+    a->pin_level = level;
+}
+
+static void ee_write(struct avr *a)
+{
+    uint16_t addr = (IO(a, IO_EEARL) | IO(a, IO_EEARH) << 8) & (AVR_EEPROM_SIZE - 1);
+    uint8_t mode = (IO(a, IO_EECR) >> 4) & 3;
+
+    if (mode == 0)
+        a->eeprom[addr] = IO(a, IO_EEDR);
+    else if (mode == 1)
+        a->eeprom[addr] = 0xFF;
+    else if (mode == 2)
+        a->eeprom[addr] &= IO(a, IO_EEDR);
+    a->eeprom_writes[addr] += 1;
+    trace(a, AVR_EEPROM, addr, a->eeprom[addr]);
+    a->ee_due = a->cycles + ms_cycles(a, mode == 0 ? 3400 : 1800);
+    a->ee_mpe_until = 0;
+    a->cycles += 2;     // the CPU is halted for two cycles
+}
+
+static void ee_control(struct avr *a, uint8_t v)
+{
+    int armed = a->cycles < a->ee_mpe_until;
+    int busy = a->ee_due != AVR_NEVER;
+
+    IO(a, IO_EECR) = (busy ? IO(a, IO_EECR) & 0x30 : v & 0x30) | (v & EERIE);
+    if ((v & EEPE) && armed && !busy) {
+        ee_write(a);
+    } else if ((v & EEMPE) && !armed) {
+        a->ee_mpe_until = a->cycles + 4;
+    }
+    if ((v & EERE) && !busy) {
+        IO(a, IO_EEDR) = a->eeprom[(IO(a, IO_EEARL) | IO(a, IO_EEARH) << 8) &
+                                   (AVR_EEPROM_SIZE - 1)];
+        a->cycles += 4;
+    }
+}
+
+static uint8_t io_read(struct avr *a, uint8_t io)
+{
+    uint8_t v, ddr;
+
+    switch (io) {
+    case IO_PINB:
+        ddr = IO(a, IO_DDRB);
+        v = IO(a, IO_PORTB) & ddr;
+        // Inputs: the button pin, and the pull-ups on the rest
+        v |= a->pin_level & ~ddr;
+        v |= IO(a, IO_PORTB) & ~ddr & ~BUTTON_PIN;
+        return v & 0x3F;
+    case IO_TCNT0:
+        timer_sync(a, &a->timer[0]);
+        return a->timer[0].tcnt;
+    case IO_TCNT1:
+        timer_sync(a, &a->timer[1]);
+        return a->timer[1].tcnt;
+    case IO_TIFR:
+        timers_sync(a);
+        return IO(a, IO_TIFR);
+    case IO_ADCL:
+        return IO(a, IO_ADMUX) & ADLAR ? (a->adc_value << 6) & 0xC0 : a->adc_value & 0xFF;
+    case IO_ADCH:
+        return IO(a, IO_ADMUX) & ADLAR ? a->adc_value >> 2 : a->adc_value >> 8;
+    case IO_EECR:
+        v = IO(a, IO_EECR) & 0x38;
+        if (a->cycles < a->ee_mpe_until)
+            v |= EEMPE;
+        if (a->ee_due != AVR_NEVER)
+            v |= EEPE;
+        return v;
+    default:
+        return IO(a, io);
+    }
+}
+
+static void io_write(struct avr *a, uint8_t io, uint8_t v)
+{
+    uint8_t old;
+
+    if (io + 0x20 == a->out_addr) {
+        if (a->out)
+            a->out(a->out_ctx, v);
+        return;
+    }
+    if (io + 0x20 == a->exit_addr) {
+        a->exit_code = v;
+        avr_stop(a, AVR_EXIT);
+        return;
+    }
+    switch (io) {
+    case IO_PORTB:
+        traced(a, IO_PORTB, AVR_PORTB, v);
+        return;
+    case IO_DDRB:
+        traced(a, IO_DDRB, AVR_DDRB, v);
+        return;
+    case IO_PINB:
+        traced(a, IO_PORTB, AVR_PORTB, IO(a, IO_PORTB) ^ v);
+        return;
+    case IO_TCCR0A:
+    case IO_TCCR0B:
+    case IO_TCNT0:
+    case IO_OCR0A:
+    case IO_OCR0B:
+        timer_sync(a, &a->timer[0]);
+        if (io == IO_TCNT0)
+            a->timer[0].tcnt = v;
+        else if (io == IO_TCCR0A)
+            traced(a, io, AVR_TCCR0A, v);
+        else if (io == IO_OCR0A)
+            traced(a, io, AVR_OCR0A, v);
+        else
+            IO(a, io) = io == IO_TCCR0B ? v & 0x0F : v;
+        timer0_config(a);
+        break;
+    case IO_TCCR1:
+    case IO_TCNT1:
+    case IO_OCR1A:
+    case IO_OCR1B:
+    case IO_OCR1C:
+    case IO_GTCCR:
+        timer_sync(a, &a->timer[1]);
+        if (io == IO_TCNT1)
+            a->timer[1].tcnt = v;
+        else if (io == IO_TCCR1)
+            traced(a, io, AVR_TCCR1, v);
+        else
+            IO(a, io) = io == IO_GTCCR ? v & 0xF0 : v;
+        timer1_config(a);
+        break;
+    case IO_TIFR:
+        timers_sync(a);
+        IO(a, IO_TIFR) &= ~v;
+        break;
+    case IO_GIFR:
+        IO(a, IO_GIFR) &= ~v;
+        break;
+    case IO_ADCSRA:
+        old = IO(a, IO_ADCSRA);
+        IO(a, IO_ADCSRA) = (v & ~(ADIF | ADSC)) | (old & ~v & ADIF) | (old & ADSC);
+        if (!(v & ADEN)) {
+            IO(a, IO_ADCSRA) &= ~ADSC;
+            a->adc_due = AVR_NEVER;
+            a->adc_first = 1;
+        } else if ((v & ADSC) && !(old & ADSC)) {
+            IO(a, IO_ADCSRA) |= ADSC;
+            adc_start(a);
+        }
+        break;
+    case IO_EECR:
+        ee_control(a, v);
+        break;
+    case IO_WDTCR:
+        old = IO(a, IO_WDTCR);
+        IO(a, IO_WDTCR) = (v & ~(WDIF | WDCE)) | (old & ~v & WDIF);
+        if (IO(a, IO_MCUSR) & AVR_WDRF)
+            IO(a, IO_WDTCR) |= WDE;
+        if ((old ^ IO(a, IO_WDTCR)) & ~WDIF)
+            a->wdt_base = a->cycles;
+        wdt_schedule(a);
+        break;
+    default:
+        IO(a, io) = v;
+        break;
+    }
+    // Anything may have enabled or raised an interrupt
+    schedule(a);
+    a->next_event = a->cycles;
+}
+
+static uint8_t mem_read(struct avr *a, uint16_t addr)
+{
+    if (addr >= 0x20 && addr < 0x60)
+        return io_read(a, addr - 0x20);
+    if (addr > AVR_RAMEND) {
+        avr_stop(a, AVR_BAD_ADDRESS);
+        return 0;
+    }
+    return a->data[addr];
+}
+
+static void mem_write(struct avr *a, uint16_t addr, uint8_t v)
+{
+    if (addr >= 0x20 && addr < 0x60)
+        io_write(a, addr - 0x20, v);
+    else if (addr > AVR_RAMEND)
+        avr_stop(a, AVR_BAD_ADDRESS);
+    else
+        a->data[addr] = v;
+}
+
+// Highest priority interrupt that is raised and enabled, or 0
+static int irq_pending(const struct avr *a)
+{
+    uint8_t tifr = IO(a, IO_TIFR) & IO(a, IO_TIMSK);
+
+    if ((IO(a, IO_GIFR) & IO(a, IO_GIMSK) & PCIF))
+        return VEC_PCINT0;
+    if (tifr & 0x40)
+        return VEC_TIM1_COMPA;
+    if (tifr & 0x04)
+        return VEC_TIM1_OVF;
+    if (tifr & 0x02)
+        return VEC_TIM0_OVF;
+    if ((IO(a, IO_EECR) & EERIE) && a->ee_due == AVR_NEVER)
+        return VEC_EE_RDY;
+    if ((IO(a, IO_ADCSRA) & (ADIF | ADIE)) == (ADIF | ADIE))
+        return VEC_ADC;
+    if (tifr & 0x20)
+        return VEC_TIM1_COMPB;
+    if (tifr & 0x10)
+        return VEC_TIM0_COMPA;
+    if (tifr & 0x08)
+        return VEC_TIM0_COMPB;
+    if ((IO(a, IO_WDTCR) & (WDIF | WDIE)) == (WDIF | WDIE))
+        return VEC_WDT;
+    return 0;
+}
+
+static void push_pc(struct avr *a, uint16_t pc)
+{
+    uint16_t sp = IO(a, IO_SPL) | IO(a, IO_SPH) << 8;
+
+    mem_write(a, sp, pc & 0xFF);
+    mem_write(a, sp - 1, pc >> 8);
+    sp -= 2;
+    IO(a, IO_SPL) = sp & 0xFF;
+    IO(a, IO_SPH) = sp >> 8;
+}
+
+static uint16_t pop_pc(struct avr *a)
+{
+    uint16_t sp = IO(a, IO_SPL) | IO(a, IO_SPH) << 8, pc;
+
+    pc = mem_read(a, sp + 1) << 8 | mem_read(a, sp + 2);
+    sp += 2;
+    IO(a, IO_SPL) = sp & 0xFF;
+    IO(a, IO_SPH) = sp >> 8;
+    return pc & (AVR_FLASH_WORDS - 1);
+}
+
+static void irq_take(struct avr *a, int vector)
+{
+    switch (vector) {
+    case VEC_PCINT0: IO(a, IO_GIFR) &= ~PCIF; break;
+    case VEC_TIM1_COMPA: IO(a, IO_TIFR) &= ~0x40; break;
+    case VEC_TIM1_OVF: IO(a, IO_TIFR) &= ~0x04; break;
+    case VEC_TIM0_OVF: IO(a, IO_TIFR) &= ~0x02; break;
+    case VEC_ADC: IO(a, IO_ADCSRA) &= ~ADIF; break;
+    case VEC_TIM1_COMPB: IO(a, IO_TIFR) &= ~0x20; break;
+    case VEC_TIM0_COMPA: IO(a, IO_TIFR) &= ~0x10; break;
+    case VEC_TIM0_COMPB: IO(a, IO_TIFR) &= ~0x08; break;
+    case VEC_WDT:
+        IO(a, IO_WDTCR) &= ~WDIF;
+        // Interrupt and reset mode: the next timeout resets
+        if (IO(a, IO_WDTCR) & WDE)
+            IO(a, IO_WDTCR) &= ~WDIE;
+        break;
+    }
+    push_pc(a, a->pc);
+    SREG(a) &= ~F_I;
+    a->pc = vector;
+    a->cycles += 4;
+}
+
+/**
+ * schedule()
+ *
+ * \brief Works out the next cycle something needs doing at.
+ */
+static void schedule(struct avr *a)
+{
+    uint64_t next = a->limit;
+
+    timer_schedule(a, &a->timer[0]);
+    timer_schedule(a, &a->timer[1]);
+    if (a->timer[0].due < next)
+        next = a->timer[0].due;
+    if (a->timer[1].due < next)
+        next = a->timer[1].due;
+    if (a->adc_due < next)
+        next = a->adc_due;
+    if (a->ee_due < next)
+        next = a->ee_due;
+    if (a->wdt_due < next)
+        next = a->wdt_due;
+    if (a->sleeping && a->poll_due < next)
+        next = a->poll_due;
+    if (a->stop != AVR_RUNNING || a->reset_flags || a->irq_hold ||
+        ((SREG(a) & F_I) && irq_pending(a)))
+        next = a->cycles;
+    a->next_event = next;
+}
+
+static void sleep_enter(struct avr *a, uint8_t mode)
+{
+    timers_sync(a);
+    a->sleeping = 1 + mode;
+    a->poll_due = AVR_NEVER;
+    if ((IO(a, IO_GIMSK) & PCIE) && (IO(a, IO_PCMSK) & BUTTON_PIN))
+        a->poll_due = a->cycles + ms_cycles(a, 16000);
+    schedule(a);
+}
+
+static void sleep_wake(struct avr *a)
+{
+    int pd = a->sleeping == SLEEP_PD;
+
+    timers_sync(a);
+    a->sleeping = 0;
+    // Halted four cycles, plus the oscillator start-up from power-down
+    a->cycles += pd ? 4 + 6 : 4;
+}
+
+void avr_reset(struct avr *a, uint8_t flags)
+{
+    uint8_t mcusr = IO(a, IO_MCUSR);
+
+    if (flags & AVR_PORF) {
+        memset(a->data, 0, sizeof(a->data));
+        mcusr = 0;
+    } else {
+        // Start-up from reset with the default fuses: 14CK + 64ms
+        a->cycles += 14 + ms_cycles(a, 64000);
+    }
+    memset(a->data + 0x20, 0, 0x40);
+    IO(a, IO_MCUSR) = mcusr | flags;
+    if (flags & AVR_WDRF)
+        IO(a, IO_WDTCR) = WDE;
+    IO(a, IO_SPL) = AVR_RAMEND & 0xFF;
+    IO(a, IO_SPH) = AVR_RAMEND >> 8;
+    a->pc = 0;
+    a->sleeping = 0;
+    a->irq_hold = 0;
+    a->reset_flags = 0;
+    a->adc_first = 1;
+    a->adc_due = AVR_NEVER;
+    a->sample_pending = 0;
+    a->ee_due = AVR_NEVER;
+    a->ee_mpe_until = 0;
+    a->poll_due = AVR_NEVER;
+    a->wdt_base = a->cycles;
+    timer0_config(a);
+    timer1_config(a);
+    a->timer[0].tcnt = a->timer[1].tcnt = 0;
+    a->timer[0].base = a->timer[1].base = a->cycles;
+    wdt_schedule(a);
+    trace(a, AVR_PORTB, 0, 0);
+    trace(a, AVR_DDRB, 0, 0);
+}
+
+void avr_fork(struct avr *child, const struct avr *parent)
+{
+    *child = *parent;
+    child->sample = NULL;
+    child->sample_ctx = NULL;
+    child->trace = NULL;
+    child->trace_ctx = NULL;
+    child->out = NULL;
+    child->out_ctx = NULL;
+    child->stop = AVR_RUNNING;
+}
+
+void avr_init(struct avr *a, uint32_t hz)
+{
+    memset(a, 0, sizeof(*a));
+    memset(a->flash, 0xFF, sizeof(a->flash));
+    memset(a->eeprom, 0xFF, sizeof(a->eeprom));
+    a->hz = hz;
+    a->out_addr = -1;
+    a->exit_addr = -1;
+    a->limit = AVR_NEVER;
+    decode(a);
+}
+
+/**
+ * service()
+ * \return int  1 if avr_run() should return.
+ *
+ * \brief Everything that is due at the current cycle: peripheral events,
+ *        resets, waking up and interrupts. Asleep, time moves on to the
+ *        next event. Leaves next_event past the current cycle.
+ */
+static int service(struct avr *a)
+{
+    int vector;
+
+    for (;;) {
+        if (a->cycles >= a->adc_due)
+            adc_done(a);
+        if (a->cycles >= a->ee_due)
+            a->ee_due = AVR_NEVER;
+        if (a->cycles >= a->wdt_due)
+            wdt_timeout(a);
+        if (a->cycles >= a->timer[0].due || a->cycles >= a->timer[1].due)
+            timers_sync(a);
+        if (a->sleeping && a->cycles >= a->poll_due) {
+            a->poll_due += ms_cycles(a, 16000);
+            sample_take(a, AVR_SAMPLE_POLL);
+        }
+        if (a->reset_flags)
+            avr_reset(a, a->reset_flags);
+        if (a->stop != AVR_RUNNING)
+            return 1;
+        if (a->cycles >= a->limit) {
+            a->stop = AVR_LIMIT;
+            return 1;
+        }
+
+        vector = (SREG(a) & F_I) ? irq_pending(a) : 0;
+        if (vector && a->sleeping)
+            sleep_wake(a);
+        if (a->irq_hold) {
+            // One instruction after SEI or RETI before the next interrupt
+            a->irq_hold = 0;
+            schedule(a);
+            if (a->next_event <= a->cycles)
+                a->next_event = a->cycles + 1;
+            return 0;
+        }
+        if (vector)
+            irq_take(a, vector);
+
+        schedule(a);
+        if (!a->sleeping) {
+            if (a->next_event <= a->cycles && !vector)
+                a->next_event = a->cycles + 1;
+            if (a->next_event > a->cycles)
+                return 0;
+            continue;
+        }
+        if (a->next_event == AVR_NEVER) {
+            a->stop = AVR_ASLEEP;
+            return 1;
+        }
+        if (a->next_event > a->cycles)
+            a->cycles = a->next_event;
+    }
+}
+
+/*
+ * The core
+ */
+
+static inline void sub_flags(struct avr *a, uint8_t d, uint8_t r, uint8_t res, int keep_z)
+{
+    uint8_t s = SREG(a) & (F_I | F_T | (keep_z ? F_Z : 0));
+    uint8_t borrow = (~d & r) | (r & res) | (res & ~d);
+
+    if (keep_z && res)
+        s &= ~F_Z;
+    else if (!keep_z && !res)
+        s |= F_Z;
+    s |= (borrow & 0x08) ? F_H : 0;
+    s |= (borrow & 0x80) ? F_C : 0;
+    s |= ((d ^ r) & (d ^ res) & 0x80) ? F_V : 0;
+    s |= (res & 0x80) ? F_N : 0;
+    s |= (((s >> 2) ^ (s >> 3)) & 1) ? F_S : 0;
+    SREG(a) = s;
+}
+
+static inline void add_flags(struct avr *a, uint8_t d, uint8_t r, uint8_t res)
+{
+    uint8_t s = SREG(a) & (F_I | F_T);
+    uint8_t carry = (d & r) | (r & ~res) | (~res & d);
+
+    s |= !res ? F_Z : 0;
+    s |= (carry & 0x08) ? F_H : 0;
+    s |= (carry & 0x80) ? F_C : 0;
+    s |= (~(d ^ r) & (d ^ res) & 0x80) ? F_V : 0;
+    s |= (res & 0x80) ? F_N : 0;
+    s |= (((s >> 2) ^ (s >> 3)) & 1) ? F_S : 0;
+    SREG(a) = s;
+}
+
+// N, Z and S from res, V cleared, the rest kept
+static inline void logic_flags(struct avr *a, uint8_t res)
+{
+    uint8_t s = SREG(a) & (F_I | F_T | F_H | F_C);
+
+    s |= !res ? F_Z : 0;
+    s |= (res & 0x80) ? F_N | F_S : 0;
+    SREG(a) = s;
+}
+
+// INC and DEC: V when the result crossed 0x7F/0x80
+static inline void incdec_flags(struct avr *a, uint8_t res, uint8_t v)
+{
+    uint8_t s = SREG(a) & (F_I | F_T | F_H | F_C);
+
+    s |= !res ? F_Z : 0;
+    s |= (res & 0x80) ? F_N : 0;
+    s |= res == v ? F_V : 0;
+    s |= (((s >> 2) ^ (s >> 3)) & 1) ? F_S : 0;
+    SREG(a) = s;
+}
+
+// Shifts right: C from the bit shifted out, V = N ^ C
+static inline void shift_flags(struct avr *a, uint8_t res, uint8_t c)
+{
+    uint8_t s = SREG(a) & (F_I | F_T | F_H);
+
+    s |= c ? F_C : 0;
+    s |= !res ? F_Z : 0;
+    s |= (res & 0x80) ? F_N : 0;
+    s |= (!!(res & 0x80) ^ !!c) ? F_V : 0;
+    s |= (((s >> 2) ^ (s >> 3)) & 1) ? F_S : 0;
+    SREG(a) = s;
+}
+
+static inline void word_flags(struct avr *a, uint16_t res, int v, int c)
+{
+    uint8_t s = SREG(a) & (F_I | F_T | F_H);
+
+    s |= !res ? F_Z : 0;
+    s |= (res & 0x8000) ? F_N : 0;
+    s |= v ? F_V : 0;
+    s |= c ? F_C : 0;
+    s |= (((s >> 2) ^ (s >> 3)) & 1) ? F_S : 0;
+    SREG(a) = s;
+}
+
+static inline void sbiw_exec(struct avr *a, uint8_t d, uint16_t k)
+{
+    uint16_t old = a->data[d] | a->data[d + 1] << 8, res = old - k;
+
+    a->data[d] = res & 0xFF;
+    a->data[d + 1] = res >> 8;
+    word_flags(a, res, (old & ~res) & 0x8000, (res & ~old) & 0x8000);
+}
+
+static inline void dec_exec(struct avr *a, uint8_t d)
+{
+    uint8_t res = a->data[d] - 1;
+
+    a->data[d] = res;
+    incdec_flags(a, res, 0x7F);
+}
+
+// One turn of subi rA, 1; sbci rB, 0 (; sbci rC, 0)
+static inline void sub_loop_exec(struct avr *a, const uint8_t *regs, int n)
+{
+    uint8_t x = a->data[regs[0]], res = x - 1, c;
+    int i;
+
+    a->data[regs[0]] = res;
+    sub_flags(a, x, 1, res, 0);
+    for (i = 1; i < n; i++) {
+        x = a->data[regs[i]];
+        c = SREG(a) & F_C;
+        res = x - c;
+        a->data[regs[i]] = res;
+        sub_flags(a, x, 0, res, 1);
+    }
+}
+
+static inline uint32_t loop_value(const struct avr *a, const uint8_t *regs, int n)
+{
+    uint32_t v = 0;
+    int i;
+
+    for (i = n - 1; i >= 0; i--)
+        v = v << 8 | a->data[regs[i]];
+    return v;
+}
+
+static inline void loop_store(struct avr *a, const uint8_t *regs, int n, uint32_t v)
+{
+    int i;
+
+    for (i = 0; i < n; i++, v >>= 8)
+        a->data[regs[i]] = v & 0xFF;
+}
+
+/**
+ * loop_turns()
+ * \param  uint32_t  left  Turns to the end of the loop.
+ * \param  unsigned  per   Cycles a turn, the last one is a cycle less.
+ * \return uint32_t  Turns that can run before the next event: all of them
+ *                   if they end before it, else those that end before it
+ *                   (0 when not even one does).
+ */
+static inline uint32_t loop_turns(const struct avr *a, uint32_t left, unsigned per)
+{
+    uint64_t room = a->next_event - a->cycles;
+
+    if ((uint64_t)left * per <= room)
+        return left;
+    return (room - 1) / per;
+}
+
+// SP as a data address, after push (-1) or pop (+1)
+#define SP_MOVE(delta) do {                                             \
+        uint16_t sp_ = (IO(a, IO_SPL) | IO(a, IO_SPH) << 8) + (delta);  \
+        IO(a, IO_SPL) = sp_ & 0xFF;                                     \
+        IO(a, IO_SPH) = sp_ >> 8;                                       \
+    } while (0)
+#define SP() (IO(a, IO_SPL) | IO(a, IO_SPH) << 8)
+#define REG16(n) (r[n] | r[(n) + 1] << 8)
+#define SET16(n, v) do { uint16_t v_ = (v); r[n] = v_ & 0xFF; r[(n) + 1] = v_ >> 8; } while (0)
+
+enum avr_stop avr_run(struct avr *a, uint64_t limit)
+{
+    static const void *const labels[OP_COUNT] = {
+        &&op_illegal, &&op_nop, &&op_movw, &&op_cpc, &&op_sbc, &&op_add,
+        &&op_cpse, &&op_cp, &&op_sub, &&op_adc, &&op_and, &&op_eor, &&op_or,
+        &&op_mov, &&op_cpi, &&op_sbci, &&op_subi, &&op_ori, &&op_andi,
+        &&op_ldd_y, &&op_ldd_z, &&op_std_y, &&op_std_z, &&op_lds, &&op_ld_zp,
+        &&op_ld_mz, &&op_lpm, &&op_lpm_p, &&op_ld_yp, &&op_ld_my, &&op_ld_x,
+        &&op_ld_xp, &&op_ld_mx, &&op_pop, &&op_sts, &&op_st_zp, &&op_st_mz,
+        &&op_st_yp, &&op_st_my, &&op_st_x, &&op_st_xp, &&op_st_mx, &&op_push,
+        &&op_com, &&op_neg, &&op_swap, &&op_inc, &&op_asr, &&op_lsr, &&op_ror,
+        &&op_dec, &&op_jmp, &&op_call, &&op_bset, &&op_bclr, &&op_ret,
+        &&op_reti, &&op_sleep, &&op_break, &&op_wdr, &&op_lpm0, &&op_ijmp,
+        &&op_icall, &&op_adiw, &&op_sbiw, &&op_cbi, &&op_sbic, &&op_sbi,
+        &&op_sbis, &&op_in, &&op_out, &&op_rjmp, &&op_rcall, &&op_ldi,
+        &&op_brbs, &&op_brbc, &&op_bld, &&op_bst, &&op_sbrc, &&op_sbrs,
+        &&op_loop_dec, &&op_loop_sbiw, &&op_loop_sub2, &&op_loop_sub3,
+    };
+    struct avr_insn *code = a->code;
+    const struct avr_insn *in;
+    uint8_t *r = a->data;
+    uint8_t x, y, res;
+    uint16_t pc, addr;
+    uint32_t turns, left;
+    uint8_t regs[3];
+    int i;
+
+    if (!a->threaded) {
+        for (i = 0; i <= AVR_FLASH_WORDS; i++)
+            code[i].label = labels[code[i].op];
+        a->threaded = 1;
+    }
+    a->limit = limit;
+    a->stop = AVR_RUNNING;
+    if (a->sample_pending)
+        sample_take(a, a->sample_pending);
+    schedule(a);
+    pc = a->pc;
+
+#define DISPATCH() do {                                 \
+        if (a->cycles >= a->next_event)                 \
+            goto service;                               \
+        in = &code[pc];                                 \
+        goto *in->label;                                \
+    } while (0)
+#define NEXT(words, n) do {                             \
+        pc += (words);                                  \
+        a->cycles += (n);                               \
+        DISPATCH();                                     \
+    } while (0)
+// Skip the next instruction, one or two words
+#define SKIP() do {                                     \
+        uint8_t w_ = code[pc + 1].words;                \
+        NEXT(1 + w_, 1 + w_);                           \
+    } while (0)
+
+    DISPATCH();
+
+service:
+    a->pc = pc;
+    if (service(a))
+        return a->stop;
+    pc = a->pc;
+    in = &code[pc];
+    goto *in->label;
+
+op_illegal:
+    a->pc = pc;
+    a->stop = AVR_ILLEGAL;
+    return a->stop;
+op_break:
+    a->pc = pc;
+    a->stop = AVR_BREAK;
+    return a->stop;
+op_nop:
+    NEXT(1, 1);
+op_movw:
+    r[in->d] = r[in->r];
+    r[in->d + 1] = r[in->r + 1];
+    NEXT(1, 1);
+op_mov:
+    r[in->d] = r[in->r];
+    NEXT(1, 1);
+op_ldi:
+    r[in->d] = in->k;
+    NEXT(1, 1);
+
+op_add:
+    x = r[in->d];
+    y = r[in->r];
+    res = x + y;
+    add_flags(a, x, y, res);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_adc:
+    x = r[in->d];
+    y = r[in->r];
+    res = x + y + (SREG(a) & F_C);
+    add_flags(a, x, y, res);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_sub:
+    x = r[in->d];
+    y = r[in->r];
+    res = x - y;
+    sub_flags(a, x, y, res, 0);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_sbc:
+    x = r[in->d];
+    y = r[in->r];
+    res = x - y - (SREG(a) & F_C);
+    sub_flags(a, x, y, res, 1);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_subi:
+    x = r[in->d];
+    res = x - in->k;
+    sub_flags(a, x, in->k, res, 0);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_sbci:
+    x = r[in->d];
+    res = x - in->k - (SREG(a) & F_C);
+    sub_flags(a, x, in->k, res, 1);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_cp:
+    x = r[in->d];
+    y = r[in->r];
+    sub_flags(a, x, y, x - y, 0);
+    NEXT(1, 1);
+op_cpc:
+    x = r[in->d];
+    y = r[in->r];
+    sub_flags(a, x, y, x - y - (SREG(a) & F_C), 1);
+    NEXT(1, 1);
+op_cpi:
+    x = r[in->d];
+    sub_flags(a, x, in->k, x - in->k, 0);
+    NEXT(1, 1);
+op_and:
+    r[in->d] &= r[in->r];
+    logic_flags(a, r[in->d]);
+    NEXT(1, 1);
+op_andi:
+    r[in->d] &= in->k;
+    logic_flags(a, r[in->d]);
+    NEXT(1, 1);
+op_or:
+    r[in->d] |= r[in->r];
+    logic_flags(a, r[in->d]);
+    NEXT(1, 1);
+op_ori:
+    r[in->d] |= in->k;
+    logic_flags(a, r[in->d]);
+    NEXT(1, 1);
+op_eor:
+    r[in->d] ^= r[in->r];
+    logic_flags(a, r[in->d]);
+    NEXT(1, 1);
+op_com:
+    res = ~r[in->d];
+    r[in->d] = res;
+    logic_flags(a, res);
+    SREG(a) |= F_C;
+    NEXT(1, 1);
+op_neg:
+    x = r[in->d];
+    res = -x;
+    sub_flags(a, 0, x, res, 0);
+    r[in->d] = res;
+    NEXT(1, 1);
+op_swap:
+    x = r[in->d];
+    r[in->d] = (x << 4) | (x >> 4);
+    NEXT(1, 1);
+op_inc:
+    res = r[in->d] + 1;
+    r[in->d] = res;
+    incdec_flags(a, res, 0x80);
+    NEXT(1, 1);
+op_dec:
+    dec_exec(a, in->d);
+    NEXT(1, 1);
+op_asr:
+    x = r[in->d];
+    res = (x >> 1) | (x & 0x80);
+    r[in->d] = res;
+    shift_flags(a, res, x & 1);
+    NEXT(1, 1);
+op_lsr:
+    x = r[in->d];
+    res = x >> 1;
+    r[in->d] = res;
+    shift_flags(a, res, x & 1);
+    NEXT(1, 1);
+op_ror:
+    x = r[in->d];
+    res = (x >> 1) | ((SREG(a) & F_C) << 7);
+    r[in->d] = res;
+    shift_flags(a, res, x & 1);
+    NEXT(1, 1);
+op_adiw: {
+    uint16_t old = REG16(in->d), sum = old + in->k;
+
+    SET16(in->d, sum);
+    word_flags(a, sum, (~old & sum) & 0x8000, (~sum & old) & 0x8000);
+    NEXT(1, 2);
+}
+op_sbiw:
+    sbiw_exec(a, in->d, in->k);
+    NEXT(1, 2);
+
+op_bset:
+    SREG(a) |= 1 << in->d;
+    if (in->d == 7) {
+        a->irq_hold = 1;
+        a->next_event = a->cycles;
+    }
+    NEXT(1, 1);
+op_bclr:
+    SREG(a) &= ~(1 << in->d);
+    NEXT(1, 1);
+op_bst:
+    if (r[in->d] & (1 << in->r))
+        SREG(a) |= F_T;
+    else
+        SREG(a) &= ~F_T;
+    NEXT(1, 1);
+op_bld:
+    if (SREG(a) & F_T)
+        r[in->d] |= 1 << in->r;
+    else
+        r[in->d] &= ~(1 << in->r);
+    NEXT(1, 1);
+
+op_brbs:
+    if (SREG(a) & (1 << in->d)) {
+        pc = in->k;
+        a->cycles += 2;
+        DISPATCH();
+    }
+    NEXT(1, 1);
+op_brbc:
+    if (!(SREG(a) & (1 << in->d))) {
+        pc = in->k;
+        a->cycles += 2;
+        DISPATCH();
+    }
+    NEXT(1, 1);
+op_cpse:
+    if (r[in->d] == r[in->r])
+        SKIP();
+    NEXT(1, 1);
+op_sbrc:
+    if (!(r[in->d] & (1 << in->r)))
+        SKIP();
+    NEXT(1, 1);
+op_sbrs:
+    if (r[in->d] & (1 << in->r))
+        SKIP();
+    NEXT(1, 1);
+op_sbic:
+    a->pc = pc;
+    if (!(io_read(a, in->d) & (1 << in->r)))
+        SKIP();
+    NEXT(1, 1);
+op_sbis:
+    a->pc = pc;
+    if (io_read(a, in->d) & (1 << in->r))
+        SKIP();
+    NEXT(1, 1);
+op_sbi:
+    a->pc = pc;
+    io_write(a, in->d, io_read(a, in->d) | (1 << in->r));
+    NEXT(1, 2);
+op_cbi:
+    a->pc = pc;
+    io_write(a, in->d, io_read(a, in->d) & ~(1 << in->r));
+    NEXT(1, 2);
+op_in:
+    a->pc = pc;
+    r[in->d] = io_read(a, in->k);
+    NEXT(1, 1);
+op_out:
+    a->pc = pc;
+    if (in->k == IO_SREG) {
+        SREG(a) = r[in->r];
+        a->next_event = a->cycles;
+    } else {
+        io_write(a, in->k, r[in->r]);
+    }
+    NEXT(1, 1);
+
+op_rjmp:
+    pc = in->k;
+    a->cycles += 2;
+    DISPATCH();
+op_jmp:
+    pc = in->k;
+    a->cycles += 3;
+    DISPATCH();
+op_ijmp:
+    pc = REG16(30) & (AVR_FLASH_WORDS - 1);
+    a->cycles += 2;
+    DISPATCH();
+op_rcall:
+    push_pc(a, pc + 1);
+    pc = in->k;
+    a->cycles += 3;
+    DISPATCH();
+op_call:
+    push_pc(a, pc + 2);
+    pc = in->k;
+    a->cycles += 4;
+    DISPATCH();
+op_icall:
+    push_pc(a, pc + 1);
+    pc = REG16(30) & (AVR_FLASH_WORDS - 1);
+    a->cycles += 3;
+    DISPATCH();
+op_ret:
+    pc = pop_pc(a);
+    a->cycles += 4;
+    DISPATCH();
+op_reti:
+    pc = pop_pc(a);
+    SREG(a) |= F_I;
+    a->irq_hold = 1;
+    a->next_event = a->cycles;
+    a->cycles += 4;
+    DISPATCH();
+
+op_push:
+    mem_write(a, SP(), r[in->d]);
+    SP_MOVE(-1);
+    NEXT(1, 2);
+op_pop:
+    SP_MOVE(1);
+    r[in->d] = mem_read(a, SP());
+    NEXT(1, 2);
+op_lds:
+    a->pc = pc;
+    r[in->d] = mem_read(a, in->k);
+    NEXT(2, 2);
+op_sts:
+    a->pc = pc;
+    mem_write(a, in->k, r[in->d]);
+    NEXT(2, 2);
+op_ldd_y:
+    a->pc = pc;
+    r[in->d] = mem_read(a, REG16(28) + in->k);
+    NEXT(1, 2);
+op_ldd_z:
+    a->pc = pc;
+    r[in->d] = mem_read(a, REG16(30) + in->k);
+    NEXT(1, 2);
+op_std_y:
+    a->pc = pc;
+    mem_write(a, REG16(28) + in->k, r[in->d]);
+    NEXT(1, 2);
+op_std_z:
+    a->pc = pc;
+    mem_write(a, REG16(30) + in->k, r[in->d]);
+    NEXT(1, 2);
+op_ld_x:
+    a->pc = pc;
+    r[in->d] = mem_read(a, REG16(26));
+    NEXT(1, 2);
+op_ld_xp:
+    a->pc = pc;
+    addr = REG16(26);
+    SET16(26, addr + 1);
+    r[in->d] = mem_read(a, addr);
+    NEXT(1, 2);
+op_ld_mx:
+    a->pc = pc;
+    addr = REG16(26) - 1;
+    SET16(26, addr);
+    r[in->d] = mem_read(a, addr);
+    NEXT(1, 2);
+op_ld_yp:
+    a->pc = pc;
+    addr = REG16(28);
+    SET16(28, addr + 1);
+    r[in->d] = mem_read(a, addr);
+    NEXT(1, 2);
+op_ld_my:
+    a->pc = pc;
+    addr = REG16(28) - 1;
+    SET16(28, addr);
+    r[in->d] = mem_read(a, addr);
+    NEXT(1, 2);
+op_ld_zp:
+    a->pc = pc;
+    addr = REG16(30);
+    SET16(30, addr + 1);
+    r[in->d] = mem_read(a, addr);
+    NEXT(1, 2);
+op_ld_mz:
+    a->pc = pc;
+    addr = REG16(30) - 1;
+    SET16(30, addr);
+    r[in->d] = mem_read(a, addr);
+    NEXT(1, 2);
+op_st_x:
+    a->pc = pc;
+    mem_write(a, REG16(26), r[in->d]);
+    NEXT(1, 2);
+op_st_xp:
+    a->pc = pc;
+    addr = REG16(26);
+    x = r[in->d];
+    SET16(26, addr + 1);
+    mem_write(a, addr, x);
+    NEXT(1, 2);
+op_st_mx:
+    a->pc = pc;
+    addr = REG16(26) - 1;
+    x = r[in->d];
+    SET16(26, addr);
+    mem_write(a, addr, x);
+    NEXT(1, 2);
+op_st_yp:
+    a->pc = pc;
+    addr = REG16(28);
+    x = r[in->d];
+    SET16(28, addr + 1);
+    mem_write(a, addr, x);
+    NEXT(1, 2);
+op_st_my:
+    a->pc = pc;
+    addr = REG16(28) - 1;
+    x = r[in->d];
+    SET16(28, addr);
+    mem_write(a, addr, x);
+    NEXT(1, 2);
+op_st_zp:
+    a->pc = pc;
+    addr = REG16(30);
+    x = r[in->d];
+    SET16(30, addr + 1);
+    mem_write(a, addr, x);
+    NEXT(1, 2);
+op_st_mz:
+    a->pc = pc;
+    addr = REG16(30) - 1;
+    x = r[in->d];
+    SET16(30, addr);
+    mem_write(a, addr, x);
+    NEXT(1, 2);
+op_lpm0:
+    r[0] = a->flash[REG16(30) & (AVR_FLASH_SIZE - 1)];
+    NEXT(1, 3);
+op_lpm:
+    r[in->d] = a->flash[REG16(30) & (AVR_FLASH_SIZE - 1)];
+    NEXT(1, 3);
+op_lpm_p:
+    addr = REG16(30);
+    SET16(30, addr + 1);
+    r[in->d] = a->flash[addr & (AVR_FLASH_SIZE - 1)];
+    NEXT(1, 3);
+
+op_sleep:
+    a->pc = pc + 1;
+    a->cycles += 1;
+    if (IO(a, IO_MCUCR) & SE)
+        sleep_enter(a, (IO(a, IO_MCUCR) >> 3) & 3);
+    pc += 1;
+    a->next_event = a->cycles;
+    DISPATCH();
+op_wdr:
+    a->wdt_base = a->cycles;
+    wdt_schedule(a);
+    a->next_event = a->cycles;
+    NEXT(1, 1);
+
+    /*
+     * The delay loops. All but the last turn run as a count, and the last
+     * one for real so the flags come out as they would. A loop the next
+     * event falls inside of runs the turns that fit and stops at its head,
+     * where the normal path takes over.
+     */
+op_loop_dec:
+    left = r[in->d] ? r[in->d] : 256;
+    turns = loop_turns(a, left, 3);
+    if (!turns)
+        goto *labels[in->plain];
+    r[in->d] -= turns - 1;
+    dec_exec(a, in->d);
+    if (turns == left) {
+        a->cycles += 3 * turns - 1;
+        pc += 2;
+    } else {
+        a->cycles += 3 * turns;
+    }
+    DISPATCH();
+op_loop_sbiw:
+    left = REG16(in->d) ? REG16(in->d) : 65536;
+    turns = loop_turns(a, left, 4);
+    if (!turns)
+        goto *labels[in->plain];
+    SET16(in->d, REG16(in->d) - (turns - 1));
+    sbiw_exec(a, in->d, 1);
+    if (turns == left) {
+        a->cycles += 4 * turns - 1;
+        pc += 2;
+    } else {
+        a->cycles += 4 * turns;
+    }
+    DISPATCH();
+op_loop_sub2:
+    regs[0] = in->d;
+    regs[1] = in->r;
+    left = loop_value(a, regs, 2);
+    left = left ? left : 1u << 16;
+    turns = loop_turns(a, left, 4);
+    if (!turns)
+        goto *labels[in->plain];
+    loop_store(a, regs, 2, loop_value(a, regs, 2) - (turns - 1));
+    sub_loop_exec(a, regs, 2);
+    if (turns == left) {
+        a->cycles += 4 * turns - 1;
+        pc += 3;
+    } else {
+        a->cycles += 4 * turns;
+    }
+    DISPATCH();
+op_loop_sub3:
+    regs[0] = in->d;
+    regs[1] = in->r;
+    regs[2] = code[pc + 2].d;
+    left = loop_value(a, regs, 3);
+    left = left ? left : 1u << 24;
+    turns = loop_turns(a, left, 5);
+    if (!turns)
+        goto *labels[in->plain];
+    loop_store(a, regs, 3, loop_value(a, regs, 3) - (turns - 1));
+    sub_loop_exec(a, regs, 3);
+    if (turns == left) {
+        a->cycles += (uint64_t)5 * turns - 1;
+        pc += 4;
+    } else {
+        a->cycles += (uint64_t)5 * turns;
+    }
+    DISPATCH();
+}
+
+/*
+ * Disassembly
+ */
+
+int avr_disasm(const struct avr *a, uint16_t pc, char *buf, size_t len)
+{
+    const struct avr_insn *in = &a->code[pc];
+    uint8_t op = in->plain;
+    const char *name = op_names[op];
+
+    switch (op) {
+    case OP_ILLEGAL:
+        snprintf(buf, len, ".word 0x%04x", a->flash[2 * pc] | a->flash[2 * pc + 1] << 8);
+        break;
+    case OP_NOP: case OP_RET: case OP_RETI: case OP_SLEEP: case OP_BREAK:
+    case OP_WDR: case OP_LPM0: case OP_IJMP: case OP_ICALL:
+        snprintf(buf, len, "%s", name);
+        break;
+    case OP_MOVW:
+        snprintf(buf, len, "%s r%u, r%u", name, in->d, in->r);
+        break;
+    case OP_CPC: case OP_SBC: case OP_ADD: case OP_CPSE: case OP_CP:
+    case OP_SUB: case OP_ADC: case OP_AND: case OP_EOR: case OP_OR: case OP_MOV:
+        snprintf(buf, len, "%s r%u, r%u", name, in->d, in->r);
+        break;
+    case OP_CPI: case OP_SBCI: case OP_SUBI: case OP_ORI: case OP_ANDI: case OP_LDI:
+        snprintf(buf, len, "%s r%u, 0x%02X", name, in->d, in->k);
+        break;
+    case OP_ADIW: case OP_SBIW:
+        snprintf(buf, len, "%s r%u, 0x%02X", name, in->d, in->k);
+        break;
+    case OP_LDD_Y: case OP_LDD_Z:
+        snprintf(buf, len, "%s r%u, %c+%u", name, in->d, op == OP_LDD_Y ? 'Y' : 'Z', in->k);
+        break;
+    case OP_STD_Y: case OP_STD_Z:
+        snprintf(buf, len, "%s %c+%u, r%u", name, op == OP_STD_Y ? 'Y' : 'Z', in->k, in->d);
+        break;
+    case OP_LDS:
+        snprintf(buf, len, "%s r%u, 0x%04X", name, in->d, in->k);
+        break;
+    case OP_STS:
+        snprintf(buf, len, "%s 0x%04X, r%u", name, in->k, in->d);
+        break;
+    case OP_LD_X: case OP_LD_XP: case OP_LD_MX: case OP_LD_YP: case OP_LD_MY:
+    case OP_LD_ZP: case OP_LD_MZ: case OP_LPM: case OP_LPM_P: {
+        static const char *const ptr[OP_COUNT] = {
+            [OP_LD_X] = "X", [OP_LD_XP] = "X+", [OP_LD_MX] = "-X",
+            [OP_LD_YP] = "Y+", [OP_LD_MY] = "-Y", [OP_LD_ZP] = "Z+",
+            [OP_LD_MZ] = "-Z", [OP_LPM] = "Z", [OP_LPM_P] = "Z+",
+        };
+        snprintf(buf, len, "%s r%u, %s", name, in->d, ptr[op]);
+        break;
+    }
+    case OP_ST_X: case OP_ST_XP: case OP_ST_MX: case OP_ST_YP: case OP_ST_MY:
+    case OP_ST_ZP: case OP_ST_MZ: {
+        static const char *const ptr[OP_COUNT] = {
+            [OP_ST_X] = "X", [OP_ST_XP] = "X+", [OP_ST_MX] = "-X",
+            [OP_ST_YP] = "Y+", [OP_ST_MY] = "-Y", [OP_ST_ZP] = "Z+",
+            [OP_ST_MZ] = "-Z",
+        };
+        snprintf(buf, len, "%s %s, r%u", name, ptr[op], in->d);
+        break;
+    }
+    case OP_PUSH: case OP_POP: case OP_COM: case OP_NEG: case OP_SWAP:
+    case OP_INC: case OP_ASR: case OP_LSR: case OP_ROR: case OP_DEC:
+        snprintf(buf, len, "%s r%u", name, in->d);
+        break;
+    case OP_BSET: case OP_BCLR: {
+        static const char *const set[8] = { "sec", "sez", "sen", "sev", "ses", "seh", "set", "sei" };
+        static const char *const clr[8] = { "clc", "clz", "cln", "clv", "cls", "clh", "clt", "cli" };
+        snprintf(buf, len, "%s", op == OP_BSET ? set[in->d] : clr[in->d]);
+        break;
+    }
+    case OP_BRBS: case OP_BRBC: {
+        static const char *const set[8] = { "brcs", "breq", "brmi", "brvs", "brlt", "brhs", "brts", "brie" };
+        static const char *const clr[8] = { "brcc", "brne", "brpl", "brvc", "brge", "brhc", "brtc", "brid" };
+        snprintf(buf, len, "%s 0x%04X", op == OP_BRBS ? set[in->d] : clr[in->d], in->k * 2);
+        break;
+    }
+    case OP_RJMP: case OP_RCALL: case OP_JMP: case OP_CALL:
+        snprintf(buf, len, "%s 0x%04X", name, in->k * 2);
+        break;
+    case OP_CBI: case OP_SBIC: case OP_SBI: case OP_SBIS:
+        snprintf(buf, len, "%s 0x%02X, %u", name, in->d, in->r);
+        break;
+    case OP_IN:
+        snprintf(buf, len, "%s r%u, 0x%02X", name, in->d, in->k);
+        break;
+    case OP_OUT:
+        snprintf(buf, len, "%s 0x%02X, r%u", name, in->k, in->r);
+        break;
+    case OP_BLD: case OP_BST: case OP_SBRC: case OP_SBRS:
+        snprintf(buf, len, "%s r%u, %u", name, in->d, in->r);
+        break;
+    default:
+        snprintf(buf, len, "%s", name);
+        break;
+    }
+    return in->words;
+}
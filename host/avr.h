@@ -0,0 +1,229 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Emulator of the ATTiny85, as much of it as the firmware uses: the AVR
+ * core, PORTB, the ADC, the EEPROM, Timer0, Timer1, the watchdog, sleep and
+ * the pin change interrupt. It runs a built image (.hex or .elf) unmodified,
+ * one CPU cycle at a time as far as anything outside can tell, so the cycle
+ * counts it reports are the part's.
+ *
+ * The flash is decoded once, at load, into one struct avr_insn per word,
+ * and avr_run() dispatches on those with computed gotos (threaded code)
+ * rather than decoding each instruction as it comes to it. The delay loops
+ * avr-libc's _delay_ms() and _delay_us() expand to are recognised when
+ * decoded and run as many turns at once as fit before the next peripheral
+ * event, which is where the firmware spends nearly all its time.
+ *
+ * Peripherals only do work when something is due: a conversion finishing,
+ * an EEPROM write completing, a watchdog timeout or a timer interrupt. The
+ * timers keep no count of their own between register accesses, TCNT and the
+ * flags are worked out from the cycle count when they are looked at.
+ *
+ * The ADC reads button samples from avr.sample, one per conversion of ADC2,
+ * as the host simulation (sim.h) does, and the bandgap channel reads as
+ * avr.vcc_mv. Register changes and EEPROM writes go to avr.trace.
+ *
+ * Not modelled: INT0, USI, the analog comparator, the PLL, SPM, the
+ * phase correct PWM modes (counted as fast PWM), the timers' prescaler reset
+ * and dead time generator, and the brown-out detector.
+ */
+#ifndef NOMIS_AVR_H
+#define NOMIS_AVR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AVR_FLASH_SIZE  8192
+#define AVR_FLASH_WORDS (AVR_FLASH_SIZE / 2)
+#define AVR_RAMEND      0x25F
+#define AVR_EEPROM_SIZE 512
+#define AVR_NEVER       UINT64_MAX
+
+// MCUSR reset flags
+#define AVR_PORF  0x01
+#define AVR_EXTRF 0x02
+#define AVR_WDRF  0x08
+
+// What avr.sample_pending is for
+#define AVR_SAMPLE_ADC  1   // a conversion of ADC2
+#define AVR_SAMPLE_POLL 2   // asleep, a look at the button pin
+
+enum avr_event {
+    AVR_PORTB,
+    AVR_DDRB,
+    AVR_TCCR0A,
+    AVR_TCCR1,
+    AVR_OCR0A,
+    AVR_EEPROM,
+};
+
+enum avr_stop {
+    AVR_RUNNING,
+    AVR_LIMIT,          // ran to the cycle limit avr_run() was given
+    AVR_EXHAUSTED,      // avr_stop() from the sample source
+    AVR_EXIT,           // a write to exit_addr, the value is in exit_code
+    AVR_ASLEEP,         // asleep with nothing left that could wake it
+    AVR_ILLEGAL,        // an opcode the ATTiny85 does not have
+    AVR_BREAK,
+    AVR_BAD_ADDRESS,    // a data access past RAMEND
+};
+
+typedef uint16_t (*avr_sample_fn)(void *ctx);
+typedef void (*avr_trace_fn)(void *ctx, enum avr_event event, uint16_t addr,
+                             uint8_t value);
+
+struct avr_insn {
+    const void *label;  // the handler, once avr_run() has threaded the code
+    uint8_t op;
+    uint8_t plain;      // a fused loop's first instruction on its own
+    uint8_t d, r;       // registers, bit numbers or an I/O address
+    uint16_t k;         // immediate, displacement or target
+    uint8_t words;
+};
+
+struct avr_timer {
+    uint64_t base;      // cycle tcnt was last brought up to
+    uint32_t prescale;  // CPU cycles per count, 0 when stopped
+    uint8_t tcnt;
+    uint8_t top;
+    uint8_t tov_at_top; // overflows at top as well as at 0xFF
+    uint8_t ocr[2];     // compare A and B
+    uint8_t tov, ocf[2];// their bits in TIFR and TIMSK
+    uint64_t due;       // next enabled interrupt, AVR_NEVER for none
+};
+
+struct avr {
+    uint8_t data[AVR_RAMEND + 1];
+    uint8_t flash[AVR_FLASH_SIZE];
+    uint8_t eeprom[AVR_EEPROM_SIZE];
+    struct avr_insn code[AVR_FLASH_WORDS + 1];
+    uint32_t flash_used;        // bytes loaded
+    int threaded;
+
+    uint32_t hz;
+    uint16_t pc;
+    uint64_t cycles;
+    uint64_t next_event;
+    uint64_t limit;
+    enum avr_stop stop;
+    int exit_code;
+    uint8_t irq_hold;           // SEI or RETI: one more instruction first
+    uint8_t sleeping;           // 0, or 1 + the sleep mode
+    uint8_t reset_flags;        // a reset due at the next boundary
+
+    struct avr_timer timer[2];
+
+    uint8_t adc_first;          // the next conversion is the first one
+    uint16_t adc_value;
+    uint64_t adc_due;
+    uint8_t pin_level;          // PB4 as a digital input, from the samples
+    uint64_t poll_due;          // asleep: next look at the button pin
+    uint8_t sample_pending;     // AVR_SAMPLE_*, taken when the source ran out
+
+    uint64_t ee_due;            // EEPE clears
+    uint64_t ee_mpe_until;      // EEMPE clears
+
+    uint64_t wdt_base;          // the watchdog was last reset here
+    uint64_t wdt_due;
+
+    uint16_t vcc_mv;
+    avr_sample_fn sample;
+    void *sample_ctx;
+    avr_trace_fn trace;
+    void *trace_ctx;
+
+    // simulavr style test output, -1 for none
+    int out_addr;
+    int exit_addr;
+    void (*out)(void *ctx, uint8_t c);
+    void *out_ctx;
+
+    uint64_t eeprom_writes[AVR_EEPROM_SIZE];
+};
+
+/**
+ * avr_init()
+ * \param  struct avr *  a   The emulator, all of it is cleared.
+ * \param  uint32_t      hz  CPU clock.
+ */
+void avr_init(struct avr *a, uint32_t hz);
+
+/**
+ * avr_load()
+ * \param  const char *  path  An Intel HEX file, or an AVR ELF image.
+ * \return int  0, or -1 with a message on stderr.
+ *
+ * \brief Loads the flash (text and data) and decodes it.
+ */
+int avr_load(struct avr *a, const char *path);
+
+/**
+ * avr_reset()
+ * \param  uint8_t  flags  MCUSR flags for the cause. AVR_PORF also clears
+ *                         the SRAM, any other keeps it.
+ */
+void avr_reset(struct avr *a, uint8_t flags);
+
+/**
+ * avr_run()
+ * \param  uint64_t  limit  Cycle count to stop at.
+ * \return enum avr_stop  Why it stopped.
+ */
+enum avr_stop avr_run(struct avr *a, uint64_t limit);
+
+/**
+ * avr_stop()
+ *
+ * \brief Stops avr_run() at the end of the current instruction, e.g. from
+ *        the sample source when it runs out.
+ */
+void avr_stop(struct avr *a, enum avr_stop why);
+
+/**
+ * avr_request_reset()
+ *
+ * \brief An external or watchdog reset at the end of the current instruction.
+ */
+void avr_request_reset(struct avr *a, uint8_t flags);
+
+/**
+ * avr_fork()
+ * \param  struct avr *        child   Becomes a copy of parent.
+ * \param  const struct avr *  parent  A stopped emulator.
+ *
+ * \brief Snapshot and fork. The child carries on from exactly where the
+ *        parent stopped: registers, SRAM, EEPROM, peripherals, the events
+ *        due and the cycle count. From there the two are independent and
+ *        can run on different threads. The callbacks are cleared for the
+ *        child to set its own. A parent that stopped for want of samples
+ *        leaves the sample it missed to the child's source.
+ */
+void avr_fork(struct avr *child, const struct avr *parent);
+
+/**
+ * avr_symbol()
+ * \param  const char *  path   An AVR ELF image.
+ * \param  const char *  name   A symbol in it.
+ * \param  uint32_t *    value  Its address: a byte address in the flash,
+ *                              or 0x800000 plus the data address.
+ * \param  uint32_t *    size   Its size in bytes, unless NULL.
+ * \return int  0, or -1 if the image has no such symbol.
+ */
+int avr_symbol(const char *path, const char *name, uint32_t *value, uint32_t *size);
+
+/**
+ * avr_disasm()
+ * \param  uint16_t  pc   Word address.
+ * \param  char *    buf  Filled in with the instruction.
+ * \return int  Words it takes.
+ */
+int avr_disasm(const struct avr *a, uint16_t pc, char *buf, size_t len);
+
+/**
+ * avr_stop_name()
+ * \return const char *  What a stop reason means, for messages.
+ */
+const char *avr_stop_name(enum avr_stop why);
+
+#endif
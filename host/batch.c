@@ -0,0 +1,292 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Batched game core, see batch.h.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#else
+#define BATCH_X86 0
+#endif
+
+#define LCG_MASK (MAX_PERIOD - 1)
+
+static uint32_t lcg(uint32_t x)
+{
+    return (x * MULTIPLIER + C) & LCG_MASK;
+}
+
+// The one hot move the LCG's nth step from start draws
+static uint32_t jump_move(const struct batch *b, uint32_t start, uint32_t n)
+{
+    uint32_t r = (b->jump_a[n] * start + b->jump_b[n]) & LCG_MASK;
+
+    return 1u << ((r * NUM_BUTTONS) >> RANDOM_BITS);
+}
+
+/**
+ * lane_step()
+ *
+ * \brief game_step() for one game, as written in nomis-memory-game.c less
+ *        what doesn't change the game. The AVX2 kernel does the same for
+ *        eight games without the branches.
+ */
+static void lane_step(struct batch *b, size_t i, uint32_t down)
+{
+    uint32_t move;
+
+    switch (b->gamestate[i]) {
+    case IDLE:
+        b->random[i] = (b->random[i] + 1) & 0xFFFF;
+        if (down) {
+            b->prev_move[i] = 0;
+            b->gamestate[i] = CPU;
+            b->start[i] = b->random[i];
+            b->random[i] = lcg(b->random[i]);
+            b->move_ready[i] = 1;
+        }
+        break;
+    case CPU:
+        if (b->cpu_counter[i] == MAX_MOVES) {
+            b->cpu_counter[i] = 0;
+            b->move_ready[i] = 0;
+            b->gamestate[i] = IDLE;
+            break;
+        }
+        if (!b->move_ready[i])
+            b->random[i] = lcg(b->random[i]);
+        b->move_ready[i] = 0;
+        b->cpu_counter[i] += 1;
+        b->gamestate[i] = PLAYER;
+        break;
+    case PLAYER:
+        move = down;
+        if (move == b->prev_move[i])
+            move = 0;
+        else
+            b->prev_move[i] = move;
+        if (move == 0) {
+            if (!b->move_ready[i] && b->cpu_counter[i] != MAX_MOVES) {
+                b->random[i] = lcg(b->random[i]);
+                b->move_ready[i] = 1;
+            }
+        } else if (move == jump_move(b, b->start[i], b->player_counter[i] + 1)) {
+            if (b->player_counter[i] == b->cpu_counter[i] - 1) {
+                b->player_counter[i] = 0;
+                if (!b->move_ready[i] && b->cpu_counter[i] != MAX_MOVES) {
+                    b->random[i] = lcg(b->random[i]);
+                    b->move_ready[i] = 1;
+                }
+                b->gamestate[i] = CPU;
+            } else {
+                b->player_counter[i] += 1;
+            }
+        } else {
+            b->gamestate[i] = LOSE;
+        }
+        break;
+    case LOSE:
+        b->player_counter[i] = 0;
+        b->cpu_counter[i] = 0;
+        b->move_ready[i] = 0;
+        b->gamestate[i] = IDLE;
+        break;
+    }
+}
+
+#if BATCH_X86
+
+#define AND(x, y)    _mm256_and_si256(x, y)
+#define OR(x, y)     _mm256_or_si256(x, y)
+#define ANDNOT(x, y) _mm256_andnot_si256(x, y)     // y and not x
+#define EQ(x, y)     _mm256_cmpeq_epi32(x, y)
+#define ADD(x, y)    _mm256_add_epi32(x, y)
+#define SUB(x, y)    _mm256_sub_epi32(x, y)
+#define PICK(x, y, m) _mm256_blendv_epi8(x, y, m)  // y where m, else x
+#define SET(v)       _mm256_set1_epi32(v)
+#define LOAD(p)      _mm256_load_si256((const __m256i *)(p))
+#define STORE(p, v)  _mm256_store_si256((__m256i *)(p), v)
+
+__attribute__((target("avx2")))
+static inline __m256i lcg_avx2(__m256i x)
+{
+    return AND(ADD(_mm256_mullo_epi32(x, SET(MULTIPLIER)), SET(C)), SET(LCG_MASK));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i expected_avx2(const struct batch *b, __m256i start, __m256i player)
+{
+    __m256i n = ADD(player, SET(1));
+    __m256i a = _mm256_i32gather_epi32((const int *)b->jump_a, n, 4);
+    __m256i c = _mm256_i32gather_epi32((const int *)b->jump_b, n, 4);
+    __m256i r = AND(ADD(_mm256_mullo_epi32(a, start), c), SET(LCG_MASK));
+    __m256i button = _mm256_srli_epi32(_mm256_mullo_epi32(r, SET(NUM_BUTTONS)), RANDOM_BITS);
+
+    return _mm256_sllv_epi32(SET(1), button);
+}
+
+/**
+ * step_avx2()
+ *
+ * \brief lane_step() for eight games at a time. Every game goes through all
+ *        of it, with masks for what its state does, and the moves drawn in
+ *        the step are drawn together at the end.
+ */
+__attribute__((target("avx2")))
+static void step_avx2(struct batch *b, const uint8_t *down)
+{
+    const __m256i zero = _mm256_setzero_si256(), one = SET(1);
+    const __m256i max_moves = SET(MAX_MOVES);
+    size_t i;
+
+    for (i = 0; i < b->padded; i += BATCH_WIDTH) {
+        __m256i random = LOAD(b->random + i), start = LOAD(b->start + i);
+        __m256i cpu = LOAD(b->cpu_counter + i), player = LOAD(b->player_counter + i);
+        __m256i state = LOAD(b->gamestate + i), prev = LOAD(b->prev_move + i);
+        __m256i ready = LOAD(b->move_ready + i);
+        __m256i in = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(down + i)));
+        __m256i idle = EQ(state, SET(IDLE)), in_cpu = EQ(state, SET(CPU));
+        __m256i in_player = EQ(state, SET(PLAYER)), lose = EQ(state, SET(LOSE));
+        __m256i begin, won, play, same, move, none, right, wrong, last, draw, full;
+
+        // IDLE: the seed counts up, and a press starts a game with its
+        // first move drawn
+        random = PICK(random, AND(ADD(random, one), SET(0xFFFF)), idle);
+        begin = ANDNOT(EQ(in, zero), idle);
+        prev = ANDNOT(begin, prev);
+        start = PICK(start, random, begin);
+
+        // CPU: shows the moves, a round past MAX_MOVES is a win
+        won = AND(in_cpu, EQ(cpu, max_moves));
+        play = ANDNOT(won, in_cpu);
+        random = PICK(random, lcg_avx2(random), AND(play, EQ(ready, zero)));
+        cpu = ADD(ANDNOT(won, cpu), AND(play, one));
+
+        // PLAYER: edge detect, then compare and advance
+        same = EQ(in, prev);
+        move = ANDNOT(same, in);
+        prev = PICK(prev, in, ANDNOT(same, in_player));
+        none = AND(in_player, EQ(move, zero));
+        right = AND(ANDNOT(none, in_player), EQ(move, expected_avx2(b, start, player)));
+        wrong = ANDNOT(OR(none, right), in_player);
+        last = AND(right, EQ(player, SUB(cpu, one)));
+        player = ANDNOT(last, ADD(player, AND(right, one)));
+
+        // move_prefetch() for a press in IDLE, a wait or the end of a round
+        full = EQ(cpu, max_moves);
+        draw = OR(begin, ANDNOT(full, AND(OR(none, last), EQ(ready, zero))));
+        random = PICK(random, lcg_avx2(random), draw);
+        ready = ANDNOT(OR(won, play), OR(ready, AND(draw, one)));
+
+        // LOSE: clean up
+        player = ANDNOT(lose, player);
+        cpu = ANDNOT(lose, cpu);
+        ready = ANDNOT(lose, ready);
+
+        state = PICK(state, SET(CPU), OR(begin, last));
+        state = PICK(state, SET(IDLE), OR(won, lose));
+        state = PICK(state, SET(PLAYER), play);
+        state = PICK(state, SET(LOSE), wrong);
+
+        STORE(b->random + i, random);
+        STORE(b->start + i, start);
+        STORE(b->cpu_counter + i, cpu);
+        STORE(b->player_counter + i, player);
+        STORE(b->gamestate + i, state);
+        STORE(b->prev_move + i, prev);
+        STORE(b->move_ready + i, ready);
+    }
+}
+
+#endif
+
+void batch_step(struct batch *b, const uint8_t *down)
+{
+    size_t i;
+
+#if BATCH_X86
+    if (b->avx2) {
+        step_avx2(b, down);
+        return;
+    }
+#endif
+    for (i = 0; i < b->padded; i++)
+        lane_step(b, i, down[i]);
+}
+
+void batch_expected(const struct batch *b, uint8_t *moves)
+{
+    size_t i;
+
+    for (i = 0; i < b->padded; i++) {
+        moves[i] = b->gamestate[i] == PLAYER ?
+            jump_move(b, b->start[i], b->player_counter[i] + 1) : 0;
+    }
+}
+
+void batch_seed(struct batch *b, size_t lane, uint16_t seed)
+{
+    b->random[lane] = seed;
+    b->start[lane] = seed;
+    b->cpu_counter[lane] = 0;
+    b->player_counter[lane] = 0;
+    b->gamestate[lane] = IDLE;
+    b->prev_move[lane] = 0;
+    b->move_ready[lane] = 0;
+}
+
+int batch_init(struct batch *b, size_t lanes, int simd)
+{
+    uint32_t **fields[] = {
+        &b->random, &b->start, &b->cpu_counter, &b->player_counter,
+        &b->gamestate, &b->prev_move, &b->move_ready,
+    };
+    size_t i, n;
+
+    memset(b, 0, sizeof(*b));
+    b->lanes = lanes;
+    b->padded = (lanes + BATCH_WIDTH - 1) / BATCH_WIDTH * BATCH_WIDTH;
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        *fields[i] = aligned_alloc(32, (b->padded ? b->padded : BATCH_WIDTH) * sizeof(uint32_t));
+        if (!*fields[i]) {
+            batch_free(b);
+            return -1;
+        }
+    }
+    for (i = 0; i < b->padded; i++)
+        batch_seed(b, i, 0xFFFF);
+
+    // LCG^n(x) = A[n] x + B[n]: A[n] = MULTIPLIER^n, B[n] = MULTIPLIER B[n-1] + C
+    b->jump_a[0] = 1;
+    b->jump_b[0] = 0;
+    for (n = 1; n <= MAX_MOVES; n++) {
+        b->jump_a[n] = (b->jump_a[n - 1] * MULTIPLIER) & LCG_MASK;
+        b->jump_b[n] = lcg(b->jump_b[n - 1]);
+    }
+
+#if BATCH_X86
+    b->avx2 = simd && __builtin_cpu_supports("avx2");
+#else
+    (void)simd;
+#endif
+    return 0;
+}
+
+void batch_free(struct batch *b)
+{
+    free(b->random);
+    free(b->start);
+    free(b->cpu_counter);
+    free(b->player_counter);
+    free(b->gamestate);
+    free(b->prev_move);
+    free(b->move_ready);
+    memset(b, 0, sizeof(*b));
+}
@@ -0,0 +1,86 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Batched game core, for sweeps over thousands of games at once: every
+ * seed, a fleet of player models. The state game_step() works on is kept
+ * for all the games in arrays, one per field (structure of arrays), and
+ * batch_step() steps them all together, eight at a time with AVX2 where the
+ * CPU has it.
+ *
+ * A step is one game_step() for each game, given the buttons that are down
+ * for it in place of the ADC readings. It leaves random, cpu_counter,
+ * player_counter, gamestate, prev_move and move_ready just as the firmware
+ * would; batchtest checks every game against the firmware itself built for
+ * the host. What doesn't change the game is left out: the LEDs, the tones,
+ * the delays, the EEPROM, idle_frames and the power down in IDLE.
+ *
+ * The moves are not stored. The firmware draws move i on the LCG's
+ * (i + 1)th step from where random was when the game started, so each game
+ * keeps that (start) and the move its player is on is worked out from it
+ * with a jump ahead table, LCG^n(x) = (A[n] x + B[n]) mod MAX_PERIOD. A
+ * game is a few words, and thousands of them stay in the cache.
+ */
+#ifndef NOMIS_BATCH_H
+#define NOMIS_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../nomis-memory-game.h"
+
+#define BATCH_WIDTH 8   // games a kernel steps at once, 32 bits each
+
+struct batch {
+    size_t lanes;               // games, the arrays are padded to BATCH_WIDTH
+    size_t padded;
+    uint32_t *random;
+    uint32_t *start;            // random when the game started
+    uint32_t *cpu_counter;
+    uint32_t *player_counter;
+    uint32_t *gamestate;
+    uint32_t *prev_move;
+    uint32_t *move_ready;
+    uint32_t jump_a[MAX_MOVES + 1];
+    uint32_t jump_b[MAX_MOVES + 1];
+    int avx2;                   // stepping with the AVX2 kernels
+};
+
+/**
+ * batch_init()
+ * \param  size_t  lanes  How many games.
+ * \param  int     simd   1 to use AVX2 when the CPU has it, 0 for the
+ *                        portable code.
+ * \return int  0, or -1 if out of memory.
+ *
+ * \brief Every game starts as game_init() leaves it with a blank EEPROM,
+ *        batch_seed() sets another seed.
+ */
+int batch_init(struct batch *b, size_t lanes, int simd);
+
+void batch_free(struct batch *b);
+
+/**
+ * batch_seed()
+ *
+ * \brief Starts a game over as game_init() would with seed at SEED_ADDR.
+ */
+void batch_seed(struct batch *b, size_t lane, uint16_t seed);
+
+/**
+ * batch_step()
+ * \param  const uint8_t *  down  For each game, the buttons that are down,
+ *                                one hot, or 0. Padded to BATCH_WIDTH.
+ *
+ * \brief One game_step() for every game.
+ */
+void batch_step(struct batch *b, const uint8_t *down);
+
+/**
+ * batch_expected()
+ * \param  uint8_t *  moves  For each game, the move its player has to make
+ *                           next, one hot, or 0 outside PLAYER.
+ */
+void batch_expected(const struct batch *b, uint8_t *moves);
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Checks the batched game core (batch.h) against the firmware, and times it.
+ * Every lane is a game with its own seed and its own player: a small random
+ * model that mostly presses the right button and lets go in between, now and
+ * then holds a button, and, except for one lane in eight that plays
+ * perfectly through to a win, sometimes presses the wrong one.
+ *
+ * The lanes are stepped in lockstep three ways: by the firmware's own
+ * game_step(), one game at a time, by the portable batch code and by the
+ * AVX2 kernels (when the CPU has AVX2). After every step random,
+ * cpu_counter, player_counter, gamestate, prev_move and move_ready have to
+ * be the same in all three, and the move batch_expected() gives the same as
+ * get_move(). -n leaves the firmware out, for lane counts it would take too
+ * long over.
+ *
+ * Exits 1 on the first difference.
+ *
+ * Usage: batchtest [-l lanes] [-s steps] [-n]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+struct lane {
+    uint32_t rng;       // the player model's xorshift
+    uint8_t down;       // buttons it is holding down
+    uint8_t perfect;
+};
+
+static uint16_t input;  // the sample the firmware lane being stepped reads
+
+static uint16_t test_sample(void *ctx)
+{
+    (void)ctx;
+    return input;
+}
+
+static uint32_t xorshift(uint32_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static int button_of(uint8_t move)
+{
+    int n;
+
+    for (n = 0; move >>= 1; n++)
+        ;
+    return n;
+}
+
+// What the player does next, given the move it should make (0 outside PLAYER)
+static uint8_t player_model(struct lane *p, uint32_t state, uint8_t expected)
+{
+    uint32_t r = xorshift(&p->rng);
+
+    if (state == IDLE) {
+        p->down = (r & 3) ? 0 : 1 << ((r >> 8) % NUM_BUTTONS);
+    } else if (state != PLAYER) {
+        p->down = 0;
+    } else if (p->perfect) {
+        p->down = p->down == expected ? 0 : expected;
+    } else if ((r & 63) == 0) {
+        // Any button but the right one
+        p->down = 1 << ((button_of(expected) + 1 + (r >> 8) % (NUM_BUTTONS - 1)) % NUM_BUTTONS);
+    } else if ((r & 15) < 4) {
+        p->down = 0;
+    } else if ((r & 15) > 4) {
+        p->down = expected;
+    }
+    return p->down;
+}
+
+static double elapsed(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int compare(const struct batch *b, size_t l, uint32_t random,
+                   uint32_t cpu, uint32_t player, uint32_t state,
+                   uint32_t prev, uint32_t ready)
+{
+    return b->random[l] == random && b->cpu_counter[l] == cpu
+        && b->player_counter[l] == player && b->gamestate[l] == state
+        && b->prev_move[l] == prev && b->move_ready[l] == ready;
+}
+
+static void report(const char *what, unsigned long step, size_t l,
+                   const struct batch *b)
+{
+    printf("FAIL: %s, step %lu lane %zu: random %u cpu %u player %u state %u"
+           " prev %u ready %u\n", what, step, l, b->random[l],
+           b->cpu_counter[l], b->player_counter[l], b->gamestate[l],
+           b->prev_move[l], b->move_ready[l]);
+}
+
+int main(int argc, char **argv)
+{
+    size_t lanes = 256, l;
+    unsigned long steps = 10000, step, wins = 0, losses = 0;
+    int firmware = 1, opt;
+    struct batch ref, simd;
+    struct game *saved;
+    struct lane *players;
+    uint8_t *down, *expected;
+    double t_firmware = 0, t_ref = 0, t_simd = 0;
+    struct timespec t0;
+
+    while ((opt = getopt(argc, argv, "l:s:n")) != -1) {
+        switch (opt) {
+        case 'l':
+            lanes = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            steps = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            firmware = 0;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l lanes] [-s steps] [-n]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (batch_init(&ref, lanes, 0) || batch_init(&simd, lanes, 1)) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    saved = calloc(lanes, sizeof(*saved));
+    players = calloc(ref.padded, sizeof(*players));
+    down = calloc(ref.padded + BATCH_WIDTH, 1);
+    expected = calloc(ref.padded, 1);
+    if (!saved || !players || !down || !expected) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    for (l = 0; l < lanes; l++) {
+        uint16_t seed = l * 40503u;
+
+        batch_seed(&ref, l, seed);
+        batch_seed(&simd, l, seed);
+        players[l].rng = l * 2654435761u + 1;
+        players[l].perfect = l % 8 == 0;
+
+        sim.eeprom[SEED_ADDR] = seed & 0xFF;
+        sim.eeprom[SEED_ADDR + 1] = seed >> 8;
+        sim_reset(test_sample, NULL);
+        io_init();
+        settings_load();
+        game_init();
+        saved[l] = game;
+    }
+
+    for (step = 0; step < steps; step++) {
+        batch_expected(&ref, expected);
+        for (l = 0; l < lanes; l++) {
+            if (firmware && ref.gamestate[l] == PLAYER) {
+                game = saved[l];
+                if (expected[l] != get_move(game.player_counter)) {
+                    report("expected move differs from the firmware's", step, l, &ref);
+                    return 1;
+                }
+            }
+            if (ref.gamestate[l] == LOSE)
+                losses += 1;
+            else if (ref.gamestate[l] == CPU && ref.cpu_counter[l] == MAX_MOVES)
+                wins += 1;
+            down[l] = player_model(&players[l], ref.gamestate[l], expected[l]);
+        }
+
+        if (firmware) {
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (l = 0; l < lanes; l++) {
+                game = saved[l];
+                input = down[l] ? BUTTON_ADC(button_of(down[l])) : 0;
+                game_step();
+                saved[l] = game;
+            }
+            t_firmware += elapsed(&t0);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        batch_step(&ref, down);
+        t_ref += elapsed(&t0);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        batch_step(&simd, down);
+        t_simd += elapsed(&t0);
+
+        for (l = 0; l < lanes; l++) {
+            if (!compare(&simd, l, ref.random[l], ref.cpu_counter[l],
+                         ref.player_counter[l], ref.gamestate[l],
+                         ref.prev_move[l], ref.move_ready[l])) {
+                report("AVX2 differs from the portable code", step, l, &simd);
+                return 1;
+            }
+            if (firmware && !compare(&ref, l, saved[l].random, saved[l].cpu_counter,
+                                     saved[l].player_counter, saved[l].gamestate,
+                                     saved[l].prev_move, saved[l].move_ready)) {
+                report("differs from the firmware", step, l, &ref);
+                printf("      firmware: random %u cpu %u player %u state %u"
+                       " prev %u ready %u\n", saved[l].random,
+                       saved[l].cpu_counter, saved[l].player_counter,
+                       saved[l].gamestate, saved[l].prev_move,
+                       saved[l].move_ready);
+                return 1;
+            }
+        }
+    }
+
+    printf("%zu games, %lu steps: %lu won, %lu lost\n", lanes, steps, wins, losses);
+    if (firmware)
+        printf("  firmware  %8.3fs %12.0f game steps/s\n", t_firmware,
+               lanes * steps / t_firmware);
+    printf("  portable  %8.3fs %12.0f game steps/s\n", t_ref, lanes * steps / t_ref);
+    printf("  %-8s  %8.3fs %12.0f game steps/s\n", simd.avx2 ? "avx2" : "(no avx2)",
+           t_simd, lanes * steps / t_simd);
+    printf("ok\n");
+
+    batch_free(&ref);
+    batch_free(&simd);
+    free(saved);
+    free(players);
+    free(down);
+    free(expected);
+    return 0;
+}
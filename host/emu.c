@@ -0,0 +1,514 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Runs a built firmware image on the ATTiny85 emulator (avr.h), the real
+ * instructions at the real cycle counts, many times faster than the part.
+ *
+ *   emu [-F hz] [-j threads] [-p] [-v] [-D] [-m ns] image [script.in [fork.in...]]
+ *
+ *   -F hz       CPU clock (default 1000000, the fuses the Makefile sets)
+ *   -j threads  how many forks run at once (default all cores)
+ *   -p          print the trace, in the format of host/trace -p
+ *   -v          how far and how fast it ran, on stderr
+ *   -D          disassemble the image instead of running it
+ *   -m ns       stop each run after ns of simulated time
+ *
+ * The scripts are trace.c's: seed, release, press, play, miss, vcc and
+ * reset (an external reset at the next sample). play and miss need to know
+ * which move the game expects, so they take an ELF image: its game symbol
+ * says where struct game is in the SRAM. Without a script the buttons stay
+ * up and the run ends at -m.
+ *
+ * With more than one script the first runs from power on and each of the
+ * others is a fork of the device where the first one ended, run on its own
+ * copy of it (avr_fork()), so e.g. a script that plays to move 98 is only
+ * run once for any number of ways to play moves 99 to 101. The forks run in
+ * parallel; their traces come out in the order they were given, each after
+ * a line naming it.
+ *
+ * It also takes the simulavr options test/run.sh uses, so the firmware
+ * unit tests run on it with make test SIMULAVR=host/emu:
+ *
+ *   -d attiny85   -f image   -W 0x20,-   -e 0x21
+ *
+ * Exits with the value written to the -e address, 1 if a run stops on
+ * something it shouldn't (an illegal instruction, a stray pointer), or 0.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avr.h"
+#include "../nomis-memory-game.h"
+
+#define EMU_MAX_COMMANDS 256
+
+enum emu_op {
+    OP_RELEASE,
+    OP_PRESS,
+    OP_PLAY,
+    OP_MISS,
+    OP_RESET,
+    OP_VCC,
+};
+
+struct emu_command {
+    enum emu_op op;
+    uint16_t button;
+    uint32_t count;
+};
+
+struct emu_script {
+    struct emu_command commands[EMU_MAX_COMMANDS];
+    int n;
+    int pos;
+    uint32_t left;
+    uint8_t released;   // play/miss has let go of the last button
+    int seed;           // -1 to keep the EEPROM as it is
+};
+
+// One run of the device: from power on, or forked from the first run
+struct emu_run {
+    struct avr avr;
+    struct emu_script script;
+    const char *name;
+    FILE *trace;
+    char *text;         // the trace, for the forks that run in parallel
+    size_t text_len;
+    enum avr_stop why;
+    double host_s;
+};
+
+static const char *event_names[] = {
+    [AVR_PORTB] = "PORTB",
+    [AVR_DDRB] = "DDRB",
+    [AVR_TCCR0A] = "TCCR0A",
+    [AVR_TCCR1] = "TCCR1",
+    [AVR_OCR0A] = "OCR0A",
+    [AVR_EEPROM] = "EEPROM",
+};
+
+static int game_addr = -1;      // struct game in the SRAM, from the image
+static int print, verbose;
+static uint64_t limit_ns;
+
+static struct emu_run *forks;
+static int nforks, next_fork;
+static pthread_mutex_t fork_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t emu_us(const struct avr *a)
+{
+    return a->cycles * 1000000 / a->hz;
+}
+
+static void emu_record(void *ctx, enum avr_event event, uint16_t addr, uint8_t value)
+{
+    struct emu_run *run = ctx;
+
+    if (event == AVR_EEPROM)
+        fprintf(run->trace, "%10llu EEPROM[%u] 0x%02X\n",
+                (unsigned long long)emu_us(&run->avr), addr, value);
+    else
+        fprintf(run->trace, "%10llu %s 0x%02X\n", (unsigned long long)emu_us(&run->avr),
+                event_names[event], value);
+}
+
+static void emu_out(void *ctx, uint8_t c)
+{
+    putchar(c);
+}
+
+// The button the game expects next, read out of its SRAM
+static uint8_t emu_expected(const struct avr *a)
+{
+    const uint8_t *g = a->data + game_addr;
+    uint16_t i = g[GAME_AVR_PLAYER_COUNTER] | g[GAME_AVR_PLAYER_COUNTER + 1] << 8;
+    uint8_t move, button = 0;
+
+    if (i >= MAX_MOVES)
+        return 0;
+#if MOVES_PACKED
+    move = 0x01 << ((g[i >> 2] >> ((i & 0x03) << 1)) & 0x03);
+#else
+    move = g[i];
+#endif
+    while (move >>= 1)
+        button++;
+    return button;
+}
+
+static uint16_t emu_next_sample(void *ctx)
+{
+    struct emu_run *run = ctx;
+    struct emu_script *s = &run->script;
+    struct avr *a = &run->avr;
+    struct emu_command *c;
+    uint8_t button;
+
+    while (s->pos < s->n) {
+        c = &s->commands[s->pos];
+        if (s->left == 0 || ((c->op == OP_PLAY || c->op == OP_MISS) &&
+                             a->data[game_addr + GAME_AVR_GAMESTATE] != PLAYER)) {
+            s->pos += 1;
+            s->left = s->pos < s->n ? s->commands[s->pos].count : 0;
+            s->released = 0;
+            continue;
+        }
+
+        switch (c->op) {
+        case OP_RELEASE:
+            s->left -= 1;
+            return 0;
+        case OP_PRESS:
+            s->left -= 1;
+            return BUTTON_ADC(c->button % NUM_BUTTONS);
+        case OP_PLAY:
+        case OP_MISS:
+            // Release first, so the press is always seen as a new edge
+            s->released = !s->released;
+            if (s->released)
+                return 0;
+            s->left -= 1;
+            button = emu_expected(a);
+            if (c->op == OP_MISS)
+                button += 1;
+            return BUTTON_ADC(button % NUM_BUTTONS);
+        case OP_RESET:
+            s->left -= 1;
+            avr_request_reset(a, AVR_EXTRF);
+            break;
+        case OP_VCC:
+            s->left -= 1;
+            a->vcc_mv = c->button;
+            break;
+        }
+    }
+    avr_stop(a, AVR_EXHAUSTED);
+    return 0;
+}
+
+static uint16_t emu_no_buttons(void *ctx)
+{
+    return 0;
+}
+
+static int emu_parse(const char *path, struct emu_script *s)
+{
+    char line[128], op[16];
+    unsigned a, b;
+    int lineno = 0, args;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    s->seed = -1;
+    while (fgets(line, sizeof(line), f)) {
+        struct emu_command *c = &s->commands[s->n];
+
+        lineno += 1;
+        line[strcspn(line, "#")] = '\0';
+        args = sscanf(line, "%15s %i %i", op, &a, &b);
+        if (args <= 0)
+            continue;
+        if (s->n == EMU_MAX_COMMANDS) {
+            fprintf(stderr, "%s:%d: too many commands\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        if (!strcmp(op, "seed") && args == 2) {
+            s->seed = a & 0xFFFF;
+            continue;
+        } else if (!strcmp(op, "release") && args == 2) {
+            *c = (struct emu_command){ OP_RELEASE, 0, a };
+        } else if (!strcmp(op, "press") && args == 3) {
+            *c = (struct emu_command){ OP_PRESS, a, b };
+        } else if (!strcmp(op, "play") && args == 2) {
+            *c = (struct emu_command){ OP_PLAY, 0, a };
+        } else if (!strcmp(op, "miss") && args == 1) {
+            *c = (struct emu_command){ OP_MISS, 0, 1 };
+        } else if (!strcmp(op, "reset") && args == 1) {
+            *c = (struct emu_command){ OP_RESET, 0, 1 };
+        } else if (!strcmp(op, "vcc") && args == 2) {
+            *c = (struct emu_command){ OP_VCC, a, 1 };
+        } else {
+            fprintf(stderr, "%s:%d: bad command\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        if ((c->op == OP_PLAY || c->op == OP_MISS) && game_addr < 0) {
+            fprintf(stderr, "%s:%d: %s needs an ELF image with the game symbol\n",
+                    path, lineno, op);
+            fclose(f);
+            return -1;
+        }
+        s->n += 1;
+    }
+    fclose(f);
+    s->left = s->n ? s->commands[0].count : 0;
+    return 0;
+}
+
+static void emu_disasm(const struct avr *a)
+{
+    char text[64];
+    uint16_t pc, words;
+
+    for (pc = 0; pc < a->flash_used / 2; pc += words) {
+        words = avr_disasm(a, pc, text, sizeof(text));
+        if (words == 2)
+            printf("%6x:\t%02x %02x %02x %02x\t%s\n", pc * 2, a->flash[2 * pc],
+                   a->flash[2 * pc + 1], a->flash[2 * pc + 2], a->flash[2 * pc + 3], text);
+        else
+            printf("%6x:\t%02x %02x      \t%s\n", pc * 2, a->flash[2 * pc],
+                   a->flash[2 * pc + 1], text);
+    }
+}
+
+/**
+ * emu_run()
+ *
+ * \brief Runs the script (if any) on run->avr, as set up or forked, for up
+ *        to -m more of simulated time.
+ */
+static void emu_run(struct emu_run *run)
+{
+    struct avr *a = &run->avr;
+    struct timespec t0, t1;
+    uint64_t limit = AVR_NEVER;
+
+    a->sample = run->script.n ? emu_next_sample : emu_no_buttons;
+    a->sample_ctx = run;
+    a->out = emu_out;
+    if (print) {
+        a->trace = emu_record;
+        a->trace_ctx = run;
+    }
+    if (run->script.seed >= 0) {
+        a->eeprom[SEED_ADDR] = run->script.seed & 0xFF;
+        a->eeprom[SEED_ADDR + 1] = run->script.seed >> 8;
+    }
+    if (limit_ns)
+        limit = a->cycles + limit_ns * a->hz / 1000000000;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    run->why = avr_run(a, limit);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    run->host_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (print)
+        fprintf(run->trace, "%10llu END\n", (unsigned long long)emu_us(a));
+}
+
+static void *emu_worker(void *arg)
+{
+    const struct avr *parent = arg;
+    struct emu_run *run;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&fork_lock);
+        i = next_fork++;
+        pthread_mutex_unlock(&fork_lock);
+        if (i >= nforks)
+            return NULL;
+        run = &forks[i];
+        avr_fork(&run->avr, parent);
+        run->trace = open_memstream(&run->text, &run->text_len);
+        if (!run->trace) {
+            perror("open_memstream");
+            exit(2);
+        }
+        emu_run(run);
+        fclose(run->trace);
+    }
+}
+
+// Reports how a run went, and returns the exit status it makes for
+static int emu_report(struct emu_run *run, uint64_t from)
+{
+    const struct avr *a = &run->avr;
+    uint64_t cycles = a->cycles - from;
+    double sim_s = (double)cycles / a->hz;
+    char where[64];
+
+    if (verbose) {
+        fprintf(stderr, "%s: %s after %llu cycles, %.3fs simulated in %.3fs: %.1f MHz, %.0fx real time\n",
+                run->name, avr_stop_name(run->why), (unsigned long long)cycles, sim_s,
+                run->host_s, run->host_s > 0 ? cycles / run->host_s / 1e6 : 0,
+                run->host_s > 0 ? sim_s / run->host_s : 0);
+    }
+    switch (run->why) {
+    case AVR_EXIT:
+        return a->exit_code;
+    case AVR_ILLEGAL:
+    case AVR_BREAK:
+    case AVR_BAD_ADDRESS:
+        avr_disasm(a, a->pc, where, sizeof(where));
+        fprintf(stderr, "%s: %s at 0x%04x (%s), cycle %llu\n", run->name,
+                avr_stop_name(run->why), a->pc * 2, where, (unsigned long long)a->cycles);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: emu [-F hz] [-j threads] [-p] [-v] [-D] [-m ns] "
+            "image [script.in [fork.in...]]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static struct emu_run first;
+    const char *image = NULL;
+    uint32_t hz = 1000000, addr, size;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int disasm = 0, opt, status, i;
+    int out_addr = -1, exit_addr = -1;
+    pthread_t *workers;
+    struct timespec t0, t1;
+    double wall_s, cpu_s;
+
+    while ((opt = getopt(argc, argv, "F:j:pvDm:d:f:W:e:")) != -1) {
+        switch (opt) {
+        case 'F':
+            hz = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            threads = strtol(optarg, NULL, 0);
+            break;
+        case 'p':
+            print = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'D':
+            disasm = 1;
+            break;
+        case 'm':
+            limit_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            if (strcmp(optarg, "attiny85")) {
+                fprintf(stderr, "emu: only the attiny85\n");
+                return 2;
+            }
+            break;
+        case 'f':
+            image = optarg;
+            break;
+        case 'W':
+            // simulavr's -W addr,file: only stdout ("-")
+            out_addr = strtol(optarg, NULL, 0);
+            break;
+        case 'e':
+            exit_addr = strtol(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!image && optind < argc)
+        image = argv[optind++];
+    if (!image || !hz || threads < 1)
+        usage();
+
+    avr_init(&first.avr, hz);
+    first.avr.out_addr = out_addr;
+    first.avr.exit_addr = exit_addr;
+    if (avr_load(&first.avr, image))
+        return 2;
+    if (disasm) {
+        emu_disasm(&first.avr);
+        return 0;
+    }
+    if (!avr_symbol(image, "game", &addr, &size) && addr >= 0x800000 &&
+        (addr & 0xFFFF) + GAME_AVR_SIZE <= AVR_RAMEND + 1) {
+        // The offsets are this build's, they only hold for an image built
+        // with the same MAX_MOVES and MOVES_PACKED
+        if (size != GAME_AVR_SIZE) {
+            fprintf(stderr, "%s: struct game is %u bytes, this emu expects %d: "
+                    "rebuild it with the image's DEFS\n",
+                    image, (unsigned)size, GAME_AVR_SIZE);
+            return 2;
+        }
+        game_addr = addr & 0xFFFF;
+    }
+
+    first.name = image;
+    first.script.seed = 0xFFFF;
+    if (optind < argc) {
+        first.name = argv[optind];
+        if (emu_parse(argv[optind++], &first.script))
+            return 2;
+        if (first.script.seed < 0)
+            first.script.seed = 0xFFFF;
+    } else if (!limit_ns) {
+        limit_ns = 60000000000ULL;
+    }
+    nforks = argc - optind;
+    forks = calloc(nforks, sizeof(*forks));
+    if (nforks && !forks) {
+        perror("calloc");
+        return 2;
+    }
+    for (i = 0; i < nforks; i++) {
+        forks[i].name = argv[optind + i];
+        if (emu_parse(forks[i].name, &forks[i].script))
+            return 2;
+    }
+
+    first.avr.vcc_mv = 3000;
+    first.trace = stdout;
+    avr_reset(&first.avr, AVR_PORF);
+    emu_run(&first);
+    fflush(stdout);
+    status = emu_report(&first, 0);
+    if (!nforks)
+        return status;
+
+    // Every fork starts from where the first run stopped
+    if (threads > nforks)
+        threads = nforks;
+    workers = malloc(threads * sizeof(*workers));
+    if (!workers) {
+        perror("malloc");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < threads; i++)
+        pthread_create(&workers[i], NULL, emu_worker, &first.avr);
+    for (i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wall_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    cpu_s = 0;
+    for (i = 0; i < nforks; i++) {
+        if (print) {
+            printf("# fork %s\n", forks[i].name);
+            fwrite(forks[i].text, 1, forks[i].text_len, stdout);
+        }
+        free(forks[i].text);
+        cpu_s += forks[i].host_s;
+        if (emu_report(&forks[i], first.avr.cycles) && !status)
+            status = 1;
+    }
+    if (verbose)
+        fprintf(stderr, "%d forks in %.3fs on %ld threads (%.3fs of runs)\n",
+                nforks, wall_s, threads, cpu_s);
+    free(workers);
+    free(forks);
+    return status;
+}
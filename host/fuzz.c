@@ -0,0 +1,286 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Coverage guided fuzzing target for the game state machine. Builds as a
+ * libFuzzer target (make fuzz), as an AFL target (make fuzz-afl) or as a
+ * plain replay tool that runs the files named on the command line, or stdin
+ * if there are none (make fuzz-replay).
+ *
+ * The fuzzer's input is read as a stream of one byte opcodes. The top three
+ * bits pick the operation and the bottom five bits are its argument:
+ *
+ *   0  release      ADC reads arg, i.e. no button or a little noise
+ *   1-4 press       button (op - 1) + (arg & 0x10 ? 4 : 0), modulo
+ *                   NUM_BUTTONS. ADC reads the middle of its ladder window
+ *                   plus (arg & 0x0F) * 2 - 15, so both window edges get
+ *                   exercised
+ *   5  play         arg + 1 correct presses (each after a release) of
+ *                   whatever the game expects next. Lets the fuzzer reach
+ *                   deep levels without having to guess the whole sequence
+ *   6  raw          the next byte completes a raw 10-bit sample,
+ *                   (arg << 5) | (next & 0x1F)
+ *   7  control      arg bit 0: warm reset, the game must resume from SRAM.
+ *                   arg bit 2: the next byte flips a bit of the game
+ *                   before the warm reset, which must then start over.
+ *                   arg bit 1: power on reset, after the next two bytes are
+ *                   written to the seed in EEPROM.
+ *                   arg bit 3: the next byte, before any of the above,
+ *                   sets VCC to 1800 + byte * 8 mV
+ *                   arg bit 4: warm reset at the next delay or sleep, in
+ *                   the middle of a step. The game as it was there must
+ *                   resume.
+ *
+ * The first two bytes of the input are the EEPROM seed at power up. The run
+ * stops once the input runs out. Invariant violations call abort(), which
+ * both fuzzers report as a crash; build with sanitizers to catch the rest.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+struct fuzz_input {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint8_t play_left;      // correct presses still to make for op 5
+    uint8_t play_released;  // op 5 has let go of the last button
+    uint8_t reset;          // op 7 asked for a reset after this step
+    int16_t flip;           // bit of the game to flip before it, or -1
+    uint8_t mid;            // 1: reset at the next delay, 2: taken there
+    struct game mid_game;   // the game as that reset found it
+};
+
+#define RESET_WARM     1
+#define RESET_POWER_ON 2
+
+static void fuzz_check_invariants()
+{
+    if (game.gamestate > LOSE)
+        abort();
+    if (game.cpu_counter > MAX_MOVES)
+        abort();
+    if (game.gamestate == PLAYER && game.player_counter >= game.cpu_counter)
+        abort();
+    if ((game.gamestate == IDLE || game.gamestate == CPU) && game.player_counter != 0)
+        abort();
+    if (game.gamestate == PLAYER && game.random >= MAX_PERIOD)
+        abort();
+}
+
+/**
+ * fuzz_reset()
+ *
+ * \brief Resets the way main() does. The game was sealed after the last
+ *        step, so a warm reset has to resume it exactly, unless a bit of it
+ *        was flipped, in which case the CRC has to turn it down.
+ */
+static void fuzz_reset(struct fuzz_input *in)
+{
+    struct game before = game;
+    // Flipping cpu_counter changes how many moves the CRC covers, which a
+    // 16 bit CRC only catches 65535 times in 65536, so it is left alone
+    uint8_t *p = (uint8_t *) &game.player_counter;
+    size_t len = (uint8_t *) &game.crc - p;
+
+    if (in->reset == RESET_POWER_ON) {
+        game_init();
+    } else if (in->flip >= 0) {
+        p[(in->flip >> 3) % len] ^= 1 << (in->flip & 7);
+        if (game_resume())
+            abort();
+        game_init();
+    } else {
+        if (!game_resume())
+            abort();
+        if (memcmp(&before, &game, sizeof(game)))
+            abort();
+    }
+    in->reset = 0;
+    in->flip = -1;
+}
+
+// A delay or sleep started: where a reset asked for with op 7 bit 4 lands
+static void fuzz_wait(void *ctx)
+{
+    struct fuzz_input *in = ctx;
+
+    if (in->mid == 1) {
+        in->mid_game = game;
+        in->mid = 2;
+    }
+}
+
+/**
+ * fuzz_reset_mid()
+ *
+ * \brief game_step() seals the game before every delay and sleep, so the
+ *        game as a reset there found it has to resume, and is carried on
+ *        with from there.
+ */
+static void fuzz_reset_mid(struct fuzz_input *in)
+{
+    game = in->mid_game;
+    if (!game_resume())
+        abort();
+    in->mid = 0;
+}
+
+static uint16_t fuzz_move_sample(uint8_t move)
+{
+    uint8_t button = 0;
+    while (move >>= 1)
+        button++;
+    return BUTTON_ADC(button % NUM_BUTTONS);
+}
+
+static uint16_t fuzz_next_sample(void *ctx)
+{
+    struct fuzz_input *in = ctx;
+    uint8_t op, arg, button;
+
+    for (;;) {
+        if (in->play_left) {
+            if (game.gamestate != PLAYER) {
+                // Nothing to play along to yet, a press starts the game
+                in->play_left = 0;
+                return BUTTON_ADC(0);
+            }
+            // Release first, so the press is always seen as a new edge
+            in->play_released = !in->play_released;
+            if (in->play_released)
+                return 0;
+            in->play_left -= 1;
+            return fuzz_move_sample(get_move(game.player_counter));
+        }
+
+        if (in->pos >= in->size) {
+            sim.exhausted = 1;
+            return 0;
+        }
+
+        op = in->data[in->pos] >> 5;
+        arg = in->data[in->pos] & 0x1F;
+        in->pos += 1;
+
+        switch (op) {
+        case 0:
+            return arg;
+        case 1: case 2: case 3: case 4:
+            button = ((op - 1) + ((arg & 0x10) >> 2)) % NUM_BUTTONS;
+            return BUTTON_ADC(button) + (arg & 0x0F) * 2 - 15;
+        case 5:
+            in->play_left = arg + 1;
+            in->play_released = 0;
+            break;
+        case 6:
+            if (in->pos >= in->size)
+                return arg << 5;
+            return (arg << 5) | (in->data[in->pos++] & 0x1F);
+        default:
+            if ((arg & 0x08) && in->pos < in->size)
+                sim.vcc_mv = 1800 + in->data[in->pos++] * 8;
+            if (arg & 0x10)
+                in->mid = 1;
+            // These resets wait until the step is done
+            if (arg & 0x02) {
+                if (in->pos + 2 <= in->size) {
+                    sim.eeprom[SEED_ADDR] = in->data[in->pos];
+                    sim.eeprom[SEED_ADDR + 1] = in->data[in->pos + 1];
+                    in->pos += 2;
+                }
+                in->reset = RESET_POWER_ON;
+            } else if (arg & 0x05) {
+                if ((arg & 0x04) && in->pos < in->size)
+                    in->flip = in->data[in->pos++];
+                in->reset = RESET_WARM;
+            }
+            break;
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct fuzz_input in;
+    uint32_t steps = 0;
+
+    memset(&in, 0, sizeof(in));
+    in.flip = -1;
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    if (size >= 2) {
+        sim.eeprom[SEED_ADDR] = data[0];
+        sim.eeprom[SEED_ADDR + 1] = data[1];
+        in.pos = 2;
+    }
+    in.data = data;
+    in.size = size;
+
+    sim_reset(fuzz_next_sample, &in);
+    sim.wait = fuzz_wait;
+    sim.wait_ctx = &in;
+    io_init();
+    settings_load();
+    game_init();
+
+    // Every op makes at most 64 samples, and the CPU state never makes more
+    // than one step in a row, so this only trips if the game stops reading
+    // the buttons altogether.
+    while (!sim.exhausted) {
+        game_step();
+        if (in.mid == 2)
+            fuzz_reset_mid(&in);
+        fuzz_check_invariants();
+        if (in.reset)
+            fuzz_reset(&in);
+        if (++steps > 128 * (size + 1) + 2 * MAX_MOVES)
+            abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+#include <stdio.h>
+
+#ifndef __AFL_LOOP
+#define __AFL_LOOP(n) (runs++ == 0)
+#endif
+
+static size_t fuzz_read(FILE *f, uint8_t *buf, size_t len)
+{
+    return fread(buf, 1, len, f);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[1 << 16];
+    unsigned runs = 0;
+    size_t len;
+    int i;
+
+    if (argc < 2) {
+        while (__AFL_LOOP(100000)) {
+            len = fuzz_read(stdin, buf, sizeof(buf));
+            LLVMFuzzerTestOneInput(buf, len);
+        }
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        len = fuzz_read(f, buf, sizeof(buf));
+        fclose(f);
+        LLVMFuzzerTestOneInput(buf, len);
+        printf("%s: %zu bytes ok\n", argv[i], len);
+    }
+    return 0;
+}
+#endif
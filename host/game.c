@@ -0,0 +1,11 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Host build of the firmware. The game core is compiled straight from
+ * nomis-memory-game.c against the shim headers in include/. The firmware's
+ * main() never returns, so it is renamed out of the way and the host tools
+ * drive io_init(), game_init() and game_step() themselves.
+ */
+#define main nomis_main
+#include "../nomis-memory-game.c"
@@ -0,0 +1,42 @@
+/* Host stand-in for <avr/eeprom.h>, see host/sim.h */
+#ifndef NOMIS_HOST_AVR_EEPROM_H
+#define NOMIS_HOST_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../sim.h"
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p)
+{
+    return sim_eeprom_read_byte((uintptr_t)p);
+}
+
+static inline void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+    sim_eeprom_write_byte((uintptr_t)p, value);
+}
+
+static inline uint16_t eeprom_read_word(const uint16_t *p)
+{
+    uintptr_t addr = (uintptr_t)p;
+    return sim_eeprom_read_byte(addr) | (sim_eeprom_read_byte(addr + 1) << 8);
+}
+
+static inline void eeprom_write_word(uint16_t *p, uint16_t value)
+{
+    uintptr_t addr = (uintptr_t)p;
+    sim_eeprom_write_byte(addr, value & 0xFF);
+    sim_eeprom_write_byte(addr + 1, value >> 8);
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    uintptr_t addr = (uintptr_t)src;
+    uint8_t *p = dst;
+
+    while (n--)
+        *p++ = sim_eeprom_read_byte(addr++);
+}
+
+#endif
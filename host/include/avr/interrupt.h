@@ -0,0 +1,13 @@
+/* Host stand-in for <avr/interrupt.h>, see host/sim.h */
+#ifndef NOMIS_HOST_AVR_INTERRUPT_H
+#define NOMIS_HOST_AVR_INTERRUPT_H
+
+#include "../../sim.h"
+
+#define sei() (sim.interrupts = 1)
+#define cli() (sim.interrupts = 0)
+
+// The simulation calls handlers by their vector name, see sim_interrupts()
+#define ISR(vector) void vector(void)
+
+#endif
@@ -0,0 +1,112 @@
+/* Host stand-in for <avr/io.h>, see host/sim.h */
+#ifndef NOMIS_HOST_AVR_IO_H
+#define NOMIS_HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#include "../../sim.h"
+
+#ifdef SIM_TRACE
+#define PORTB  (*sim_io(&sim.portb))
+#define DDRB   (*sim_io(&sim.ddrb))
+#define TCCR0A (*sim_io(&sim.tccr0a))
+#define TCCR1  (*sim_io(&sim.tccr1))
+#define OCR0A  (*sim_io(&sim.ocr0a))
+#else
+#define PORTB  (sim.portb)
+#define DDRB   (sim.ddrb)
+#define TCCR0A (sim.tccr0a)
+#define TCCR1  (sim.tccr1)
+#define OCR0A  (sim.ocr0a)
+#endif
+
+#define ADMUX  (sim.admux)
+#define ADCSRA (*sim_adcsra())
+#define ADC    (sim_adc())
+#define TCCR0B (sim.tccr0b)
+#define TCNT0  (sim.tcnt0)
+#define OCR0B  (sim.ocr0b)
+#define GTCCR  (sim.gtccr)
+#define TCNT1  (sim.tcnt1)
+#define OCR1B  (sim.ocr1b)
+#define OCR1C  (sim.ocr1c)
+#define WDTCR  (sim.wdtcr)
+#define MCUSR  (sim.mcusr)
+#define GIMSK  (sim.gimsk)
+#define GIFR   (sim.gifr)
+#define PCMSK  (sim.pcmsk)
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+
+#define ADEN  7
+#define ADSC  6
+#define ADATE 5
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01  1
+#define WGM00  0
+
+#define WGM02  3
+#define CS02   2
+#define CS01   1
+#define CS00   0
+
+#define CTC1   7
+#define PWM1A  6
+#define COM1A1 5
+#define COM1A0 4
+#define CS13   3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+
+#define TSM    7
+#define PWM1B  6
+#define COM1B1 5
+#define COM1B0 4
+#define FOC1B  3
+#define FOC1A  2
+#define PSR1   1
+#define PSR0   0
+
+#define WDIF   7
+#define WDIE   6
+#define WDP3   5
+#define WDCE   4
+#define WDE    3
+#define WDP2   2
+#define WDP1   1
+#define WDP0   0
+
+#define INT0   6
+#define PCIE   5
+
+#define INTF0  6
+#define PCIF   5
+
+#define PCINT5 5
+#define PCINT4 4
+#define PCINT3 3
+#define PCINT2 2
+#define PCINT1 1
+#define PCINT0 0
+
+#define WDRF   3
+#define BORF   2
+#define EXTRF  1
+#define PORF   0
+
+#endif
@@ -0,0 +1,13 @@
+/* Host stand-in for <avr/pgmspace.h>, see host/sim.h */
+#ifndef NOMIS_HOST_AVR_PGMSPACE_H
+#define NOMIS_HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// The host has one address space, so flash is just const data
+#define PROGMEM
+#define memcpy_P(dst, src, n) memcpy((dst), (src), (n))
+#define pgm_read_byte(p)      (*(const uint8_t *)(p))
+
+#endif
@@ -0,0 +1,16 @@
+/* Host stand-in for <avr/sleep.h>, see host/sim.h */
+#ifndef NOMIS_HOST_AVR_SLEEP_H
+#define NOMIS_HOST_AVR_SLEEP_H
+
+#include "../../sim.h"
+
+#define SLEEP_MODE_IDLE     0x00
+#define SLEEP_MODE_ADC      0x08
+#define SLEEP_MODE_PWR_DOWN 0x10
+
+#define set_sleep_mode(mode) (sim.sleep_mode = (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()          sim_sleep()
+
+#endif
@@ -0,0 +1,22 @@
+/* Host stand-in for <util/crc16.h>, see host/sim.h */
+#ifndef NOMIS_HOST_UTIL_CRC16_H
+#define NOMIS_HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+// The C equivalent given in the avr-libc manual (polynomial 0xA001)
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+    int i;
+
+    crc ^= a;
+    for (i = 0; i < 8; ++i) {
+        if (crc & 1)
+            crc = (crc >> 1) ^ 0xA001;
+        else
+            crc = (crc >> 1);
+    }
+    return crc;
+}
+
+#endif
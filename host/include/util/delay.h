@@ -0,0 +1,17 @@
+/* Host stand-in for <util/delay.h>, see host/sim.h */
+#ifndef NOMIS_HOST_UTIL_DELAY_H
+#define NOMIS_HOST_UTIL_DELAY_H
+
+#include "../../sim.h"
+
+static inline void _delay_ms(double ms)
+{
+    sim_delay_us(ms * 1000.0);
+}
+
+static inline void _delay_us(double us)
+{
+    sim_delay_us(us);
+}
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Shared library of the game core for analysis from Python (ctypes or CFFI),
+ * see scripts/nomis.py. The moves and random numbers come from the
+ * firmware's own next_move() and rand_lcg(), built from the same sources as
+ * the other host tools, so the numbers are the firmware's by construction.
+ *
+ * Every call works on caller owned buffers, a batch at a time, so the
+ * Python side can hand in numpy arrays and the loops run at native speed.
+ * The game state is per thread, so calls from different threads don't mix.
+ */
+#include <stdint.h>
+
+#include "../nomis-memory-game.h"
+
+/**
+ * nomis_num_buttons(), nomis_max_moves(), nomis_max_period()
+ *
+ * \brief The build's configuration, so callers can size their buffers.
+ */
+uint32_t nomis_num_buttons(void)
+{
+    return NUM_BUTTONS;
+}
+
+uint32_t nomis_max_moves(void)
+{
+    return MAX_MOVES;
+}
+
+uint32_t nomis_max_period(void)
+{
+    return MAX_PERIOD;
+}
+
+/**
+ * nomis_lcg()
+ * \param  uint16_t    seed  LCG state to start from.
+ * \param  uint32_t    n     Numbers to make.
+ * \param  uint16_t *  out   n numbers, the states after seed.
+ *
+ * \return  uint16_t  The state after the last one, to carry on from.
+ */
+uint16_t nomis_lcg(uint16_t seed, uint32_t n, uint16_t *out)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        seed = rand_lcg(seed, MAX_PERIOD, MULTIPLIER, C);
+        out[i] = seed;
+    }
+    return seed;
+}
+
+/**
+ * nomis_moves()
+ * \param  const uint16_t *  seeds   game.random when the first move is made.
+ * \param  uint32_t          nseeds  Number of seeds.
+ * \param  uint32_t          nmoves  Moves to make for each seed.
+ * \param  uint8_t *         out     nseeds * nmoves buttons (0 based), row
+ *                                   major, a row per seed.
+ *
+ * \brief The moves the game makes from each seed. nmoves may be more than
+ *        MAX_MOVES, to look further along the generator.
+ */
+void nomis_moves(const uint16_t *seeds, uint32_t nseeds, uint32_t nmoves,
+                 uint8_t *out)
+{
+    uint32_t s, i;
+    uint8_t move, button;
+
+    for (s = 0; s < nseeds; s++) {
+        game.random = seeds[s];
+        for (i = 0; i < nmoves; i++) {
+            move = next_move();
+            button = 0;
+            while (move >>= 1)
+                button++;
+            *out++ = button;
+        }
+    }
+}
+
+/**
+ * nomis_move_counts()
+ * \param  const uint16_t *  seeds   As for nomis_moves().
+ * \param  uint32_t          nseeds
+ * \param  uint32_t          nmoves
+ * \param  uint64_t *        counts  nmoves * NUM_BUTTONS counters, added to:
+ *                                   how often each button was move i.
+ *
+ * \brief A histogram of nomis_moves() without the nseeds * nmoves buffer.
+ */
+void nomis_move_counts(const uint16_t *seeds, uint32_t nseeds, uint32_t nmoves,
+                       uint64_t *counts)
+{
+    uint32_t s, i;
+    uint8_t move, button;
+
+    for (s = 0; s < nseeds; s++) {
+        game.random = seeds[s];
+        for (i = 0; i < nmoves; i++) {
+            move = next_move();
+            button = 0;
+            while (move >>= 1)
+                button++;
+            counts[i * NUM_BUTTONS + button] += 1;
+        }
+    }
+}
@@ -0,0 +1,411 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Exhaustive model checker for the game state machine. For every one of the
+ * MAX_PERIOD LCG seeds it starts a game and then feeds it every sequence of
+ * up to N button events, where an event is one ADC sample: a release or a
+ * press of one of the NUM_BUTTONS buttons. Holding a button, pressing two in a row
+ * without a release and so on are all covered, which is where the edge
+ * detection in get_player_move() gets interesting.
+ *
+ * After every game_step() the checker compares the game against a small
+ * reference model of the rules:
+ *
+ *   - cpu_counter never exceeds MAX_MOVES and player_counter always indexes
+ *     a move the computer has made
+ *   - once an event has been handled the game is waiting in IDLE or PLAYER,
+ *     CPU and LOSE only ever last for one step
+ *   - a new press of the expected button advances the player, or starts the
+ *     next round after the last move
+ *   - a new press of any other button goes to LOSE, and LOSE cleans up and
+ *     goes back to IDLE
+ *   - a held button or a release changes nothing
+ *
+ * A game that has ended is a leaf, unless -a is given, in which case the
+ * sequence carries on into the next game from IDLE.
+ *
+ * Seeds are handed out to the worker threads as ranges. A worker that runs
+ * out of seeds steals the top half of the busiest looking range of another
+ * worker, so the load stays balanced whatever depth and pruning do to the
+ * cost of each seed.
+ *
+ * Usage: modelcheck [-n depth] [-j threads] [-a]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+#define CHECK_MAX_DEPTH   32
+#define CHECK_MAX_REPORTS 10
+
+// Event 0 is a release, events 1 to NUM_BUTTONS press a button. The samples
+// are the middles of the windows in get_player_move().
+#define NUM_EVENTS (NUM_BUTTONS + 1)
+static uint16_t event_sample[NUM_EVENTS];
+
+struct worker {
+    pthread_mutex_t lock;
+    uint32_t next;      // next seed this worker will take
+    uint32_t end;       // one past the last seed it owns
+    uint64_t nodes;
+    uint64_t leaves;
+    uint64_t steps;
+    pthread_t thread;
+};
+
+struct check {
+    unsigned depth;
+    int all;
+    unsigned nworkers;
+    struct worker *workers;
+    pthread_mutex_t report_lock;
+    unsigned violations;
+};
+
+static struct check check;
+
+// Per thread: the event being fed to the game and the path to it
+struct feed {
+    uint16_t sample;
+    int consumed;
+    uint32_t seed;
+    uint8_t path[CHECK_MAX_DEPTH];
+    uint64_t steps;
+};
+
+static _Thread_local struct feed feed;
+
+static uint16_t check_next_sample(void *ctx)
+{
+    (void)ctx;
+    feed.consumed += 1;
+    return feed.sample;
+}
+
+static void check_report(unsigned depth, const char *what)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&check.report_lock);
+    check.violations += 1;
+    if (check.violations <= CHECK_MAX_REPORTS) {
+        printf("seed %u, events", (unsigned)feed.seed);
+        for (i = 0; i < depth; i++)
+            printf(" %c", "R123456"[feed.path[i]]);
+        printf(": %s (state %d, cpu %u, player %u)\n", what,
+               game.gamestate, game.cpu_counter, game.player_counter);
+    }
+    pthread_mutex_unlock(&check.report_lock);
+}
+
+static uint8_t check_window(uint16_t sample)
+{
+    unsigned i;
+    for (i = 1; i < NUM_EVENTS; i++)
+        if (sample == event_sample[i])
+            return 0x01 << (i - 1);
+    return 0;
+}
+
+static int check_invariants(unsigned depth)
+{
+    if (game.gamestate > LOSE) {
+        check_report(depth, "unknown state");
+        return 0;
+    }
+    if (game.cpu_counter > MAX_MOVES) {
+        check_report(depth, "cpu_counter past MAX_MOVES");
+        return 0;
+    }
+    if (game.gamestate == PLAYER && game.player_counter >= game.cpu_counter) {
+        check_report(depth, "player_counter past the last move");
+        return 0;
+    }
+    return 1;
+}
+
+static void check_step()
+{
+    game_step();
+    feed.steps += 1;
+}
+
+/**
+ * check_event()
+ *
+ * \brief Feed one event to the game, step it until it is waiting for input
+ *        again and hold it to the reference model. Returns 1 if the game is
+ *        still going and 0 if it ended or something was wrong.
+ */
+static int check_event(unsigned depth, uint8_t event)
+{
+    struct game before = game;
+    uint8_t press = check_window(event_sample[event]);
+    uint8_t edge = (press != before.prev_move) ? press : 0;
+    uint8_t expected = get_move(before.player_counter);
+
+    feed.sample = event_sample[event];
+    feed.consumed = 0;
+
+    check_step();
+    if (!check_invariants(depth))
+        return 0;
+    if (feed.consumed != 1) {
+        check_report(depth, "event not read exactly once");
+        return 0;
+    }
+
+    if (before.gamestate == IDLE) {
+        if (event_sample[event] > settings.idle_threshold) {
+            if (game.gamestate != CPU) {
+                check_report(depth, "press in IDLE did not start a game");
+                return 0;
+            }
+        } else if (game.gamestate != IDLE) {
+            check_report(depth, "left IDLE without a press");
+            return 0;
+        }
+    } else if (edge == 0) {
+        if (game.gamestate != PLAYER
+            || game.player_counter != before.player_counter
+            || game.cpu_counter != before.cpu_counter) {
+            check_report(depth, "release or held button changed the game");
+            return 0;
+        }
+    } else if (edge == expected) {
+        if (before.player_counter == before.cpu_counter - 1) {
+            if (game.gamestate != CPU || game.player_counter != 0) {
+                check_report(depth, "last move did not end the round");
+                return 0;
+            }
+        } else if (game.gamestate != PLAYER
+                   || game.player_counter != before.player_counter + 1) {
+            check_report(depth, "right move did not advance the player");
+            return 0;
+        }
+    } else if (game.gamestate != LOSE) {
+        check_report(depth, "wrong move did not go to LOSE");
+        return 0;
+    }
+
+    if (game.gamestate == LOSE) {
+        check_step();
+        if (!check_invariants(depth))
+            return 0;
+        if (game.gamestate != IDLE || game.cpu_counter != 0
+            || game.player_counter != 0) {
+            check_report(depth, "LOSE did not clean up and go to IDLE");
+            return 0;
+        }
+        return check.all;
+    }
+
+    if (game.gamestate == CPU) {
+        uint16_t cpu_counter = game.cpu_counter;
+
+        check_step();
+        if (!check_invariants(depth))
+            return 0;
+        if (feed.consumed != 1) {
+            check_report(depth, "CPU turn read the buttons");
+            return 0;
+        }
+        if (cpu_counter == MAX_MOVES) {
+            if (game.gamestate != IDLE || game.cpu_counter != 0) {
+                check_report(depth, "full move buffer did not end the game");
+                return 0;
+            }
+            return check.all;
+        }
+        if (game.gamestate != PLAYER || game.cpu_counter != cpu_counter + 1) {
+            check_report(depth, "CPU turn did not add exactly one move");
+            return 0;
+        }
+    }
+
+    if (game.gamestate != IDLE && game.gamestate != PLAYER) {
+        check_report(depth, "stuck outside IDLE/PLAYER");
+        return 0;
+    }
+    return 1;
+}
+
+static void check_tree(struct worker *w, unsigned depth)
+{
+    struct game saved;
+    uint8_t event;
+
+    w->nodes += 1;
+    if (depth == check.depth) {
+        w->leaves += 1;
+        return;
+    }
+
+    saved = game;
+    for (event = 0; event < NUM_EVENTS; event++) {
+        game = saved;
+        feed.path[depth] = event;
+        if (check_event(depth + 1, event))
+            check_tree(w, depth + 1);
+        else
+            w->leaves += 1;
+    }
+    game = saved;
+}
+
+static void check_seed(struct worker *w, uint32_t seed)
+{
+    uint16_t start = seed - 1;
+
+    // IDLE adds one to the seed before it looks at the buttons, so start
+    // one below to have the CPU draw from exactly this seed.
+    sim.eeprom[SEED_ADDR] = start & 0xFF;
+    sim.eeprom[SEED_ADDR + 1] = start >> 8;
+    sim_reset(check_next_sample, NULL);
+    io_init();
+    settings_load();
+    game_init();
+
+    feed.seed = seed;
+    feed.sample = event_sample[1];
+    feed.consumed = 0;
+    game_step();
+    game_step();
+    if (game.gamestate != PLAYER || game.cpu_counter != 1) {
+        check_report(0, "game did not start");
+        return;
+    }
+    check_tree(w, 0);
+}
+
+// Take the next seed of our own range, or steal half of somebody else's
+static int check_take(struct worker *w, uint32_t *seed)
+{
+    unsigned i, victim = 0;
+    uint32_t most = 0, half;
+    struct worker *v;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end) {
+        *seed = w->next++;
+        pthread_mutex_unlock(&w->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for (i = 0; i < check.nworkers; i++) {
+        v = &check.workers[i];
+        if (v == w)
+            continue;
+        pthread_mutex_lock(&v->lock);
+        if (v->end - v->next > most) {
+            most = v->end - v->next;
+            victim = i;
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    if (most == 0)
+        return 0;
+
+    v = &check.workers[victim];
+    pthread_mutex_lock(&v->lock);
+    if (v->next >= v->end) {
+        pthread_mutex_unlock(&v->lock);
+        return check_take(w, seed);
+    }
+    half = (v->end - v->next) / 2;
+    *seed = v->end - half - 1;
+    v->end -= half + 1;
+    pthread_mutex_unlock(&v->lock);
+
+    pthread_mutex_lock(&w->lock);
+    w->next = *seed + 1;
+    w->end = *seed + 1 + half;
+    pthread_mutex_unlock(&w->lock);
+    return 1;
+}
+
+static void *check_worker(void *arg)
+{
+    struct worker *w = arg;
+    uint32_t seed;
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    while (check_take(w, &seed))
+        check_seed(w, seed);
+    w->steps = feed.steps;
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec t0, t1;
+    uint64_t nodes = 0, leaves = 0, steps = 0;
+    double seconds;
+    unsigned i;
+    int opt;
+
+    check.depth = 6;
+    check.nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "n:j:a")) != -1) {
+        switch (opt) {
+        case 'n':
+            check.depth = atoi(optarg);
+            break;
+        case 'j':
+            check.nworkers = atoi(optarg);
+            break;
+        case 'a':
+            check.all = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n depth] [-j threads] [-a]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (check.depth > CHECK_MAX_DEPTH)
+        check.depth = CHECK_MAX_DEPTH;
+    if (check.nworkers < 1)
+        check.nworkers = 1;
+
+    check.workers = calloc(check.nworkers, sizeof(*check.workers));
+    pthread_mutex_init(&check.report_lock, NULL);
+    for (i = 0; i < check.nworkers; i++) {
+        pthread_mutex_init(&check.workers[i].lock, NULL);
+        check.workers[i].next = (uint64_t)MAX_PERIOD * i / check.nworkers;
+        check.workers[i].end = (uint64_t)MAX_PERIOD * (i + 1) / check.nworkers;
+    }
+
+    for (i = 1; i < NUM_EVENTS; i++)
+        event_sample[i] = BUTTON_ADC(i - 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < check.nworkers; i++)
+        pthread_create(&check.workers[i].thread, NULL, check_worker,
+                       &check.workers[i]);
+    for (i = 0; i < check.nworkers; i++) {
+        pthread_join(check.workers[i].thread, NULL);
+        nodes += check.workers[i].nodes;
+        leaves += check.workers[i].leaves;
+        steps += check.workers[i].steps;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%u seeds, %u buttons, depth %u%s, %u threads\n", MAX_PERIOD,
+           NUM_BUTTONS, check.depth, check.all ? " (through game over)" : "",
+           check.nworkers);
+    printf("%llu states, %llu leaves, %llu steps in %.2f s, %.0f states/s\n",
+           (unsigned long long)nodes, (unsigned long long)leaves,
+           (unsigned long long)steps, seconds, nodes / seconds);
+    printf("%u violations\n", check.violations);
+    return check.violations ? 1 : 0;
+}
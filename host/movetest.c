@@ -0,0 +1,152 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Exhaustive check of how moves are drawn (draw_button(), next_move()) for
+ * the NUM_BUTTONS it is built with. make move-check builds and runs it for
+ * every button count from 2 to 6.
+ *
+ * Everything is counted over every state the generator has, so the results
+ * are exact rather than sampled:
+ *
+ *  - draw_button() gives each button floor or ceil of MAX_PERIOD/NUM_BUTTONS
+ *    of the outputs, in one run each, so no button is ahead of another by
+ *    more than one state in MAX_PERIOD.
+ *  - The state next_move() steps is rand_lcg()'s, for every state, and its
+ *    moves are one hot and in range.
+ *  - Over a full period from any seed each button comes up as evenly as
+ *    above, and so does each pair of consecutive moves, to a chi-square
+ *    well inside what an even draw gives (p = 0.001).
+ *
+ * Exits 1 if any of them fails.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+// Chi-square at p = 0.001 for NUM_BUTTONS^2 - 1 degrees of freedom
+static const double chi_limit[7] = { 0, 0, 16.27, 26.12, 37.70, 51.18, 66.62 };
+
+static int failures;
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures += 1;
+    }
+}
+
+static int button_of(uint8_t move)
+{
+    int n;
+
+    for (n = 0; move >>= 1; n++)
+        ;
+    return n;
+}
+
+static int even(const uint32_t *counts, int n, uint32_t total)
+{
+    uint32_t low = total / n, high = (total + n - 1) / n;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (counts[i] < low || counts[i] > high)
+            return 0;
+    }
+    return 1;
+}
+
+static void check_draw(void)
+{
+    uint32_t counts[NUM_BUTTONS] = { 0 };
+    uint32_t r;
+    int last = 0, runs = 1, b, ok = 1;
+
+    for (r = 0; r < MAX_PERIOD; r++) {
+        b = draw_button(r);
+        if (b < 0 || b >= NUM_BUTTONS) {
+            ok = 0;
+            continue;
+        }
+        if (b != last)
+            runs += 1;
+        last = b;
+        counts[b] += 1;
+    }
+    check(ok, "draw_button() out of range");
+    check(runs == NUM_BUTTONS, "draw_button() not one run per button");
+    check(even(counts, NUM_BUTTONS, MAX_PERIOD), "draw_button() uneven");
+    printf("draw_button: %u states, %u to %u per button\n", MAX_PERIOD,
+           MAX_PERIOD / NUM_BUTTONS, (MAX_PERIOD + NUM_BUTTONS - 1) / NUM_BUTTONS);
+}
+
+static void check_period(uint16_t seed, double *chi_max)
+{
+    uint32_t counts[NUM_BUTTONS] = { 0 };
+    uint32_t pairs[NUM_BUTTONS][NUM_BUTTONS] = { { 0 } };
+    double expect = (double)MAX_PERIOD / (NUM_BUTTONS * NUM_BUTTONS), chi = 0;
+    uint8_t move;
+    uint32_t i;
+    int b, prev, ok = 1, a;
+
+    game.random = seed;
+    prev = button_of(next_move());
+    counts[prev] += 1;
+    // One move past the period so the last pair wraps round to the first
+    for (i = 1; i <= MAX_PERIOD; i++) {
+        move = next_move();
+        b = button_of(move);
+        if (!move || (move & (move - 1)) || b >= NUM_BUTTONS) {
+            ok = 0;
+            break;
+        }
+        if (i < MAX_PERIOD)
+            counts[b] += 1;
+        pairs[prev][b] += 1;
+        prev = b;
+    }
+    check(ok, "next_move() not one hot");
+    check(even(counts, NUM_BUTTONS, MAX_PERIOD), "next_move() uneven over a period");
+    for (a = 0; a < NUM_BUTTONS; a++) {
+        for (b = 0; b < NUM_BUTTONS; b++)
+            chi += (pairs[a][b] - expect) * (pairs[a][b] - expect) / expect;
+    }
+    if (chi > *chi_max)
+        *chi_max = chi;
+}
+
+int main(void)
+{
+    uint32_t first[NUM_BUTTONS] = { 0 };
+    uint32_t s;
+    uint16_t lcg;
+    double chi_max = 0;
+    int same = 1;
+
+    sim_reset(NULL, NULL);
+    check_draw();
+
+    for (s = 0; s < MAX_PERIOD; s++) {
+        lcg = rand_lcg(s, MAX_PERIOD, MULTIPLIER, C);
+        game.random = s;
+        first[button_of(next_move())] += 1;
+        if (game.random != lcg)
+            same = 0;
+    }
+    check(same, "next_move() steps the LCG differently from rand_lcg()");
+    check(even(first, NUM_BUTTONS, MAX_PERIOD), "first move uneven over the seeds");
+
+    // The pairs over a whole period don't depend much on where it starts
+    for (s = 0; s < MAX_PERIOD; s += 4099)
+        check_period(s, &chi_max);
+    check(chi_max < chi_limit[NUM_BUTTONS], "consecutive moves uneven");
+    printf("next_move: %d buttons, pairs chi-square %.2f (limit %.2f)\n",
+           NUM_BUTTONS, chi_max, chi_limit[NUM_BUTTONS]);
+
+    printf("%s\n", failures ? "FAIL" : "ok");
+    return failures != 0;
+}
@@ -0,0 +1,373 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * The game in a terminal, in real time. The host build of the firmware runs
+ * paced to the wall clock, the keys a s d f (then g h with more buttons)
+ * press the buttons through the ADC ladder, and the charlieplexed LEDs are
+ * worked out from PORTB, DDRB and Timer0 the way the pins would drive them.
+ *
+ *   play [-s speed] [-t seconds]
+ *
+ *   -s  run speed times faster than real time (default 1)
+ *   -t  stop after this many simulated seconds; by default q stops
+ *
+ * Below the LEDs is a latency meter: the time from a key going down to its
+ * LED lighting up, which is what changes to the scheduler or the button
+ * debounce do to the feel of the game. A press made while the game waits
+ * for the player whose LED never lights (before the next press, or within
+ * PLAY_DROP_US) counts as dropped.
+ *
+ * A terminal only reports keys going down, so a key counts as held for
+ * PLAY_HOLD_US after its last repeat.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "../nomis-memory-game.h"
+#include "../nomis-hal.h"
+
+#define PLAY_HOLD_US      150000
+#define PLAY_DROP_US      1000000
+#define PLAY_RENDER_US    20000    // wall clock time between frames
+#define PLAY_POLL_MS      5
+
+static const char play_keys[] = "asdfgh";
+
+// Anode and cathode bit of each LED, as nomis-hal.h wires them
+static const uint8_t led_pins[6][2] = {
+    { LED0_ANODE, LED0_CATHODE }, { LED1_ANODE, LED1_CATHODE },
+    { LED2_ANODE, LED2_CATHODE }, { LED3_ANODE, LED3_CATHODE },
+    { LED4_ANODE, LED4_CATHODE }, { LED5_ANODE, LED5_CATHODE },
+};
+
+struct play {
+    double speed;
+    uint64_t stop_us;       // simulated time to stop at, 0 for never
+    struct timespec start;
+    int tty;
+    int eof;
+    int quit;
+    int lines;              // lines drawn last frame
+
+    int held;               // button held down, -1 for none
+    uint64_t held_until;
+
+    int pending;            // button whose LED is awaited, -1 for none
+    uint64_t pending_us;
+    uint32_t presses;
+    uint32_t dropped;
+    uint32_t measured;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+    uint64_t latency_last;
+
+    uint8_t lit;            // LEDs lit since the last frame
+    uint8_t beeped;         // the piezo played since the last frame
+    uint64_t next_frame;    // wall clock us
+};
+
+static struct play play;
+static struct termios play_saved;
+
+static uint64_t play_wall_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - play.start.tv_sec) * 1000000ULL +
+           (now.tv_nsec - play.start.tv_nsec) / 1000;
+}
+
+// Simulated time the wall clock has reached, for when a key went down
+static uint64_t play_now(void)
+{
+    uint64_t wall = play_wall_us() * play.speed;
+
+    return wall < sim.time_us ? wall : sim.time_us;
+}
+
+static void play_restore(void)
+{
+    if (play.tty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &play_saved);
+}
+
+static void play_signal(int sig)
+{
+    play_restore();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/**
+ * play_pin()
+ * \param  int       pin   Bit of PORTB.
+ * \param  double *  high  Set to the fraction of the time the pin is high.
+ * \return int  0 if the pin floats.
+ */
+static int play_pin(int pin, double *high)
+{
+    uint8_t com = 0, ocr = 0;
+
+    if (!(sim.ddrb & (1 << pin)))
+        return 0;
+    if (pin == 0) {
+        com = (sim.tccr0a >> 6) & 0x03;
+        ocr = sim.ocr0a;
+    } else if (pin == 1) {
+        com = (sim.tccr0a >> 4) & 0x03;
+        ocr = sim.ocr0b;
+    }
+    if (com >= 2) {
+        // Fast PWM: high from BOTTOM to the compare match, or the inverse
+        *high = (ocr + 1) / 256.0;
+        if (com == 3)
+            *high = 1 - *high;
+    } else {
+        *high = (sim.portb >> pin) & 1;
+    }
+    return 1;
+}
+
+/**
+ * play_leds()
+ * \return uint8_t  One bit per LED that is lit at all right now.
+ */
+static uint8_t play_leds(void)
+{
+    double anode, cathode;
+    uint8_t leds = 0;
+    int n;
+
+    for (n = 0; n < NUM_BUTTONS; n++) {
+        if (play_pin(led_pins[n][0], &anode) &&
+            play_pin(led_pins[n][1], &cathode) && anode > 0 && cathode < 1)
+            leds |= 1 << n;
+    }
+    return leds;
+}
+
+static void play_render(void)
+{
+    static const char *states[] = { "IDLE", "CPU", "PLAYER", "LOSE" };
+    uint64_t wall = play_wall_us();
+    double lag = wall * play.speed / 1000.0 - sim.time_us / 1000.0;
+    int n;
+
+    if (play.lines)
+        printf("\r\033[%dA", play.lines);
+    printf("nomis  %-6s round %-3u  %.1f s x%.1f%s\033[K\n",
+           game.gamestate <= LOSE ? states[game.gamestate] : "?",
+           game.cpu_counter, sim.time_us / 1e6, play.speed,
+           lag > 50 ? "  (behind)" : "");
+    for (n = 0; n < NUM_BUTTONS; n++)
+        printf(play.lit & (1 << n) ? "  \033[1;31m(#)\033[0m" : "  ( )");
+    printf("%s\033[K\n", play.beeped ? "  beep" : "");
+    for (n = 0; n < NUM_BUTTONS; n++)
+        printf("   %c%c", play_keys[n], play.held == n ? '*' : ' ');
+    printf("\033[K\n");
+    if (play.measured)
+        printf("latency last %.0f ms, mean %.0f ms, max %.0f ms",
+               play.latency_last / 1000.0,
+               play.latency_sum / 1000.0 / play.measured,
+               play.latency_max / 1000.0);
+    else
+        printf("latency -");
+    printf("   presses %u, dropped %u\033[K\n", play.presses, play.dropped);
+    printf("%.*s press the buttons, q quits\033[K\n", NUM_BUTTONS, play_keys);
+    fflush(stdout);
+    play.lines = 5;
+
+    play.lit = play_leds();
+    play.beeped = sim.tccr1 != 0;
+    play.next_frame = wall + PLAY_RENDER_US;
+}
+
+static void play_drop(void)
+{
+    if (play.pending >= 0) {
+        play.dropped += 1;
+        play.pending = -1;
+    }
+}
+
+static void play_key(int c)
+{
+    const char *k;
+    uint64_t now;
+    int button;
+
+    if (c == 'q' || c == 3) {
+        play.quit = 1;
+        return;
+    }
+    k = strchr(play_keys, c);
+    if (!k || !c || k - play_keys >= NUM_BUTTONS)
+        return;
+    button = k - play_keys;
+    now = play_now();
+    if (play.held == button && now < play.held_until) {
+        // A key repeat, the key is still down
+        play.held_until = now + PLAY_HOLD_US;
+        return;
+    }
+    play.held = button;
+    play.held_until = now + PLAY_HOLD_US;
+    play.presses += 1;
+    if (game.gamestate == PLAYER) {
+        play_drop();
+        play.pending = button;
+        play.pending_us = now;
+    }
+}
+
+static void play_read_keys(void)
+{
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    char buf[16];
+    ssize_t len, i;
+
+    while (!play.eof && poll(&fd, 1, 0) > 0) {
+        len = read(STDIN_FILENO, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR)
+                continue;
+            play.eof = 1;
+            if (!play.stop_us)
+                play.quit = 1;
+            break;
+        }
+        for (i = 0; i < len; i++)
+            play_key(buf[i]);
+    }
+}
+
+/**
+ * play_pace()
+ *
+ * \brief Waits for the wall clock to catch up with simulated time, reading
+ *        keys and drawing frames in the meantime.
+ */
+static void play_pace(void)
+{
+    uint64_t target = sim.time_us / play.speed, wall;
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    int wait_ms;
+
+    for (;;) {
+        play_read_keys();
+        wall = play_wall_us();
+        if (wall >= play.next_frame)
+            play_render();
+        if (play.quit || wall >= target)
+            break;
+        wait_ms = (target - wall) / 1000;
+        if (wait_ms > PLAY_POLL_MS)
+            wait_ms = PLAY_POLL_MS;
+        poll(&fd, play.eof ? 0 : 1, wait_ms);
+    }
+    if (play.held >= 0 && sim.time_us >= play.held_until)
+        play.held = -1;
+    if (play.pending >= 0 && sim.time_us - play.pending_us > PLAY_DROP_US)
+        play_drop();
+    if (play.stop_us && sim.time_us >= play.stop_us)
+        play.quit = 1;
+}
+
+static void play_event(void *ctx, enum sim_event event, uint16_t addr, uint8_t value)
+{
+    uint8_t leds = play_leds();
+    uint64_t latency;
+
+    (void)ctx;
+    (void)addr;
+    (void)value;
+    play.lit |= leds;
+    if (event == SIM_TCCR1 && sim.tccr1)
+        play.beeped = 1;
+    if (play.pending >= 0 && (leds & (1 << play.pending))) {
+        latency = sim.time_us - play.pending_us;
+        play.latency_last = latency;
+        play.latency_sum += latency;
+        if (latency > play.latency_max)
+            play.latency_max = latency;
+        play.measured += 1;
+        play.pending = -1;
+    }
+    play_pace();
+}
+
+static uint16_t play_next_sample(void *ctx)
+{
+    (void)ctx;
+    play_pace();
+    if (play.quit) {
+        sim.exhausted = 1;
+        return 0;
+    }
+    return play.held >= 0 ? BUTTON_ADC(play.held) : 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct termios raw;
+    uint16_t seed;
+    int opt;
+
+    play.speed = 1;
+    while ((opt = getopt(argc, argv, "s:t:")) != -1) {
+        switch (opt) {
+        case 's':
+            play.speed = atof(optarg);
+            break;
+        case 't':
+            play.stop_us = atof(optarg) * 1e6;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s speed] [-t seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (play.speed <= 0)
+        play.speed = 1;
+    play.held = -1;
+    play.pending = -1;
+
+    play.tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &play_saved) == 0;
+    if (play.tty) {
+        raw = play_saved;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        atexit(play_restore);
+        signal(SIGTERM, play_signal);
+        signal(SIGHUP, play_signal);
+    }
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    seed = time(NULL) & (MAX_PERIOD - 1);
+    sim.eeprom[SEED_ADDR] = seed & 0xFF;
+    sim.eeprom[SEED_ADDR + 1] = seed >> 8;
+    clock_gettime(CLOCK_MONOTONIC, &play.start);
+    sim_reset(play_next_sample, NULL);
+    sim.trace = play_event;
+    io_init();
+    settings_load();
+    game_init();
+    while (!sim.exhausted) {
+        game_step();
+    }
+    play_render();
+    return 0;
+}
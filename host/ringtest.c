@@ -0,0 +1,181 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Stress test for the ring buffer in nomis-ring.h. A producer and a consumer
+ * thread pass a numbered stream through rings of a few sizes, the way the
+ * main loop and an interrupt would, and the consumer checks that every
+ * element arrives once, in order and whole. Each element carries its number
+ * twice, so a slot read before the producer finished writing it shows up.
+ *
+ *   ringtest [-n items]
+ *
+ * Build with make ringtest-tsan to have ThreadSanitizer check the memory
+ * ordering as well. Exits 1 if anything went wrong.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "../nomis-ring.h"
+
+struct item {
+    uint32_t seq;
+    uint32_t check;     // ~seq
+};
+
+RING(ring2, struct item, 2);
+RING(ring8, struct item, 8);
+RING(ring128, struct item, 128);
+
+struct test {
+    const char *name;
+    void *(*producer)(void *);
+    void *(*consumer)(void *);
+    void *buffer;
+    uint32_t items;
+    uint32_t errors;
+    uint32_t spins;
+};
+
+/**
+ * RING_TEST(ring)
+ *
+ * \brief The producer and consumer threads for struct ring. A macro, since
+ *        the ring macros need to know the ring's type.
+ */
+#define RING_TEST(ring)                                                     \
+static void *ring##_producer(void *arg)                                     \
+{                                                                           \
+    struct test *t = arg;                                                   \
+    struct ring *r = t->buffer;                                             \
+    struct item it;                                                         \
+    uint32_t i;                                                             \
+                                                                            \
+    for (i = 0; i < t->items; i++) {                                        \
+        while (ring_full(r))                                                \
+            sched_yield();                                                  \
+        it.seq = i;                                                         \
+        it.check = ~i;                                                      \
+        ring_push(r, it);                                                   \
+    }                                                                       \
+    return NULL;                                                            \
+}                                                                           \
+                                                                            \
+static void *ring##_consumer(void *arg)                                     \
+{                                                                           \
+    struct test *t = arg;                                                   \
+    struct ring *r = t->buffer;                                             \
+    struct item it;                                                         \
+    uint32_t i;                                                             \
+                                                                            \
+    for (i = 0; i < t->items; i++) {                                        \
+        while (ring_empty(r)) {                                             \
+            t->spins += 1;                                                  \
+            sched_yield();                                                  \
+        }                                                                   \
+        if (ring_count(r) > RING_SIZE(r))                                   \
+            t->errors += 1;                                                 \
+        it = ring_peek(r);                                                  \
+        ring_drop(r);                                                       \
+        if (it.seq != i || it.check != ~i) {                                \
+            if (t->errors++ < 5)                                            \
+                fprintf(stderr, "%s: got %u (check %08x), expected %u\n",   \
+                        t->name, it.seq, it.check, i);                      \
+        }                                                                   \
+    }                                                                       \
+    return NULL;                                                            \
+}
+
+RING_TEST(ring2)
+RING_TEST(ring8)
+RING_TEST(ring128)
+
+/**
+ * single_thread_test()
+ *
+ * \brief Random pushes and pops from one thread against a plain counter,
+ *        including the wrap of the 8-bit head and tail.
+ */
+static int single_thread_test(void)
+{
+    struct ring8 r;
+    struct item it;
+    uint32_t pushed = 0, popped = 0;
+    int i, errors = 0;
+
+    memset(&r, 0, sizeof(r));
+    srand(1);
+    for (i = 0; i < 1000000; i++) {
+        if (rand() & 1) {
+            if (ring_full(&r) != (pushed - popped == 8))
+                errors += 1;
+            if (!ring_full(&r)) {
+                it.seq = pushed;
+                it.check = ~pushed;
+                ring_push(&r, it);
+                pushed += 1;
+            }
+        } else {
+            if (ring_empty(&r) != (pushed == popped))
+                errors += 1;
+            if (!ring_empty(&r)) {
+                it = ring_peek(&r);
+                ring_drop(&r);
+                if (it.seq != popped || it.check != ~popped)
+                    errors += 1;
+                popped += 1;
+            }
+        }
+        if (ring_count(&r) != pushed - popped)
+            errors += 1;
+    }
+    printf("single thread: %u pushed, %u popped, %d errors\n", pushed, popped, errors);
+    return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+    static struct ring2 r2;
+    static struct ring8 r8;
+    static struct ring128 r128;
+    struct test tests[] = {
+        { "ring2", ring2_producer, ring2_consumer, &r2, 0, 0, 0 },
+        { "ring8", ring8_producer, ring8_consumer, &r8, 0, 0, 0 },
+        { "ring128", ring128_producer, ring128_consumer, &r128, 0, 0, 0 },
+    };
+    uint32_t items = 2000000;
+    pthread_t producer, consumer;
+    int failed, i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            items = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-n items]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    failed = single_thread_test();
+
+    for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+        struct test *t = &tests[i];
+
+        t->items = items;
+        if (pthread_create(&producer, NULL, t->producer, t) ||
+            pthread_create(&consumer, NULL, t->consumer, t)) {
+            perror("pthread_create");
+            return 2;
+        }
+        pthread_join(producer, NULL);
+        pthread_join(consumer, NULL);
+        printf("%s: %u items, %u times empty, %u errors\n", t->name, t->items,
+               t->spins, t->errors);
+        failed |= t->errors != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,542 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Session throughput model for tuning the timings on demo units. Simulated
+ * players walk up and play games until they have had enough, and for each
+ * candidate timing table this reports how long games and sessions last and
+ * how many games an hour a unit gets through.
+ *
+ *   session [-g games] [-S span] [-d span_sd] [-w width] [-e encode_ms]
+ *           [-r reaction_ms] [-q quit] [-Q quit_short] [-l lanes]
+ *           [-s seed] [-j threads] [table...]
+ *
+ *   table  play/gap/pause[/flash[/lose]] in ms, e.g. 500/100/1000, the
+ *          settings the CPU shows a move for, the gap between two, the
+ *          pause after a matched round and the player's flashes. lose
+ *          replaces the time the LOSE blinks take, which the firmware has
+ *          no setting for, to see what changing them would buy. Without
+ *          tables the defaults and a few faster ones are compared.
+ *   -g  games per table (default 1000000)
+ *   -S  mean memory span in moves (default 8), -d its spread (default 2)
+ *   -w  how sharply recall falls off past the span (default 1)
+ *   -e  time a move has to be on show, with its gap, to be taken in; a
+ *       faster show shrinks the span in proportion (default 600)
+ *   -r  median time to make a move (default 700)
+ *   -q  chance of walking away after a game (default 0.3), -Q after a
+ *       game lost before round 4 (default 0.6)
+ *   -l  games stepped together per thread (default 4096)
+ *   -j  threads (default one per core)
+ *
+ * The player model: each player has a span drawn from a normal
+ * distribution and a median reaction time drawn around -r. A round of n
+ * moves is recalled in full with chance 1 / (1 + exp((n - span) / width)),
+ * and otherwise goes wrong at a move picked at random. Each press takes a
+ * time drawn from a log normal around the player's median, and the button
+ * is let go before the next one.
+ *
+ * The games are played by the batched game core (batch.h), which steps the
+ * same state machine as the firmware, many games at a time. How long each
+ * step takes is measured first for each table by running the host build of
+ * the firmware through a game with those settings, so the times are the
+ * firmware's own, blinks and all, for the table's settings.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+#define SESSION_MAX_TABLES 16
+#define SESSION_SHORT      3       // rounds; a game lost before round 4 is short
+
+// How long each kind of step takes the firmware, in us
+struct timing {
+    const char *name;
+    uint16_t play_ms, gap_ms, pause_ms;
+    uint8_t flash_ms;
+    long lose_ms;               // -1 for the firmware's blinks
+
+    uint64_t start;             // press in IDLE to the first CPU turn
+    uint64_t show;              // CPU turn, less the moves
+    uint64_t show_move;         // each move the CPU shows
+    uint64_t press;             // a right move within the round
+    uint64_t round_end;         // the last right move of a round
+    uint64_t wrong;
+    uint64_t poll;              // a look at the buttons with none down
+    uint64_t draw;              // drawing the next move and saving the seed
+    uint64_t lose;
+    uint64_t win;               // the round past MAX_MOVES
+};
+
+struct result {
+    uint64_t games;
+    uint64_t game_us;
+    uint64_t rounds;            // rounds matched, over all games
+    uint64_t short_games;
+    uint64_t sessions;
+    uint64_t session_us;
+    uint64_t session_games;
+};
+
+struct player {
+    uint64_t rng;
+    double span;
+    double reaction_us;         // median
+    int32_t fail_at;            // move the round goes wrong at, -1 for none
+    uint8_t held;
+    uint64_t clock;             // us since the lane started
+    uint64_t game_from;
+    uint64_t session_from;
+    uint32_t session_games;
+};
+
+struct session {
+    uint64_t games;
+    double span, span_sd;
+    double width;
+    double encode_ms;
+    double reaction_ms;
+    double quit, quit_short;
+    size_t lanes;
+    uint64_t seed;
+    unsigned nthreads;
+
+    const struct timing *table;
+    struct result result;
+    pthread_mutex_t lock;
+};
+
+static struct session session;
+
+static uint64_t session_rand(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double session_uniform(uint64_t *state)
+{
+    return (session_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double session_normal(uint64_t *state)
+{
+    double u = 1.0 - session_uniform(state), v = session_uniform(state);
+
+    return sqrt(-2.0 * log(u)) * cos(2 * M_PI * v);
+}
+
+static uint8_t session_button(uint8_t move)
+{
+    uint8_t button = 0;
+    while (move >>= 1)
+        button++;
+    return button;
+}
+
+/*
+ * Calibration: the host build of the firmware, stepped through a game with
+ * the table's settings, timed by sim.time_us.
+ */
+
+static uint16_t cal_input;
+
+static uint16_t cal_sample(void *ctx)
+{
+    (void)ctx;
+    return cal_input;
+}
+
+static uint64_t cal_step(uint16_t sample, enum STATE expect)
+{
+    uint64_t t = sim.time_us;
+
+    cal_input = sample;
+    game_step();
+    if (game.gamestate != expect) {
+        fprintf(stderr, "calibration: game in state %d, expected %d\n",
+                game.gamestate, expect);
+        exit(2);
+    }
+    return sim.time_us - t;
+}
+
+static uint16_t cal_move(uint8_t right)
+{
+    uint8_t button = session_button(get_move(game.player_counter));
+
+    return BUTTON_ADC(right ? button : (button + 1) % NUM_BUTTONS);
+}
+
+/**
+ * session_calibrate()
+ *
+ * \brief Fills in t's step times from the firmware running with its
+ *        settings: a start, two rounds, a wrong move and a win. The
+ *        step times are without the move draw, which comes on top in
+ *        whichever step makes it.
+ */
+static void session_calibrate(struct timing *t)
+{
+    uint64_t show1, show2, round_end, poll;
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    sim_reset(cal_sample, NULL);
+    io_init();
+    settings_load();
+    settings.play_ms = t->play_ms;
+    settings.gap_ms = t->gap_ms;
+    settings.flash_ms = t->flash_ms;
+    settings.pause_ms = t->pause_ms;
+    game_init();
+
+    // A poll or the end of a round draws the next move, unless done already
+    t->start = cal_step(BUTTON_ADC(0), CPU);
+    show1 = cal_step(0, PLAYER);
+    round_end = cal_step(cal_move(1), CPU);
+    show2 = cal_step(0, PLAYER);
+    t->show_move = show2 - show1;
+    t->show = show1 - t->show_move;
+    poll = cal_step(0, PLAYER);
+    t->press = cal_step(cal_move(1), PLAYER);
+    t->poll = cal_step(0, PLAYER);
+    t->draw = poll - t->poll;
+    t->round_end = cal_step(cal_move(1), CPU);
+    if (round_end != t->round_end + t->draw) {
+        fprintf(stderr, "calibration: drawing a move takes %llu or %llu us\n",
+                (unsigned long long)t->draw,
+                (unsigned long long)(round_end - t->round_end));
+        exit(2);
+    }
+    cal_step(0, PLAYER);
+    cal_step(0, PLAYER);
+    t->wrong = cal_step(cal_move(0), LOSE);
+    t->lose = t->lose_ms < 0 ? cal_step(0, IDLE) : (uint64_t)t->lose_ms * 1000;
+
+    game.gamestate = CPU;
+    game.cpu_counter = MAX_MOVES;
+    t->win = cal_step(0, IDLE);
+}
+
+/*
+ * The sessions
+ */
+
+static void player_new(struct player *p)
+{
+    const struct timing *t = session.table;
+    double encode = (t->play_ms + t->gap_ms) / session.encode_ms;
+
+    p->span = session.span + session.span_sd * session_normal(&p->rng);
+    if (encode < 1)
+        p->span *= encode;
+    p->reaction_us = session.reaction_ms * 1000 * exp(0.25 * session_normal(&p->rng));
+    p->held = 0;
+    p->session_from = p->clock;
+    p->session_games = 0;
+}
+
+static uint64_t player_reaction(struct player *p)
+{
+    return (uint64_t)(p->reaction_us * exp(0.35 * session_normal(&p->rng)));
+}
+
+// A round of n moves: all of them right, or which one goes wrong
+static void player_round(struct player *p, uint32_t n)
+{
+    double recall = 1.0 / (1.0 + exp((n - p->span) / session.width));
+
+    p->fail_at = -1;
+    if (session_uniform(&p->rng) >= recall)
+        p->fail_at = session_rand(&p->rng) % n;
+}
+
+static void player_game_over(struct player *p, struct result *r, uint32_t rounds)
+{
+    double quit = rounds < SESSION_SHORT ? session.quit_short : session.quit;
+
+    r->games += 1;
+    r->game_us += p->clock - p->game_from;
+    r->rounds += rounds;
+    r->short_games += rounds < SESSION_SHORT;
+    p->session_games += 1;
+    if (session_uniform(&p->rng) < quit) {
+        r->sessions += 1;
+        r->session_us += p->clock - p->session_from;
+        r->session_games += p->session_games;
+        player_new(p);
+    }
+}
+
+static void *session_worker(void *arg)
+{
+    const struct timing *t = session.table;
+    uintptr_t n = (uintptr_t)arg;
+    uint64_t share = session.games / session.nthreads +
+                     (n < session.games % session.nthreads);
+    struct result r;
+    struct batch b;
+    struct player *players;
+    uint8_t *down, *expected;
+    size_t l;
+
+    memset(&r, 0, sizeof(r));
+    if (batch_init(&b, session.lanes, 1) != 0)
+        return NULL;
+    players = calloc(b.padded, sizeof(*players));
+    down = calloc(b.padded + BATCH_WIDTH, 1);
+    expected = calloc(b.padded, 1);
+    if (!players || !down || !expected) {
+        batch_free(&b);
+        free(players);
+        free(down);
+        free(expected);
+        return NULL;
+    }
+
+    for (l = 0; l < b.lanes; l++) {
+        players[l].rng = session.seed ^ ((uint64_t)(n * b.lanes + l) * 0xD1B54A32D192ED03ULL);
+        batch_seed(&b, l, session_rand(&players[l].rng));
+        player_new(&players[l]);
+    }
+
+    while (r.games < share) {
+        batch_expected(&b, expected);
+        for (l = 0; l < b.lanes; l++) {
+            struct player *p = &players[l];
+            uint32_t cpu = b.cpu_counter[l], player = b.player_counter[l];
+            uint64_t draw = b.move_ready[l] || cpu == MAX_MOVES ? 0 : t->draw;
+
+            down[l] = 0;
+            switch (b.gamestate[l]) {
+            case IDLE:
+                p->clock += player_reaction(p);
+                p->game_from = p->clock;
+                p->clock += t->start;
+                down[l] = 1;
+                break;
+            case CPU:
+                if (cpu == MAX_MOVES) {
+                    p->clock += t->win;
+                    player_game_over(p, &r, MAX_MOVES);
+                    break;
+                }
+                p->clock += t->show + t->show_move * (cpu + 1) + draw;
+                player_round(p, cpu + 1);
+                break;
+            case PLAYER:
+                if (p->held) {
+                    p->held = 0;
+                    p->clock += t->poll + draw;
+                    break;
+                }
+                p->held = 1;
+                p->clock += player_reaction(p);
+                if ((int32_t)player == p->fail_at) {
+                    down[l] = 1 << ((session_button(expected[l]) + 1) % NUM_BUTTONS);
+                    p->clock += t->wrong;
+                } else {
+                    down[l] = expected[l];
+                    p->clock += player == cpu - 1 ? t->round_end + draw : t->press;
+                }
+                break;
+            case LOSE:
+                p->clock += t->lose;
+                player_game_over(p, &r, cpu - 1);
+                break;
+            }
+        }
+        batch_step(&b, down);
+    }
+
+    pthread_mutex_lock(&session.lock);
+    session.result.games += r.games;
+    session.result.game_us += r.game_us;
+    session.result.rounds += r.rounds;
+    session.result.short_games += r.short_games;
+    session.result.sessions += r.sessions;
+    session.result.session_us += r.session_us;
+    session.result.session_games += r.session_games;
+    pthread_mutex_unlock(&session.lock);
+
+    batch_free(&b);
+    free(players);
+    free(down);
+    free(expected);
+    return NULL;
+}
+
+static int session_table(const char *arg, struct timing *t)
+{
+    const char *name = arg;
+    long v[5] = { 0, 0, 0, 50, -1 };
+    char *end;
+    int n;
+
+    for (n = 0; n < 5; n++) {
+        v[n] = strtol(arg, &end, 10);
+        if (end == arg || v[n] < 0 || v[n] > 65535)
+            return -1;
+        arg = end;
+        if (*arg != '/')
+            break;
+        arg++;
+    }
+    if (*arg || n < 2 || v[0] > PLAY_MS_MAX || v[3] > 255)
+        return -1;
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    t->play_ms = v[0];
+    t->gap_ms = v[1];
+    t->pause_ms = v[2];
+    t->flash_ms = v[3];
+    t->lose_ms = v[4];
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *defaults[] = {
+        "500/100/1000", "400/100/750", "350/75/500", "250/50/250",
+    };
+    struct timing tables[SESSION_MAX_TABLES];
+    struct result *r = &session.result;
+    struct timespec t0, t1;
+    pthread_t *threads;
+    double seconds;
+    unsigned i, j, ntables = 0;
+    int opt;
+
+    session.games = 1000000;
+    session.span = 8;
+    session.span_sd = 2;
+    session.width = 1;
+    session.encode_ms = 600;
+    session.reaction_ms = 700;
+    session.quit = 0.3;
+    session.quit_short = 0.6;
+    session.lanes = 4096;
+    session.seed = 1;
+    session.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "g:S:d:w:e:r:q:Q:l:s:j:")) != -1) {
+        switch (opt) {
+        case 'g':
+            session.games = strtoull(optarg, NULL, 0);
+            break;
+        case 'S':
+            session.span = atof(optarg);
+            break;
+        case 'd':
+            session.span_sd = atof(optarg);
+            break;
+        case 'w':
+            session.width = atof(optarg);
+            break;
+        case 'e':
+            session.encode_ms = atof(optarg);
+            break;
+        case 'r':
+            session.reaction_ms = atof(optarg);
+            break;
+        case 'q':
+            session.quit = atof(optarg);
+            break;
+        case 'Q':
+            session.quit_short = atof(optarg);
+            break;
+        case 'l':
+            session.lanes = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            session.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'j':
+            session.nthreads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-g games] [-S span] [-d span_sd] "
+                    "[-w width] [-e encode_ms] [-r reaction_ms] [-q quit] "
+                    "[-Q quit_short] [-l lanes] [-s seed] [-j threads] "
+                    "[play/gap/pause[/flash[/lose]]...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind == argc) {
+        argv = (char **)defaults;
+        argc = sizeof(defaults) / sizeof(defaults[0]);
+        optind = 0;
+    }
+    for (i = optind; i < (unsigned)argc; i++) {
+        const char *arg = argv[i];
+
+        if (ntables == SESSION_MAX_TABLES || session_table(arg, &tables[ntables])) {
+            fprintf(stderr, "bad table %s, or more than %d\n", arg, SESSION_MAX_TABLES);
+            return 2;
+        }
+        ntables++;
+    }
+    if (session.games < 1 || session.lanes < 1 || session.width <= 0 ||
+        session.encode_ms <= 0 || session.quit <= 0 || session.quit_short <= 0) {
+        fprintf(stderr, "need games, lanes, a width, an encode time and a "
+                "chance of quitting\n");
+        return 2;
+    }
+    if (session.nthreads < 1)
+        session.nthreads = 1;
+    threads = calloc(session.nthreads, sizeof(*threads));
+    if (!threads) {
+        perror("calloc");
+        return 2;
+    }
+    pthread_mutex_init(&session.lock, NULL);
+
+    printf("span %.1f +- %.1f, width %.1f, encode %.0f ms, reaction %.0f ms, "
+           "quit %.2f (%.2f short), %llu games a table, %u threads\n\n",
+           session.span, session.span_sd, session.width, session.encode_ms,
+           session.reaction_ms, session.quit, session.quit_short,
+           (unsigned long long)session.games, session.nthreads);
+    printf("%-20s %7s %7s %7s %6s %8s %9s %9s %8s %6s\n", "table", "show", "round",
+           "lose", "rounds", "short", "game s", "session", "games", "games");
+    printf("%-20s %7s %7s %7s %6s %8s %9s %9s %8s %6s\n", "play/gap/pause", "ms/move",
+           "end ms", "ms", "mean", "games", "mean", "min", "/session", "/hour");
+
+    for (i = 0; i < ntables; i++) {
+        session_calibrate(&tables[i]);
+        session.table = &tables[i];
+        memset(r, 0, sizeof(*r));
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (j = 0; j < session.nthreads; j++)
+            pthread_create(&threads[j], NULL, session_worker, (void *)(uintptr_t)j);
+        for (j = 0; j < session.nthreads; j++)
+            pthread_join(threads[j], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (r->games == 0 || r->sessions == 0) {
+            fprintf(stderr, "out of memory, or no session ended\n");
+            return 2;
+        }
+
+        printf("%-20s %7.0f %7.0f %7.0f %6.2f %7.1f%% %9.1f %9.2f %8.2f %6.1f"
+               "   (%.2f s)\n", tables[i].name, tables[i].show_move / 1e3,
+               tables[i].round_end / 1e3, (tables[i].wrong + tables[i].lose) / 1e3,
+               (double)r->rounds / r->games, 100.0 * r->short_games / r->games,
+               r->game_us / 1e6 / r->games, r->session_us / 60e6 / r->sessions,
+               (double)r->session_games / r->sessions,
+               r->session_games * 3600e6 / r->session_us, seconds);
+    }
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,238 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * See sim.h.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/* Bit numbers, as in <avr/iotn85.h> */
+#define SIM_ADSC 6
+#define SIM_ADIF 4
+#define SIM_WDIE 6
+#define SIM_WDP3 5
+#define SIM_PORF 0
+#define SIM_PCIE 5
+#define SIM_MUX_VBG 0x0C   // MUX3:0 of the 1.1V bandgap
+
+// A pin change samples the button pin against roughly VCC/2
+#define SIM_PIN_HIGH 512
+
+/* Interrupt handlers the firmware may define with ISR() */
+void WDT_vect(void) __attribute__((weak));
+void PCINT0_vect(void) __attribute__((weak));
+
+_Thread_local struct sim sim;
+
+/**
+ * sim_reset()
+ * \param  sim_adc_source  source  Where ADC samples come from.
+ * \param  void *          ctx     Passed back to source.
+ *
+ * \brief Power-on reset of the I/O registers, on a SIM_VCC_MV supply. The
+ *        EEPROM is left alone, just like on the real part.
+ */
+void sim_reset(sim_adc_source source, void *ctx)
+{
+    sim.portb = 0;
+    sim.ddrb = 0;
+    sim.admux = 0;
+    sim.adcsra = 0;
+    sim.adc = 0;
+    sim.tccr0a = 0;
+    sim.tccr0b = 0;
+    sim.tcnt0 = 0;
+    sim.ocr0a = 0;
+    sim.ocr0b = 0;
+    sim.tccr1 = 0;
+    sim.gtccr = 0;
+    sim.tcnt1 = 0;
+    sim.ocr1b = 0;
+    sim.ocr1c = 0;
+    sim.wdtcr = 0;
+    sim.mcusr = 1 << SIM_PORF;
+    sim.gimsk = 0;
+    sim.gifr = 0;
+    sim.pcmsk = 0;
+    sim.sleep_mode = 0;
+    sim.sleeps = 0;
+    sim.interrupts = 0;
+    sim.wdt_due = SIM_WDT_PERIOD;
+    sim.vcc_mv = 0;
+    sim.adc_source = source;
+    sim.adc_ctx = ctx;
+    sim.adc_conversions = 0;
+    sim.exhausted = 0;
+    sim.time_us = 0;
+    sim.trace = 0;
+    sim.trace_ctx = 0;
+    sim.wait = 0;
+    sim.wait_ctx = 0;
+    memset(sim.traced, 0, sizeof(sim.traced));
+}
+
+/**
+ * sim_adcsra()
+ *
+ * \brief Every access to ADCSRA goes through here. A pending conversion
+ *        (ADSC set) completes immediately: the next sample is latched into
+ *        ADC and ADIF is raised, so the firmware's polling loop falls
+ *        straight through. With the bandgap selected the sample is
+ *        1.1V * 1024 / sim.vcc_mv instead, and the source is left alone.
+ */
+uint8_t *sim_adcsra(void)
+{
+    if (sim.adcsra & (1 << SIM_ADSC)) {
+        if (sim.trace)
+            sim_trace_flush();
+        if ((sim.admux & 0x0F) == SIM_MUX_VBG) {
+            uint32_t vbg = 1126400UL / (sim.vcc_mv ? sim.vcc_mv : SIM_VCC_MV);
+            sim.adc = vbg > 0x3FF ? 0x3FF : vbg;
+        } else {
+            sim.adc = sim.adc_source ? sim.adc_source(sim.adc_ctx) & 0x3FF : 0;
+        }
+        sim.adc_conversions += 1;
+        sim.adcsra &= ~(1 << SIM_ADSC);
+        sim.adcsra |= (1 << SIM_ADIF);
+        // A conversion takes 13 ADC clocks at F_CPU/8
+        sim.time_us += 13 * 8;
+    }
+    return &sim.adcsra;
+}
+
+/**
+ * sim_interrupts()
+ *
+ * \brief Called once simulated time reaches sim.wdt_due. Runs the watchdog
+ *        interrupt for every period that went by, as long as the firmware
+ *        has it and interrupts enabled. The period is 16ms doubled for each
+ *        step of the WDP3:0 prescaler.
+ */
+void sim_interrupts(void)
+{
+    uint64_t now = sim.time_us;
+    uint8_t wdp = (sim.wdtcr & 0x07) | (sim.wdtcr >> SIM_WDP3 & 1) << 3;
+
+    while (now >= sim.wdt_due) {
+        if (WDT_vect && sim.interrupts && (sim.wdtcr & (1 << SIM_WDIE))) {
+            // Anything the handler changes is traced at the time it ran
+            sim.time_us = sim.wdt_due;
+            sim.interrupts = 0;
+            WDT_vect();
+            sim.interrupts = 1;
+            if (sim.trace)
+                sim_trace_flush();
+        }
+        sim.wdt_due += (uint64_t)SIM_WDT_PERIOD << wdp;
+    }
+    sim.time_us = now;
+}
+
+/**
+ * sim_sleep()
+ *
+ * \brief The sleep instruction. Time moves on to the next watchdog interrupt,
+ *        which wakes the MCU up. With the watchdog off only the pin change
+ *        interrupt can: every 16ms the next ADC sample is taken as the
+ *        button pin's level, and the first one over SIM_PIN_HIGH (or the
+ *        source running out) wakes the MCU. With neither the real MCU would
+ *        never wake.
+ */
+void sim_sleep(void)
+{
+    if (!sim.interrupts)
+        abort();
+    if (sim.wait)
+        sim.wait(sim.wait_ctx);
+    if (sim.trace)
+        sim_trace_flush();
+    sim.sleeps += 1;
+    if (sim.wdtcr & (1 << SIM_WDIE)) {
+        sim.time_us = sim.wdt_due;
+        sim_interrupts();
+        return;
+    }
+    if (!PCINT0_vect || !(sim.gimsk & (1 << SIM_PCIE)) || !sim.pcmsk)
+        abort();
+    for (;;) {
+        sim.time_us = sim.wdt_due;
+        sim_interrupts();
+        if (!sim.adc_source || sim.adc_source(sim.adc_ctx) >= SIM_PIN_HIGH ||
+            sim.exhausted)
+            break;
+    }
+    sim.interrupts = 0;
+    PCINT0_vect();
+    sim.interrupts = 1;
+    if (sim.trace)
+        sim_trace_flush();
+}
+
+/**
+ * sim_skip()
+ * \param  uint64_t  us  Time to skip.
+ *
+ * \brief Moves time on by us with nothing running, as when powered down
+ *        with the watchdog off. The watchdog keeps its phase.
+ */
+void sim_skip(uint64_t us)
+{
+    sim.time_us += us;
+    sim.wdt_due += us;
+}
+
+/**
+ * sim_trace_flush()
+ *
+ * \brief Reports every traced register that changed since the last call.
+ *        Called before each register access and before time moves on.
+ */
+void sim_trace_flush(void)
+{
+    const uint8_t regs[SIM_EEPROM] = {
+        [SIM_PORTB] = sim.portb,
+        [SIM_DDRB] = sim.ddrb,
+        [SIM_TCCR0A] = sim.tccr0a,
+        [SIM_TCCR1] = sim.tccr1,
+        [SIM_OCR0A] = sim.ocr0a,
+    };
+    int i;
+
+    if (!sim.trace)
+        return;
+    for (i = 0; i < SIM_EEPROM; i++) {
+        if (regs[i] != sim.traced[i]) {
+            sim.traced[i] = regs[i];
+            sim.trace(sim.trace_ctx, i, 0, regs[i]);
+        }
+    }
+}
+
+uint16_t sim_adc(void)
+{
+    return sim.adc;
+}
+
+uint8_t sim_eeprom_read_byte(uintptr_t addr)
+{
+    if (addr >= SIM_EEPROM_SIZE)
+        abort();
+    return sim.eeprom[addr];
+}
+
+void sim_eeprom_write_byte(uintptr_t addr, uint8_t value)
+{
+    if (addr >= SIM_EEPROM_SIZE)
+        abort();
+    if (sim.trace) {
+        sim_trace_flush();
+        sim.trace(sim.trace_ctx, SIM_EEPROM, addr, value);
+    }
+    sim.eeprom[addr] = value;
+    sim.eeprom_writes[addr] += 1;
+    // tWD_EEPROM, erase and write
+    sim.time_us += 3400;
+}
@@ -0,0 +1,150 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Host simulation of the bits of the ATTiny85 that the game touches: PORTB,
+ * DDRB, the ADC, the Timer0/Timer1 registers, the watchdog interrupt, the
+ * EEPROM and the delay loops. The shim headers in
+ * host/include/ point the avr-libc names at this state, so that
+ * nomis-memory-game.c can be compiled unmodified with the host compiler.
+ *
+ * Time does not really pass on the host. _delay_ms() and _delay_us() just add
+ * to sim.time_us, which is plenty fast for fuzzing and other bulk runs. The
+ * watchdog interrupt, if the firmware enabled it, is run from there every
+ * 16ms of simulated time, or as much less often as WDTCR's prescaler says.
+ * Sleeping with the watchdog on skips ahead to its next interrupt, and the
+ * buttons are only seen when the firmware next reads the ADC. With the
+ * watchdog off, sim_sleep() takes a sample every 16ms instead, and one that
+ * pulls PB4 high (SIM_PIN_HIGH) wakes the MCU through PCINT0_vect, as a
+ * press does.
+ *
+ * Builds with SIM_TRACE defined also report every change to the registers
+ * that drive pins (PORTB, DDRB, TCCR0A, TCCR1 and OCR0A) and every EEPROM write to
+ * sim.trace, stamped with the simulated time. Register writes are noticed at
+ * the next register access or delay, so a write that leaves the value as it
+ * was is not reported.
+ */
+#ifndef NOMIS_SIM_H
+#define NOMIS_SIM_H
+
+#include <stdint.h>
+
+#define SIM_EEPROM_SIZE 512
+#define SIM_WDT_PERIOD  16000   // us, watchdog at its shortest timeout
+#define SIM_VCC_MV      3000    // supply voltage unless sim.vcc_mv says
+
+/**
+ * sim_adc_source
+ *
+ * \brief Called once per ADC conversion to get the next 10-bit sample.
+ *        Sets sim.exhausted and returns 0 once it has nothing left to say.
+ */
+typedef uint16_t (*sim_adc_source)(void *ctx);
+
+enum sim_event {
+    SIM_PORTB,
+    SIM_DDRB,
+    SIM_TCCR0A,
+    SIM_TCCR1,
+    SIM_OCR0A,
+    SIM_EEPROM,
+};
+
+/**
+ * sim_trace_fn
+ *
+ * \brief Called with the new value of a traced register, or with the address
+ *        and value of an EEPROM write. The time is in sim.time_us.
+ */
+typedef void (*sim_trace_fn)(void *ctx, enum sim_event event, uint16_t addr,
+                             uint8_t value);
+
+/**
+ * sim_wait_fn
+ *
+ * \brief Called as each delay or sleep starts, where the firmware spends
+ *        nearly all of its time and so where a reset most likely lands.
+ */
+typedef void (*sim_wait_fn)(void *ctx);
+
+struct sim {
+    uint8_t portb;
+    uint8_t ddrb;
+    uint8_t admux;
+    uint8_t adcsra;
+    uint16_t adc;
+
+    uint8_t tccr0a;
+    uint8_t tccr0b;
+    uint8_t tcnt0;
+    uint8_t ocr0a;
+    uint8_t ocr0b;
+
+    uint8_t tccr1;
+    uint8_t gtccr;
+    uint8_t tcnt1;
+    uint8_t ocr1b;
+    uint8_t ocr1c;
+
+    uint8_t wdtcr;
+    uint8_t mcusr;
+    uint8_t gimsk;
+    uint8_t gifr;
+    uint8_t pcmsk;
+    uint8_t sleep_mode;     // set_sleep_mode(), as the SM bits of MCUCR
+    uint32_t sleeps;
+    uint8_t interrupts;     // global interrupt enable, sei()/cli()
+    uint64_t wdt_due;       // time of the next watchdog interrupt
+    uint16_t vcc_mv;        // supply voltage, 0 for SIM_VCC_MV
+
+    sim_adc_source adc_source;
+    void *adc_ctx;
+    uint32_t adc_conversions;
+    int exhausted;
+
+    uint64_t time_us;
+
+    sim_trace_fn trace;
+    void *trace_ctx;
+    sim_wait_fn wait;
+    void *wait_ctx;
+    uint8_t traced[SIM_EEPROM];     // last reported value of each register
+
+    uint8_t eeprom[SIM_EEPROM_SIZE];
+    uint32_t eeprom_writes[SIM_EEPROM_SIZE];
+};
+
+// One simulated chip per thread, so host tools can run games in parallel
+extern _Thread_local struct sim sim;
+
+void sim_reset(sim_adc_source source, void *ctx);
+uint8_t *sim_adcsra(void);
+uint16_t sim_adc(void);
+void sim_interrupts(void);
+void sim_trace_flush(void);
+void sim_sleep(void);
+void sim_skip(uint64_t us);
+
+#ifdef SIM_TRACE
+static inline uint8_t *sim_io(uint8_t *reg)
+{
+    sim_trace_flush();
+    return reg;
+}
+#endif
+
+static inline void sim_delay_us(double us)
+{
+    if (sim.wait)
+        sim.wait(sim.wait_ctx);
+    if (sim.trace)
+        sim_trace_flush();
+    sim.time_us += (uint64_t)us;
+    if (sim.time_us >= sim.wdt_due)
+        sim_interrupts();
+}
+
+uint8_t sim_eeprom_read_byte(uintptr_t addr);
+void sim_eeprom_write_byte(uintptr_t addr, uint8_t value);
+
+#endif
@@ -0,0 +1,476 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Golden I/O trace regression check. Runs the game on a fixed seed with
+ * scripted button presses, records every change to PORTB, DDRB, TCCR0A,
+ * TCCR1 and OCR0A and every EEPROM write with its simulated time, and compares the
+ * trace with the golden one checked in next to the script.
+ *
+ *   trace [-u] [-t] [-p] script.in...
+ *
+ *   -u  write the traces as the new golden ones instead of comparing
+ *   -t  fail when only the timing changed, too
+ *   -p  print the trace to stdout instead
+ *
+ * The golden trace for script.in is script.trace. A change in what the pins
+ * or the EEPROM see fails the check and prints where the traces part ways. A
+ * change that only moves events in time passes, but the largest shift and
+ * the change in total run time are reported, so an optimization can be shown
+ * to keep the behavior and what it did to the timing.
+ *
+ * Scripts are one command per line, # starts a comment:
+ *
+ *   seed N         EEPROM seed at power up (default 0xFFFF, blank EEPROM)
+ *   release N      N ADC samples with no button down
+ *   press B N      N ADC samples with button B (0 based) down
+ *   play N         N correct presses, each after a release, of whatever
+ *                  the game expects next. Stops early outside PLAYER
+ *   miss           a release then a press of the wrong button
+ *   reset          warm reset once the current game step is done, the game
+ *                  resumes from SRAM like main() would have it
+ *   vcc MV         the supply is MV millivolts from the next sample on
+ *                  (default 3000)
+ *
+ * The run ends when the script does. The game's configuration is part of the
+ * trace, so a trace only compares against one made with the same DEFS.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+#define TRACE_MAX_COMMANDS 256
+#define TRACE_LINE         128
+
+#define STR_(x) #x
+#define STR(x)  STR_(x)
+#define TRACE_CONFIG "# NUM_BUTTONS=" STR(NUM_BUTTONS) " MAX_MOVES=" STR(MAX_MOVES) \
+    " MOVES_PACKED=" STR(MOVES_PACKED) " SAVE_SEED=" STR(SAVE_SEED) \
+    " PWM_LEDS=" STR(PWM_LEDS) " LED_BRIGHTNESS=" STR(LED_BRIGHTNESS) \
+    " TONE=" STR(TONE) " BATTERY=" STR(BATTERY)
+
+enum trace_op {
+    OP_RELEASE,
+    OP_PRESS,
+    OP_PLAY,
+    OP_MISS,
+    OP_RESET,
+    OP_VCC,
+};
+
+struct trace_command {
+    enum trace_op op;
+    uint16_t button;
+    uint32_t count;
+};
+
+struct trace_script {
+    struct trace_command commands[TRACE_MAX_COMMANDS];
+    int n;
+    int pos;
+    uint32_t left;          // samples (or presses) left in the current command
+    uint8_t released;       // play/miss has let go of the last button
+    uint8_t reset;          // a reset is due after this step
+    uint16_t seed;
+};
+
+struct trace_event {
+    uint64_t time_us;
+    char text[TRACE_LINE];
+};
+
+struct trace {
+    struct trace_event *events;
+    size_t n;
+    size_t size;
+};
+
+static const char *event_names[] = {
+    [SIM_PORTB] = "PORTB",
+    [SIM_DDRB] = "DDRB",
+    [SIM_TCCR0A] = "TCCR0A",
+    [SIM_TCCR1] = "TCCR1",
+    [SIM_OCR0A] = "OCR0A",
+    [SIM_EEPROM] = "EEPROM",
+};
+
+static void trace_add(struct trace *t, uint64_t time_us, const char *text)
+{
+    if (t->n == t->size) {
+        t->size = t->size ? 2 * t->size : 1024;
+        t->events = realloc(t->events, t->size * sizeof(*t->events));
+        if (!t->events) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    t->events[t->n].time_us = time_us;
+    snprintf(t->events[t->n].text, TRACE_LINE, "%s", text);
+    t->n += 1;
+}
+
+static void trace_record(void *ctx, enum sim_event event, uint16_t addr, uint8_t value)
+{
+    char text[TRACE_LINE];
+
+    if (event == SIM_EEPROM)
+        snprintf(text, sizeof(text), "EEPROM[%u] 0x%02X", addr, value);
+    else
+        snprintf(text, sizeof(text), "%s 0x%02X", event_names[event], value);
+    trace_add(ctx, sim.time_us, text);
+}
+
+static uint8_t trace_move_button(uint8_t move)
+{
+    uint8_t button = 0;
+    while (move >>= 1)
+        button++;
+    return button;
+}
+
+static uint16_t trace_next_sample(void *ctx)
+{
+    struct trace_script *s = ctx;
+    struct trace_command *c;
+    uint8_t button;
+
+    while (s->pos < s->n) {
+        c = &s->commands[s->pos];
+        if (s->left == 0 || ((c->op == OP_PLAY || c->op == OP_MISS) && game.gamestate != PLAYER)) {
+            s->pos += 1;
+            s->left = s->pos < s->n ? s->commands[s->pos].count : 0;
+            s->released = 0;
+            continue;
+        }
+
+        switch (c->op) {
+        case OP_RELEASE:
+            s->left -= 1;
+            return 0;
+        case OP_PRESS:
+            s->left -= 1;
+            return BUTTON_ADC(c->button % NUM_BUTTONS);
+        case OP_PLAY:
+        case OP_MISS:
+            // Release first, so the press is always seen as a new edge
+            s->released = !s->released;
+            if (s->released)
+                return 0;
+            s->left -= 1;
+            button = trace_move_button(get_move(game.player_counter));
+            if (c->op == OP_MISS)
+                button += 1;
+            return BUTTON_ADC(button % NUM_BUTTONS);
+        case OP_RESET:
+            s->left -= 1;
+            s->reset = 1;
+            break;
+        case OP_VCC:
+            s->left -= 1;
+            sim.vcc_mv = c->button;
+            break;
+        }
+    }
+    sim.exhausted = 1;
+    return 0;
+}
+
+static int trace_parse(const char *path, struct trace_script *s)
+{
+    char line[128], op[16];
+    unsigned a, b;
+    int lineno = 0, args;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    s->seed = 0xFFFF;
+    while (fgets(line, sizeof(line), f)) {
+        struct trace_command *c = &s->commands[s->n];
+
+        lineno += 1;
+        line[strcspn(line, "#")] = '\0';
+        args = sscanf(line, "%15s %i %i", op, &a, &b);
+        if (args <= 0)
+            continue;
+        if (s->n == TRACE_MAX_COMMANDS) {
+            fprintf(stderr, "%s:%d: too many commands\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        if (!strcmp(op, "seed") && args == 2) {
+            s->seed = a;
+            continue;
+        } else if (!strcmp(op, "release") && args == 2) {
+            *c = (struct trace_command){ OP_RELEASE, 0, a };
+        } else if (!strcmp(op, "press") && args == 3) {
+            *c = (struct trace_command){ OP_PRESS, a, b };
+        } else if (!strcmp(op, "play") && args == 2) {
+            *c = (struct trace_command){ OP_PLAY, 0, a };
+        } else if (!strcmp(op, "miss") && args == 1) {
+            *c = (struct trace_command){ OP_MISS, 0, 1 };
+        } else if (!strcmp(op, "reset") && args == 1) {
+            *c = (struct trace_command){ OP_RESET, 0, 1 };
+        } else if (!strcmp(op, "vcc") && args == 2) {
+            *c = (struct trace_command){ OP_VCC, a, 1 };
+        } else {
+            fprintf(stderr, "%s:%d: bad command\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        s->n += 1;
+    }
+    fclose(f);
+    s->left = s->n ? s->commands[0].count : 0;
+    return 0;
+}
+
+static void trace_run(struct trace_script *s, struct trace *t)
+{
+    uint32_t steps = 0;
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    sim.eeprom[SEED_ADDR] = s->seed & 0xFF;
+    sim.eeprom[SEED_ADDR + 1] = s->seed >> 8;
+
+    sim_reset(trace_next_sample, s);
+    sim.trace = trace_record;
+    sim.trace_ctx = t;
+    io_init();
+    settings_load();
+    game_init();
+    while (!sim.exhausted) {
+        game_step();
+        if (s->reset) {
+            s->reset = 0;
+            if (!game_resume())
+                game_init();
+        }
+        // A script that stops the game reading the buttons would never end
+        if (++steps > 1000000) {
+            fprintf(stderr, "the game stopped reading the buttons\n");
+            exit(2);
+        }
+    }
+    sim_trace_flush();
+    trace_add(t, sim.time_us, "END");
+}
+
+static int trace_load(const char *path, struct trace *t)
+{
+    char line[TRACE_LINE + 32], text[TRACE_LINE];
+    unsigned long long time_us;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') {
+            line[strcspn(line, "\n")] = '\0';
+            trace_add(t, 0, line);
+        } else if (sscanf(line, "%llu %127[^\n]", &time_us, text) == 2) {
+            trace_add(t, time_us, text);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static void trace_write(FILE *f, const struct trace *t)
+{
+    size_t i;
+
+    for (i = 0; i < t->n; i++) {
+        if (t->events[i].text[0] == '#')
+            fprintf(f, "%s\n", t->events[i].text);
+        else
+            fprintf(f, "%10llu %s\n", (unsigned long long)t->events[i].time_us,
+                    t->events[i].text);
+    }
+}
+
+static void trace_print_around(const char *label, const struct trace *t, size_t at)
+{
+    size_t i = at > 3 ? at - 3 : 0;
+
+    printf("  %s:\n", label);
+    for (; i < t->n && i < at + 4; i++)
+        printf("  %c %10llu %s\n", i == at ? '>' : ' ',
+               (unsigned long long)t->events[i].time_us, t->events[i].text);
+}
+
+/**
+ * trace_channel()
+ *
+ * \brief Length of the name of the register (or EEPROM address) an event is
+ *        for, the part of its text before the value.
+ */
+static size_t trace_channel(const char *text)
+{
+    return strcspn(text, " ");
+}
+
+static size_t trace_next(const struct trace *t, size_t i, const char *key, size_t len)
+{
+    for (; i < t->n; i++) {
+        if (trace_channel(t->events[i].text) == len &&
+            !strncmp(t->events[i].text, key, len))
+            break;
+    }
+    return i;
+}
+
+/**
+ * trace_compare()
+ *
+ * \brief Compares a fresh trace with the golden one. Returns 1 if the events
+ *        differ, or if only the timing does and timing_fails is set.
+ *
+ * Each register and EEPROM address is compared on its own. The note queue
+ * runs off the watchdog tick, so a few microseconds more in the main loop can
+ * move a note change past an LED change without anything being wrong.
+ */
+static int trace_compare(const char *name, const struct trace *golden,
+                         const struct trace *now, int timing_fails)
+{
+    char keys[32][TRACE_LINE];
+    int nkeys = 0, k, moved = 0;
+    size_t i, g, c, len, worst = 0;
+    int64_t delta, worst_delta = 0;
+    const struct trace *t;
+
+    // Every channel either trace has
+    for (t = golden; t; t = t == golden ? now : NULL) {
+        for (i = 0; i < t->n; i++) {
+            len = trace_channel(t->events[i].text);
+            for (k = 0; k < nkeys; k++) {
+                if (strlen(keys[k]) == len && !strncmp(keys[k], t->events[i].text, len))
+                    break;
+            }
+            if (k == nkeys && nkeys < 32) {
+                snprintf(keys[k], TRACE_LINE, "%.*s", (int)len, t->events[i].text);
+                nkeys += 1;
+            }
+        }
+    }
+
+    for (k = 0; k < nkeys; k++) {
+        len = strlen(keys[k]);
+        g = trace_next(golden, 0, keys[k], len);
+        c = trace_next(now, 0, keys[k], len);
+        while (g < golden->n && c < now->n) {
+            if (strcmp(golden->events[g].text, now->events[c].text))
+                break;
+            delta = (int64_t)(now->events[c].time_us - golden->events[g].time_us);
+            if (delta)
+                moved += 1;
+            if (llabs(delta) > llabs(worst_delta)) {
+                worst_delta = delta;
+                worst = c;
+            }
+            g = trace_next(golden, g + 1, keys[k], len);
+            c = trace_next(now, c + 1, keys[k], len);
+        }
+        if (g < golden->n || c < now->n) {
+            printf("%s: FAIL, %s differs from the golden trace\n", name, keys[k]);
+            trace_print_around("golden", golden, g);
+            trace_print_around("now", now, c);
+            return 1;
+        }
+    }
+
+    if (!moved) {
+        printf("%s: ok, %zu events\n", name, now->n);
+        return 0;
+    }
+    // Both end with END, which is the total run time
+    g = golden->n - 1;
+    c = now->n - 1;
+    delta = (int64_t)(now->events[c].time_us - golden->events[g].time_us);
+    printf("%s: %s, %zu events, %d moved in time\n", name,
+           timing_fails ? "FAIL" : "ok", now->n, moved);
+    printf("  largest shift %+lld us at event %zu (%s at %llu us)\n",
+           (long long)worst_delta, worst, now->events[worst].text,
+           (unsigned long long)now->events[worst].time_us);
+    printf("  run time %llu us -> %llu us (%+lld us, %+.2f%%)\n",
+           (unsigned long long)golden->events[g].time_us,
+           (unsigned long long)now->events[c].time_us, (long long)delta,
+           golden->events[g].time_us ?
+           100.0 * delta / golden->events[g].time_us : 0.0);
+    return timing_fails;
+}
+
+int main(int argc, char **argv)
+{
+    static struct trace_script script;
+    char path[4096];
+    int update = 0, timing_fails = 0, print = 0, failed = 0;
+    int i, opt;
+    size_t len;
+
+    for (opt = 1; opt < argc && argv[opt][0] == '-'; opt++) {
+        if (!strcmp(argv[opt], "-u"))
+            update = 1;
+        else if (!strcmp(argv[opt], "-t"))
+            timing_fails = 1;
+        else if (!strcmp(argv[opt], "-p"))
+            print = 1;
+        else
+            break;
+    }
+    if (opt == argc) {
+        fprintf(stderr, "usage: %s [-u] [-t] [-p] script.in...\n", argv[0]);
+        return 2;
+    }
+
+    for (i = opt; i < argc; i++) {
+        struct trace now = { 0 }, golden = { 0 };
+        FILE *f;
+
+        if (trace_parse(argv[i], &script))
+            return 2;
+        trace_add(&now, 0, TRACE_CONFIG);
+        trace_run(&script, &now);
+
+        len = strlen(argv[i]);
+        if (len > 3 && !strcmp(argv[i] + len - 3, ".in"))
+            len -= 3;
+        snprintf(path, sizeof(path), "%.*s.trace", (int)len, argv[i]);
+
+        if (print) {
+            trace_write(stdout, &now);
+        } else if (update) {
+            f = fopen(path, "w");
+            if (!f) {
+                perror(path);
+                return 2;
+            }
+            trace_write(f, &now);
+            fclose(f);
+            printf("%s: wrote %zu events\n", path, now.n);
+        } else {
+            if (trace_load(path, &golden))
+                return 2;
+            if (!golden.n || strcmp(golden.events[0].text, now.events[0].text)) {
+                printf("%s: golden trace is for another build\n  golden: %s\n  now:    %s\n",
+                       argv[i], golden.n ? golden.events[0].text : "", now.events[0].text);
+                failed = 1;
+            } else {
+                failed |= trace_compare(argv[i], &golden, &now, timing_fails);
+            }
+        }
+        free(now.events);
+        free(golden.events);
+    }
+    return failed;
+}
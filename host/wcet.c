@@ -0,0 +1,2154 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Static worst case execution time of the firmware's functions, in CPU
+ * cycles, from the avr-objdump listing `make lst` writes (given the .elf it
+ * runs $OBJDUMP, avr-objdump by default, itself).
+ *
+ *   wcet [-a annotations] [-D name=value] [-F hz] [-f function] [-v]
+ *        image.lst|image.elf
+ *
+ *   -a  loop bounds, indirect call targets, states and budgets, see below
+ *   -D  a number the annotations can use by name, e.g. the build's MAX_MOVES
+ *   -F  CPU clock for the times shown (default 1000000)
+ *   -f  only report this function (and what it calls)
+ *   -v  also show each loop, with its bound and cycles per turn
+ *
+ * Each function is split into basic blocks, and each instruction costs what
+ * the ATTiny85's instruction set manual gives it, a branch or skip taken or
+ * not. Calls cost the call and return plus the callee's worst case. Loops
+ * are found from the dominators, innermost first, and one of n turns costs
+ * n - 1 times the longest way round plus the longest way out. What is left
+ * is a DAG, and the worst case is the longest path through it. ISRs
+ * (__vector_n) also pay for the interrupt response and the vector's rjmp.
+ *
+ * Registers are followed as constants through each function, as far as ldi,
+ * mov and the arithmetic go, so a branch on a known value only goes one way
+ * and the delay loops avr-libc's _delay_ms() and _delay_us() expand to (a
+ * counter set with ldi and counted down to 0) are bounded without help. Any
+ * other loop needs a bound in the annotations. So does an icall.
+ *
+ * The annotations, one per line, # for comments. A <bound>, a <value> and
+ * the offset in <symbol+offset> can be a name given with -D:
+ *
+ *   loop   <function> <where> <bound>
+ *          The loop goes round at most <bound> times each time it is
+ *          entered. <function> may be a pattern, as in the shell. <where> is
+ *          "text" for the innermost loop with code from a source line
+ *          containing text (the listing has the source in it), @n for the
+ *          function's nth loop by address, or the address of the loop's
+ *          first instruction.
+ *   calls  <function> <callee>...
+ *          Where the icalls and ijmps in <function> can go.
+ *   state  <name> <function> <symbol+offset> <value> [<bytes>]
+ *          Also works out <function> as it runs when the variable at
+ *          <symbol+offset> holds <value>, little endian over <bytes> (default
+ *          1), e.g. game_step in each game state. It only holds for loads
+ *          in <function> itself, up to a store to it.
+ *   budget <function>[:<state>] <limit>
+ *          Fail if the worst case is over <limit>: cycles, or with a us or
+ *          ms suffix. A function that can't be bounded fails its budget too,
+ *          and so does one that isn't in the listing.
+ *   if     <name> <annotation>
+ *          Only if <name> isn't 0, e.g. the budget of an ISR that is only
+ *          built with some feature.
+ *
+ * Time asleep and time spent in interrupts that break in is not counted.
+ *
+ * Exits 1 if any budget is exceeded, 2 if the listing or annotations can't
+ * be read.
+ */
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WCET_MAX_INSNS   16384
+#define WCET_MAX_FUNCS   512
+#define WCET_MAX_SOURCES 8192
+#define WCET_MAX_NOTES   256
+#define WCET_MAX_SYMBOLS 512
+#define WCET_MAX_DEFINES 32
+#define WCET_IRQ_CYCLES  6      // interrupt response, then the vector's rjmp
+
+#define NEVER  INT64_MIN / 4    // no path
+
+enum kind {
+    K_PLAIN, K_BRANCH, K_SKIP, K_RJMP, K_JMP, K_RCALL, K_CALL, K_ICALL,
+    K_IJMP, K_RET, K_RETI,
+};
+
+// What the value analysis does with an instruction
+enum val {
+    V_NONE,     // no register or flag changes
+    V_FLAGS,    // flags only, unknown
+    V_DEST,     // first operand register unknown, flags too
+    V_DEST_NF,  // first operand register unknown, flags kept
+    V_LDI, V_MOV, V_MOVW, V_ADD, V_ADC, V_SUB, V_SBC, V_SUBI, V_SBCI, V_CP,
+    V_CPC, V_CPI, V_AND, V_ANDI, V_OR, V_ORI, V_EOR, V_INC, V_DEC, V_COM,
+    V_NEG, V_LSL, V_ROL, V_LSR, V_ROR, V_ASR, V_SWAP, V_ADIW, V_SBIW, V_LDS,
+    V_LD, V_STS, V_ST, V_LPM, V_BSET, V_BCLR, V_CALL,
+};
+
+#define F_C 0x01
+#define F_Z 0x02
+#define F_N 0x04
+#define F_V 0x08
+#define F_S 0x10
+#define F_H 0x20
+#define F_T 0x40
+#define F_I 0x80
+
+struct mnemonic {
+    const char *name;
+    uint8_t kind;
+    uint8_t cycles;     // not taken / not skipping for branches and skips
+    uint8_t val;
+    int8_t bit;         // SREG bit of a branch or of sec/clc..., -1 if none
+    uint8_t set;        // branch if set, or sec rather than clc
+    uint8_t alias;      // operand is used twice (lsl, rol, tst, clr)
+};
+
+static const struct mnemonic mnemonics[] = {
+    { "nop", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "movw", K_PLAIN, 1, V_MOVW, -1, 0, 0 },
+    { "mov", K_PLAIN, 1, V_MOV, -1, 0, 0 },
+    { "ldi", K_PLAIN, 1, V_LDI, -1, 0, 0 },
+    { "ser", K_PLAIN, 1, V_LDI, -1, 0, 0 },
+    { "add", K_PLAIN, 1, V_ADD, -1, 0, 0 },
+    { "lsl", K_PLAIN, 1, V_LSL, -1, 0, 1 },
+    { "adc", K_PLAIN, 1, V_ADC, -1, 0, 0 },
+    { "rol", K_PLAIN, 1, V_ROL, -1, 0, 1 },
+    { "sub", K_PLAIN, 1, V_SUB, -1, 0, 0 },
+    { "subi", K_PLAIN, 1, V_SUBI, -1, 0, 0 },
+    { "sbc", K_PLAIN, 1, V_SBC, -1, 0, 0 },
+    { "sbci", K_PLAIN, 1, V_SBCI, -1, 0, 0 },
+    { "cp", K_PLAIN, 1, V_CP, -1, 0, 0 },
+    { "cpc", K_PLAIN, 1, V_CPC, -1, 0, 0 },
+    { "cpi", K_PLAIN, 1, V_CPI, -1, 0, 0 },
+    { "and", K_PLAIN, 1, V_AND, -1, 0, 0 },
+    { "tst", K_PLAIN, 1, V_AND, -1, 0, 1 },
+    { "andi", K_PLAIN, 1, V_ANDI, -1, 0, 0 },
+    { "cbr", K_PLAIN, 1, V_DEST, -1, 0, 0 },
+    { "or", K_PLAIN, 1, V_OR, -1, 0, 0 },
+    { "ori", K_PLAIN, 1, V_ORI, -1, 0, 0 },
+    { "sbr", K_PLAIN, 1, V_ORI, -1, 0, 0 },
+    { "eor", K_PLAIN, 1, V_EOR, -1, 0, 0 },
+    { "clr", K_PLAIN, 1, V_EOR, -1, 0, 1 },
+    { "com", K_PLAIN, 1, V_COM, -1, 0, 0 },
+    { "neg", K_PLAIN, 1, V_NEG, -1, 0, 0 },
+    { "inc", K_PLAIN, 1, V_INC, -1, 0, 0 },
+    { "dec", K_PLAIN, 1, V_DEC, -1, 0, 0 },
+    { "lsr", K_PLAIN, 1, V_LSR, -1, 0, 0 },
+    { "ror", K_PLAIN, 1, V_ROR, -1, 0, 0 },
+    { "asr", K_PLAIN, 1, V_ASR, -1, 0, 0 },
+    { "swap", K_PLAIN, 1, V_SWAP, -1, 0, 0 },
+    { "adiw", K_PLAIN, 2, V_ADIW, -1, 0, 0 },
+    { "sbiw", K_PLAIN, 2, V_SBIW, -1, 0, 0 },
+    { "bst", K_PLAIN, 1, V_BCLR, 6, 0, 0 },    // T unknown, see transfer()
+    { "bld", K_PLAIN, 1, V_DEST_NF, -1, 0, 0 },
+    { "in", K_PLAIN, 1, V_DEST_NF, -1, 0, 0 },
+    { "out", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "sbi", K_PLAIN, 2, V_NONE, -1, 0, 0 },
+    { "cbi", K_PLAIN, 2, V_NONE, -1, 0, 0 },
+    { "push", K_PLAIN, 2, V_NONE, -1, 0, 0 },
+    { "pop", K_PLAIN, 2, V_DEST_NF, -1, 0, 0 },
+    { "lds", K_PLAIN, 2, V_LDS, -1, 0, 0 },
+    { "sts", K_PLAIN, 2, V_STS, -1, 0, 0 },
+    { "ld", K_PLAIN, 2, V_LD, -1, 0, 0 },
+    { "ldd", K_PLAIN, 2, V_LD, -1, 0, 0 },
+    { "st", K_PLAIN, 2, V_ST, -1, 0, 0 },
+    { "std", K_PLAIN, 2, V_ST, -1, 0, 0 },
+    { "lpm", K_PLAIN, 3, V_LPM, -1, 0, 0 },
+    { "wdr", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "sleep", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "break", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "sec", K_PLAIN, 1, V_BSET, 0, 1, 0 },
+    { "clc", K_PLAIN, 1, V_BCLR, 0, 0, 0 },
+    { "sez", K_PLAIN, 1, V_BSET, 1, 1, 0 },
+    { "clz", K_PLAIN, 1, V_BCLR, 1, 0, 0 },
+    { "sen", K_PLAIN, 1, V_BSET, 2, 1, 0 },
+    { "cln", K_PLAIN, 1, V_BCLR, 2, 0, 0 },
+    { "sev", K_PLAIN, 1, V_BSET, 3, 1, 0 },
+    { "clv", K_PLAIN, 1, V_BCLR, 3, 0, 0 },
+    { "ses", K_PLAIN, 1, V_BSET, 4, 1, 0 },
+    { "cls", K_PLAIN, 1, V_BCLR, 4, 0, 0 },
+    { "seh", K_PLAIN, 1, V_BSET, 5, 1, 0 },
+    { "clh", K_PLAIN, 1, V_BCLR, 5, 0, 0 },
+    { "set", K_PLAIN, 1, V_BSET, 6, 1, 0 },
+    { "clt", K_PLAIN, 1, V_BCLR, 6, 0, 0 },
+    { "sei", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "cli", K_PLAIN, 1, V_NONE, -1, 0, 0 },
+    { "brcs", K_BRANCH, 1, V_NONE, 0, 1, 0 },
+    { "brlo", K_BRANCH, 1, V_NONE, 0, 1, 0 },
+    { "brcc", K_BRANCH, 1, V_NONE, 0, 0, 0 },
+    { "brsh", K_BRANCH, 1, V_NONE, 0, 0, 0 },
+    { "breq", K_BRANCH, 1, V_NONE, 1, 1, 0 },
+    { "brne", K_BRANCH, 1, V_NONE, 1, 0, 0 },
+    { "brmi", K_BRANCH, 1, V_NONE, 2, 1, 0 },
+    { "brpl", K_BRANCH, 1, V_NONE, 2, 0, 0 },
+    { "brvs", K_BRANCH, 1, V_NONE, 3, 1, 0 },
+    { "brvc", K_BRANCH, 1, V_NONE, 3, 0, 0 },
+    { "brlt", K_BRANCH, 1, V_NONE, 4, 1, 0 },
+    { "brge", K_BRANCH, 1, V_NONE, 4, 0, 0 },
+    { "brhs", K_BRANCH, 1, V_NONE, 5, 1, 0 },
+    { "brhc", K_BRANCH, 1, V_NONE, 5, 0, 0 },
+    { "brts", K_BRANCH, 1, V_NONE, 6, 1, 0 },
+    { "brtc", K_BRANCH, 1, V_NONE, 6, 0, 0 },
+    { "brie", K_BRANCH, 1, V_NONE, 7, 1, 0 },
+    { "brid", K_BRANCH, 1, V_NONE, 7, 0, 0 },
+    { "cpse", K_SKIP, 1, V_NONE, -1, 0, 0 },
+    { "sbrc", K_SKIP, 1, V_NONE, -1, 0, 0 },
+    { "sbrs", K_SKIP, 1, V_NONE, -1, 1, 0 },
+    { "sbic", K_SKIP, 1, V_NONE, -1, 0, 0 },
+    { "sbis", K_SKIP, 1, V_NONE, -1, 1, 0 },
+    { "rjmp", K_RJMP, 2, V_NONE, -1, 0, 0 },
+    { "jmp", K_JMP, 3, V_NONE, -1, 0, 0 },
+    { "ijmp", K_IJMP, 2, V_NONE, -1, 0, 0 },
+    { "rcall", K_RCALL, 3, V_CALL, -1, 0, 0 },
+    { "call", K_CALL, 4, V_CALL, -1, 0, 0 },
+    { "icall", K_ICALL, 3, V_CALL, -1, 0, 0 },
+    { "ret", K_RET, 4, V_NONE, -1, 0, 0 },
+    { "reti", K_RETI, 4, V_NONE, -1, 0, 0 },
+};
+
+#define NUM_MNEMONICS (sizeof(mnemonics) / sizeof(mnemonics[0]))
+
+struct insn {
+    uint32_t addr;
+    uint8_t words;
+    const struct mnemonic *m;
+    char text[48];          // as listed, for messages
+    int8_t rd, rr;          // registers, -1 for none
+    int32_t k;              // immediate, I/O address, bit or data address
+    uint32_t target;        // jumps, branches and calls
+    uint8_t ptr;            // ld/st: 26 X, 28 Y, 30 Z, 0 for none
+    int8_t ptr_step;        // -1 pre-decrement, 1 post-increment
+    int source;             // index into sources, -1 for none
+};
+
+struct func {
+    char name[128];
+    int first, count;       // instructions
+    int isr;
+    int visiting;           // on the call stack, to catch recursion
+    int done;
+    int64_t wcet;
+    char error[160];
+};
+
+enum note_kind { N_LOOP, N_CALLS, N_STATE, N_BUDGET };
+
+struct note {
+    enum note_kind kind;
+    int line;
+    char func[64];
+    char where[96];         // loop: "text", @n or an address; state: its name
+    int64_t value;          // loop bound, budget in cycles, state value
+    char symbol[64];        // state: symbol+offset
+    int bytes;
+    char callees[8][64];
+    int ncallees;
+    int used;
+};
+
+struct symbol {
+    char name[64];
+    uint32_t addr;          // data address, as in lds/sts
+};
+
+struct define {
+    char name[64];
+    int64_t value;
+};
+
+static struct insn insns[WCET_MAX_INSNS];
+static int ninsns;
+static struct func funcs[WCET_MAX_FUNCS];
+static int nfuncs;
+static char *sources[WCET_MAX_SOURCES];
+static int nsources;
+static struct note notes[WCET_MAX_NOTES];
+static int nnotes;
+static struct symbol symbols[WCET_MAX_SYMBOLS];
+static int nsymbols;
+static struct define defines[WCET_MAX_DEFINES];
+static int ndefines;
+
+static uint32_t hz = 1000000;
+static int verbose;
+
+/*
+ * The listing
+ */
+
+static int reg_of(const char *s)
+{
+    if (s[0] == 'r' && isdigit((unsigned char)s[1]))
+        return atoi(s + 1);
+    return -1;
+}
+
+static void add_symbol(const char *name, uint32_t addr)
+{
+    int i;
+
+    for (i = 0; i < nsymbols; i++) {
+        if (!strcmp(symbols[i].name, name))
+            return;
+    }
+    if (nsymbols < WCET_MAX_SYMBOLS) {
+        snprintf(symbols[nsymbols].name, sizeof(symbols[nsymbols].name), "%s", name);
+        symbols[nsymbols++].addr = addr;
+    }
+}
+
+// "; 0x800067 <game+0x6a>" on an lds or sts: where the symbol is
+static void note_symbol(const char *comment, uint32_t addr)
+{
+    const char *lt = strchr(comment, '<');
+    char name[64];
+    size_t n;
+    uint32_t off = 0;
+
+    if (!lt)
+        return;
+    n = strcspn(lt + 1, "+>");
+    if (n == 0 || n >= sizeof(name))
+        return;
+    memcpy(name, lt + 1, n);
+    name[n] = 0;
+    if (lt[1 + n] == '+')
+        off = strtoul(lt + 2 + n, NULL, 0);
+    add_symbol(name, addr - off);
+}
+
+// The operands, as avr-objdump writes them
+static void parse_operands(struct insn *in, char *ops, const char *comment)
+{
+    char *a = ops, *b = NULL, *c;
+    const char *p;
+
+    in->rd = in->rr = -1;
+    c = strchr(ops, ',');
+    if (c) {
+        *c = 0;
+        b = c + 1;
+        while (*b == ' ')
+            b++;
+    }
+    while (*a == ' ' || *a == '\t')
+        a++;
+
+    // A relative jump or branch, .+4 or .-12
+    if (*a == '.' && (a[1] == '+' || a[1] == '-')) {
+        in->target = in->addr + 2 + strtol(a + 1, NULL, 0);
+        return;
+    }
+    if (b && *b == '.' && (b[1] == '+' || b[1] == '-')) {
+        in->target = in->addr + 2 + strtol(b + 1, NULL, 0);
+        b = NULL;
+    }
+    if (in->m->kind == K_JMP || in->m->kind == K_CALL) {
+        in->target = strtoul(a, NULL, 0);
+        return;
+    }
+
+    // ld r24, Z+ / ldd r24, Y+3 / st -X, r24 / std Z+5, r24 / lpm r0, Z+
+    if (in->m->val == V_LD || in->m->val == V_ST || in->m->val == V_LPM) {
+        p = in->m->val == V_ST ? a : (b ? b : "");
+        if (*p == '-') {
+            in->ptr_step = -1;
+            p++;
+        }
+        in->ptr = *p == 'X' ? 26 : *p == 'Y' ? 28 : *p == 'Z' ? 30 : 0;
+        if (in->ptr && p[1] == '+') {
+            if (isdigit((unsigned char)p[2]))
+                in->k = strtol(p + 2, NULL, 0);
+            else
+                in->ptr_step = 1;
+        }
+    }
+
+    if (in->m->val == V_ST) {
+        in->rr = b ? reg_of(b) : -1;
+    } else if (in->m->val == V_STS) {
+        in->k = strtoul(a, NULL, 0);
+        in->rr = b ? reg_of(b) : -1;
+        if (comment)
+            note_symbol(comment, in->k | 0x800000);
+    } else {
+        in->rd = reg_of(a);
+        if (b) {
+            in->rr = reg_of(b);
+            if (in->rr < 0 && in->m->val != V_LD && in->m->val != V_LPM)
+                in->k = strtol(b, NULL, 0);
+        } else if (in->rd < 0) {
+            in->k = strtol(a, NULL, 0);    // out, sbi and the like: k is first
+        }
+        if (in->m->val == V_LDS && comment)
+            note_symbol(comment, in->k | 0x800000);
+    }
+    // out 0x3f, r24 and sbi/sbic 0x06, 4: the register or bit is second
+    if (in->rd < 0 && b && !in->ptr) {
+        in->k = strtol(a, NULL, 0);
+        in->rr = reg_of(b);
+        if (in->rr < 0)
+            in->rr = strtol(b, NULL, 0);
+    }
+    if (in->m->alias)
+        in->rr = in->rd;
+    if (in->m->val == V_LDI && !strcmp(in->m->name, "ser"))
+        in->k = 0xFF;
+}
+
+static const struct mnemonic *find_mnemonic(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < NUM_MNEMONICS; i++) {
+        if (!strcmp(mnemonics[i].name, name))
+            return &mnemonics[i];
+    }
+    return NULL;
+}
+
+static void add_func(const char *name, uint32_t addr)
+{
+    struct func *f;
+
+    if (nfuncs > 0)
+        funcs[nfuncs - 1].count = ninsns - funcs[nfuncs - 1].first;
+    if (nfuncs == WCET_MAX_FUNCS) {
+        fprintf(stderr, "wcet: more than %d functions\n", WCET_MAX_FUNCS);
+        exit(2);
+    }
+    f = &funcs[nfuncs++];
+    memset(f, 0, sizeof(*f));
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->first = ninsns;
+    f->isr = !strncmp(name, "__vector_", 9) && isdigit((unsigned char)name[9]);
+    (void)addr;
+}
+
+/**
+ * read_listing()
+ *
+ * \brief Reads avr-objdump -d (-S, -h) output: "0000009c <name>:" starts a
+ *        function, "  9c:\t0f 93 \tpush\tr16" is an instruction, and any
+ *        other line that isn't blank is taken as source for the code after
+ *        it.
+ */
+static void read_listing(FILE *f, const char *path)
+{
+    char line[512], label[128], *p, *tab, *mn, *ops, *comment;
+    unsigned long addr;
+    int source = -1, n, bytes, in_text = 1, after_code = 1;
+    struct insn *in;
+
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!strncmp(line, "Disassembly of section ", 23)) {
+            in_text = !strncmp(line + 23, ".text", 5);
+            continue;
+        }
+        if (!in_text)
+            continue;
+        if (sscanf(line, "%lx <%127[^>]>:", &addr, label) == 2 && line[0] != ' ') {
+            add_func(label, addr);
+            source = -1;
+            continue;
+        }
+
+        p = line;
+        while (*p == ' ')
+            p++;
+        for (tab = p; isxdigit((unsigned char)*tab); tab++)
+            ;
+        if (tab > p && tab[0] == ':' && tab[1] == '\t' && nfuncs > 0) {
+            addr = strtoul(p, NULL, 16);
+            // The bytes, then the mnemonic and operands
+            p = tab + 2;
+            bytes = 0;
+            while (isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]) && p[2] == ' ') {
+                bytes++;
+                p += 3;
+            }
+            while (*p == ' ' || *p == '\t')
+                p++;
+            mn = p;
+            n = strcspn(p, "\t ");
+            ops = p + n;
+            if (*ops)
+                *ops++ = 0;
+            comment = strchr(ops, ';');
+            if (comment)
+                *comment++ = 0;
+            if (ninsns == WCET_MAX_INSNS) {
+                fprintf(stderr, "%s: more than %d instructions\n", path, WCET_MAX_INSNS);
+                exit(2);
+            }
+            in = &insns[ninsns++];
+            memset(in, 0, sizeof(*in));
+            in->addr = addr;
+            in->words = bytes >= 4 ? 2 : 1;
+            in->source = source;
+            in->m = find_mnemonic(mn);
+            snprintf(in->text, sizeof(in->text), "%s %s", mn, ops);
+            for (n = strlen(in->text); n > 0 && isspace((unsigned char)in->text[n - 1]); n--)
+                in->text[n - 1] = 0;
+            if (in->m)
+                parse_operands(in, ops, comment);
+            after_code = 1;
+            continue;
+        }
+
+        // Source (or anything else) that comes before the code: all the
+        // lines since the last instruction go with the next ones
+        if (*p && strcmp(p, "...") && nfuncs > 0) {
+            if (source >= 0 && !after_code) {
+                size_t len = strlen(sources[source]);
+                char *joined = realloc(sources[source], len + strlen(p) + 2);
+
+                if (joined) {
+                    sprintf(joined + len, "\n%s", p);
+                    sources[source] = joined;
+                }
+            } else if (nsources < WCET_MAX_SOURCES) {
+                sources[nsources] = strdup(p);
+                source = nsources++;
+            }
+            after_code = 0;
+        }
+    }
+    if (nfuncs > 0)
+        funcs[nfuncs - 1].count = ninsns - funcs[nfuncs - 1].first;
+}
+
+static FILE *open_listing(const char *path, int *piped)
+{
+    char magic[4] = { 0 }, cmd[1024];
+    const char *objdump = getenv("OBJDUMP");
+    FILE *f = fopen(path, "r");
+
+    *piped = 0;
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    if (fread(magic, 1, 4, f) == 4 && !memcmp(magic, "\177ELF", 4)) {
+        fclose(f);
+        snprintf(cmd, sizeof(cmd), "%s -d -S '%s'", objdump ? objdump : "avr-objdump", path);
+        f = popen(cmd, "r");
+        if (!f) {
+            perror(cmd);
+            exit(2);
+        }
+        *piped = 1;
+        return f;
+    }
+    rewind(f);
+    return f;
+}
+
+static int find_func(const char *name)
+{
+    int i;
+
+    for (i = 0; i < nfuncs; i++) {
+        if (!strcmp(funcs[i].name, name))
+            return i;
+    }
+    return -1;
+}
+
+// The function that starts at addr, or -1
+static int func_at(uint32_t addr)
+{
+    int i;
+
+    for (i = 0; i < nfuncs; i++) {
+        if (funcs[i].count > 0 && insns[funcs[i].first].addr == addr)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Annotations
+ */
+
+static int64_t parse_limit(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    if (end == s || v < 0)
+        return -1;
+    if (!strcmp(end, "us"))
+        return (int64_t)(v * hz / 1e6);
+    if (!strcmp(end, "ms"))
+        return (int64_t)(v * hz / 1e3);
+    if (*end)
+        return -1;
+    return (int64_t)v;
+}
+
+// A number, or a name given with -D. Returns -1 if it is neither.
+static int number(const char *s, int64_t *value)
+{
+    char *end;
+    int i;
+
+    *value = strtoll(s, &end, 0);
+    if (end != s && !*end)
+        return 0;
+    for (i = 0; i < ndefines; i++) {
+        if (!strcmp(defines[i].name, s)) {
+            *value = defines[i].value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Splits a line into words, "quoted text" being one
+static int split(char *line, char **words, int max)
+{
+    int n = 0;
+    char *p = line;
+
+    while (n < max) {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (!*p || *p == '#')
+            break;
+        if (*p == '"') {
+            words[n++] = p;
+            p = strchr(p + 1, '"');
+            if (!p)
+                return -1;
+            p++;
+        } else {
+            words[n++] = p;
+            while (*p && !isspace((unsigned char)*p))
+                p++;
+        }
+        if (*p)
+            *p++ = 0;
+    }
+    return n;
+}
+
+static void read_notes(const char *path)
+{
+    char line[512], *w[12], *plus;
+    FILE *f = fopen(path, "r");
+    struct note *n;
+    int lineno = 0, nw, i;
+    int64_t offset, cond;
+
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        nw = split(line, w, 12);
+        if (nw == 0)
+            continue;
+        if (nw < 0 || nnotes == WCET_MAX_NOTES)
+            goto bad;
+        if (!strcmp(w[0], "if")) {
+            if (nw < 3 || number(w[1], &cond))
+                goto bad;
+            if (!cond) {
+                if (isdigit((unsigned char)w[1][0]))
+                    fprintf(stderr, "%s:%d: not used\n", path, lineno);
+                else
+                    fprintf(stderr, "%s:%d: not used, %s is 0\n", path, lineno, w[1]);
+                continue;
+            }
+            nw -= 2;
+            memmove(w, w + 2, nw * sizeof(*w));
+        }
+        n = &notes[nnotes];
+        memset(n, 0, sizeof(*n));
+        n->line = lineno;
+        if (!strcmp(w[0], "loop") && nw == 4) {
+            n->kind = N_LOOP;
+            snprintf(n->func, sizeof(n->func), "%s", w[1]);
+            snprintf(n->where, sizeof(n->where), "%s", w[2]);
+            if (number(w[3], &n->value) || n->value < 1)
+                goto bad;
+        } else if (!strcmp(w[0], "calls") && nw >= 3 && nw <= 10) {
+            n->kind = N_CALLS;
+            snprintf(n->func, sizeof(n->func), "%s", w[1]);
+            for (i = 2; i < nw; i++)
+                snprintf(n->callees[n->ncallees++], sizeof(n->callees[0]), "%s", w[i]);
+        } else if (!strcmp(w[0], "state") && (nw == 5 || nw == 6)) {
+            n->kind = N_STATE;
+            snprintf(n->where, sizeof(n->where), "%s", w[1]);
+            snprintf(n->func, sizeof(n->func), "%s", w[2]);
+            snprintf(n->symbol, sizeof(n->symbol), "%s", w[3]);
+            plus = strchr(w[3], '+');
+            if ((plus && number(plus + 1, &offset)) || number(w[4], &n->value))
+                goto bad;
+            n->bytes = nw == 6 ? atoi(w[5]) : 1;
+            if (n->bytes < 1 || n->bytes > 4)
+                goto bad;
+        } else if (!strcmp(w[0], "budget") && nw == 3) {
+            n->kind = N_BUDGET;
+            snprintf(n->func, sizeof(n->func), "%s", w[1]);
+            n->value = parse_limit(w[2]);
+            if (n->value < 0)
+                goto bad;
+        } else {
+            goto bad;
+        }
+        nnotes++;
+    }
+    fclose(f);
+    return;
+bad:
+    fprintf(stderr, "%s:%d: can't make sense of this\n", path, lineno);
+    exit(2);
+}
+
+// symbol+offset to a data address, or -1
+static int64_t resolve(const char *s)
+{
+    char name[64];
+    size_t n = strcspn(s, "+");
+    int64_t offset = 0;
+    int i;
+
+    if (isdigit((unsigned char)*s))
+        return strtol(s, NULL, 0) | 0x800000;
+    if (n >= sizeof(name) || (s[n] == '+' && number(s + n + 1, &offset)))
+        return -1;
+    memcpy(name, s, n);
+    name[n] = 0;
+    for (i = 0; i < nsymbols; i++) {
+        if (!strcmp(symbols[i].name, name))
+            return symbols[i].addr + offset;
+    }
+    return -1;
+}
+
+/*
+ * Value analysis: which registers and flags hold known values at the start
+ * of each block, and which ways each branch can go.
+ */
+
+struct values {
+    uint8_t reached;
+    uint8_t assumed;        // the state's variable still holds its value
+    uint32_t known;         // registers
+    uint8_t r[32];
+    uint8_t sreg_known;
+    uint8_t sreg;
+};
+
+struct assume {
+    int64_t addr;           // data address | 0x800000, -1 for none
+    int bytes;
+    uint32_t value;
+};
+
+static int known(const struct values *v, int reg)
+{
+    return reg >= 0 && reg < 32 && (v->known >> reg & 1);
+}
+
+static void set_reg(struct values *v, int reg, uint8_t value)
+{
+    if (reg < 0 || reg >= 32)
+        return;
+    v->known |= 1u << reg;
+    v->r[reg] = value;
+}
+
+static void forget_reg(struct values *v, int reg)
+{
+    if (reg >= 0 && reg < 32)
+        v->known &= ~(1u << reg);
+}
+
+static void set_flags(struct values *v, uint8_t mask, uint8_t value)
+{
+    v->sreg_known |= mask;
+    v->sreg = (v->sreg & ~mask) | (value & mask);
+}
+
+static void forget_flags(struct values *v, uint8_t mask)
+{
+    v->sreg_known &= ~mask;
+}
+
+static uint8_t nz(uint8_t res)
+{
+    return (res ? 0 : F_Z) | (res & 0x80 ? F_N : 0);
+}
+
+static uint8_t sub_sreg(uint8_t d, uint8_t r, uint8_t res, int carry_in, int keep_z, uint8_t old)
+{
+    uint8_t s = 0, c, v, n;
+
+    (void)carry_in;
+    c = ((~d & r) | (r & res) | (res & ~d)) & 0x80 ? F_C : 0;
+    v = ((d & ~r & ~res) | (~d & r & res)) & 0x80 ? F_V : 0;
+    n = res & 0x80 ? F_N : 0;
+    s = c | v | n;
+    if (keep_z)
+        s |= (res == 0 && (old & F_Z)) ? F_Z : 0;
+    else
+        s |= res == 0 ? F_Z : 0;
+    if ((n != 0) != (v != 0))
+        s |= F_S;
+    return s;
+}
+
+static uint8_t add_sreg(uint8_t d, uint8_t r, uint8_t res)
+{
+    uint8_t s = 0, c, v, n;
+
+    c = ((d & r) | (r & ~res) | (~res & d)) & 0x80 ? F_C : 0;
+    v = ((d & r & ~res) | (~d & ~r & res)) & 0x80 ? F_V : 0;
+    n = res & 0x80 ? F_N : 0;
+    s = c | v | n | (res == 0 ? F_Z : 0);
+    if ((n != 0) != (v != 0))
+        s |= F_S;
+    return s;
+}
+
+static uint8_t logic_sreg(uint8_t res)
+{
+    return nz(res) | (res & 0x80 ? F_S : 0);
+}
+
+#define ARITH_FLAGS (F_C | F_Z | F_N | F_V | F_S)
+
+static int64_t load_assumed(const struct values *v, const struct assume *as, int64_t addr)
+{
+    if (!as || as->addr < 0 || !v->assumed || addr < as->addr || addr >= as->addr + as->bytes)
+        return -1;
+    return (as->value >> (8 * (addr - as->addr))) & 0xFF;
+}
+
+// Addresses the X, Y or Z pointer holds, or -1
+static int64_t pointer(const struct values *v, int ptr)
+{
+    if (!known(v, ptr) || !known(v, ptr + 1))
+        return -1;
+    return (v->r[ptr] | v->r[ptr + 1] << 8) | 0x800000;
+}
+
+/**
+ * transfer()
+ *
+ * \brief What an instruction does to the known registers and flags.
+ */
+static void transfer(struct values *v, const struct insn *in, const struct assume *as)
+{
+    const struct mnemonic *m = in->m;
+    int d = in->rd, r = in->rr, carry;
+    uint8_t a, b, res;
+    int64_t addr, val;
+    uint16_t w;
+
+    switch (m->val) {
+    case V_NONE:
+        if (!strcmp(m->name, "out") && in->k == 0x3F)
+            forget_flags(v, 0xFF);
+        break;
+    case V_FLAGS:
+        forget_flags(v, ARITH_FLAGS | F_H);
+        break;
+    case V_DEST:
+        forget_reg(v, d);
+        forget_flags(v, ARITH_FLAGS | F_H);
+        break;
+    case V_DEST_NF:
+        forget_reg(v, d);
+        break;
+    case V_LDI:
+        set_reg(v, d, in->k);
+        break;
+    case V_MOV:
+        if (known(v, r))
+            set_reg(v, d, v->r[r]);
+        else
+            forget_reg(v, d);
+        break;
+    case V_MOVW:
+        if (known(v, r))
+            set_reg(v, d, v->r[r]);
+        else
+            forget_reg(v, d);
+        if (known(v, r + 1))
+            set_reg(v, d + 1, v->r[r + 1]);
+        else
+            forget_reg(v, d + 1);
+        break;
+    case V_ADD: case V_LSL: case V_ADC: case V_ROL:
+        carry = m->val == V_ADC || m->val == V_ROL;
+        if (known(v, d) && known(v, r) && (!carry || (v->sreg_known & F_C))) {
+            a = v->r[d];
+            b = v->r[r];
+            res = a + b + (carry && (v->sreg & F_C));
+            set_reg(v, d, res);
+            set_flags(v, ARITH_FLAGS, add_sreg(a, b, res));
+        } else {
+            forget_reg(v, d);
+            forget_flags(v, ARITH_FLAGS);
+        }
+        forget_flags(v, F_H);
+        break;
+    case V_SUB: case V_SUBI: case V_CP: case V_CPI:
+    case V_SBC: case V_SBCI: case V_CPC:
+        carry = m->val == V_SBC || m->val == V_SBCI || m->val == V_CPC;
+        b = (m->val == V_SUBI || m->val == V_CPI || m->val == V_SBCI) ? in->k : v->r[r < 0 ? 0 : r];
+        if (known(v, d) && (m->val == V_SUBI || m->val == V_CPI || m->val == V_SBCI || known(v, r))
+            && (!carry || (v->sreg_known & (F_C | F_Z)) == (F_C | F_Z))) {
+            a = v->r[d];
+            res = a - b - (carry && (v->sreg & F_C));
+            if (m->val != V_CP && m->val != V_CPI && m->val != V_CPC)
+                set_reg(v, d, res);
+            set_flags(v, ARITH_FLAGS, sub_sreg(a, b, res, carry, carry, v->sreg));
+        } else {
+            if (m->val != V_CP && m->val != V_CPI && m->val != V_CPC)
+                forget_reg(v, d);
+            forget_flags(v, ARITH_FLAGS);
+        }
+        forget_flags(v, F_H);
+        break;
+    case V_AND: case V_ANDI: case V_OR: case V_ORI: case V_EOR:
+        if (m->val == V_EOR && d == r) {
+            set_reg(v, d, 0);
+            set_flags(v, F_Z | F_N | F_V | F_S, F_Z);
+            break;
+        }
+        b = (m->val == V_ANDI || m->val == V_ORI) ? in->k : v->r[r < 0 ? 0 : r];
+        if (known(v, d) && (m->val == V_ANDI || m->val == V_ORI || known(v, r))) {
+            a = v->r[d];
+            res = m->val == V_AND || m->val == V_ANDI ? a & b :
+                  m->val == V_EOR ? a ^ b : a | b;
+            set_reg(v, d, res);
+            set_flags(v, F_Z | F_N | F_V | F_S, logic_sreg(res));
+        } else {
+            forget_reg(v, d);
+            forget_flags(v, F_Z | F_N | F_V | F_S);
+        }
+        break;
+    case V_INC: case V_DEC:
+        if (known(v, d)) {
+            a = v->r[d];
+            res = m->val == V_INC ? a + 1 : a - 1;
+            set_reg(v, d, res);
+            set_flags(v, F_Z | F_N | F_V | F_S,
+                      nz(res) | ((m->val == V_INC ? a == 0x7F : a == 0x80) ? F_V : 0) |
+                      (((res & 0x80) != 0) != (m->val == V_INC ? a == 0x7F : a == 0x80) ? F_S : 0));
+        } else {
+            forget_reg(v, d);
+            forget_flags(v, F_Z | F_N | F_V | F_S);
+        }
+        break;
+    case V_SBIW: case V_ADIW:
+        if (known(v, d) && known(v, d + 1)) {
+            w = v->r[d] | v->r[d + 1] << 8;
+            w = m->val == V_SBIW ? w - in->k : w + in->k;
+            set_reg(v, d, w & 0xFF);
+            set_reg(v, d + 1, w >> 8);
+            forget_flags(v, ARITH_FLAGS);
+            set_flags(v, F_Z, w ? 0 : F_Z);
+        } else {
+            forget_reg(v, d);
+            forget_reg(v, d + 1);
+            forget_flags(v, ARITH_FLAGS);
+        }
+        break;
+    case V_COM: case V_NEG: case V_LSR: case V_ROR: case V_ASR: case V_SWAP:
+        forget_reg(v, d);
+        if (m->val != V_SWAP)
+            forget_flags(v, ARITH_FLAGS | F_H);
+        break;
+    case V_LDS:
+        val = load_assumed(v, as, in->k | 0x800000);
+        if (val >= 0)
+            set_reg(v, d, val);
+        else
+            forget_reg(v, d);
+        break;
+    case V_LD:
+        addr = in->ptr ? pointer(v, in->ptr) : -1;
+        if (addr >= 0)
+            addr += in->ptr_step < 0 ? -1 : in->k;
+        val = addr >= 0 ? load_assumed(v, as, addr) : -1;
+        if (in->ptr_step) {
+            forget_reg(v, in->ptr);
+            forget_reg(v, in->ptr + 1);
+        }
+        if (val >= 0)
+            set_reg(v, d, val);
+        else
+            forget_reg(v, d);
+        break;
+    case V_STS:
+        if (load_assumed(v, as, in->k | 0x800000) >= 0)
+            v->assumed = 0;
+        break;
+    case V_ST:
+        addr = in->ptr ? pointer(v, in->ptr) : -1;
+        if (addr >= 0 && load_assumed(v, as, addr + (in->ptr_step < 0 ? -1 : in->k)) >= 0)
+            v->assumed = 0;
+        if (in->ptr_step) {
+            forget_reg(v, in->ptr);
+            forget_reg(v, in->ptr + 1);
+        }
+        break;
+    case V_LPM:
+        forget_reg(v, d < 0 ? 0 : d);
+        if (in->ptr_step) {
+            forget_reg(v, 30);
+            forget_reg(v, 31);
+        }
+        break;
+    case V_BSET:
+        set_flags(v, 1 << m->bit, 0xFF);
+        break;
+    case V_BCLR:
+        if (!strcmp(m->name, "bst"))
+            forget_flags(v, F_T);
+        else
+            set_flags(v, 1 << m->bit, 0);
+        break;
+    case V_CALL:
+        // avr-gcc's ABI: r2-r17 and r28-r29 are kept, r1 is zero again
+        v->known &= 0x3003FFFC;
+        set_reg(v, 1, 0);
+        forget_flags(v, 0xFF);
+        break;
+    }
+    (void)r;
+}
+
+/*
+ * Blocks and loops
+ */
+
+struct edge {
+    int to;                 // block, -1 to leave the function
+    int64_t cost;           // the block's cycles on the way out this edge
+    uint8_t feasible;
+    int16_t callee;         // a jump out of the function: its worst case too
+};
+
+struct block {
+    int first, last;        // instructions, inclusive
+    struct edge e[2 + 8];
+    int ne;
+    int loop;               // innermost loop it is in, -1 for none
+    char bad[160];          // why it can't be costed
+    struct values in;
+};
+
+struct loop {
+    int header;
+    uint8_t *body;          // blocks
+    int size;
+    int parent;
+    int64_t bound;          // times the header runs, -1 unknown
+    int64_t iter, out, total;
+    int done;
+};
+
+struct cfg {
+    struct func *f;
+    const struct assume *as;
+    struct block *b;
+    int nb;
+    int *block_of;          // instruction (from f->first) to block
+    struct loop *loops;
+    int nloops;
+    int64_t *memo;
+    uint8_t *state;         // longest path DFS: 0 new, 1 on the stack, 2 done
+    char *error;
+    size_t error_len;
+};
+
+static int64_t func_wcet(int fi);
+
+// The last source line before an instruction, for messages
+static const char *source_line(int source)
+{
+    const char *nl;
+
+    if (source < 0)
+        return "";
+    nl = strrchr(sources[source], '\n');
+    return nl ? nl + 1 : sources[source];
+}
+
+static void fail(struct cfg *c, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (c->error[0])
+        return;
+    va_start(ap, fmt);
+    vsnprintf(c->error, c->error_len, fmt, ap);
+    va_end(ap);
+}
+
+static int index_of(const struct cfg *c, uint32_t addr)
+{
+    int lo = c->f->first, hi = c->f->first + c->f->count - 1, mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (insns[mid].addr == addr)
+            return mid;
+        if (insns[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+static const struct note *calls_note(const char *func)
+{
+    int i;
+
+    for (i = 0; i < nnotes; i++) {
+        if (notes[i].kind == N_CALLS && !strcmp(notes[i].func, func))
+            return &notes[i];
+    }
+    return NULL;
+}
+
+// Worst case of a call, or of an icall over its annotated targets
+static int64_t call_cost(struct cfg *c, const struct insn *in)
+{
+    const struct note *n;
+    int64_t worst = NEVER, w;
+    int fi, i;
+
+    if (in->m->kind != K_ICALL && in->m->kind != K_IJMP) {
+        fi = func_at(in->target);
+        if (fi < 0) {
+            fail(c, "%s at 0x%x goes to 0x%x, which is no function's start",
+                 in->m->name, in->addr, in->target);
+            return NEVER;
+        }
+        w = func_wcet(fi);
+        if (w == NEVER)
+            fail(c, "calls %s: %s", funcs[fi].name, funcs[fi].error);
+        return w;
+    }
+    n = calls_note(c->f->name);
+    if (!n) {
+        fail(c, "%s at 0x%x needs a \"calls %s ...\" annotation", in->m->name,
+             in->addr, c->f->name);
+        return NEVER;
+    }
+    ((struct note *)n)->used = 1;
+    for (i = 0; i < n->ncallees; i++) {
+        fi = find_func(n->callees[i]);
+        if (fi < 0) {
+            fail(c, "no function %s to call", n->callees[i]);
+            return NEVER;
+        }
+        w = func_wcet(fi);
+        if (w == NEVER) {
+            fail(c, "calls %s: %s", funcs[fi].name, funcs[fi].error);
+            return NEVER;
+        }
+        if (w > worst)
+            worst = w;
+    }
+    return worst;
+}
+
+static void add_edge(struct block *b, int to, int64_t cost, int16_t callee)
+{
+    b->e[b->ne].to = to;
+    b->e[b->ne].cost = cost;
+    b->e[b->ne].feasible = 0;
+    b->e[b->ne].callee = callee;
+    b->ne++;
+}
+
+/**
+ * build_blocks()
+ *
+ * \brief Splits the function into blocks and costs their edges.
+ */
+static int build_blocks(struct cfg *c)
+{
+    struct func *f = c->f;
+    uint8_t *leader = calloc(f->count + 1, 1);
+    int i, j, t, nb = 0, fi;
+    int64_t cost, w;
+    struct block *b;
+    char *error;
+    size_t error_len;
+    const struct insn *in, *last;
+
+    if (!leader)
+        return -1;
+    leader[0] = 1;
+    for (i = 0; i < f->count; i++) {
+        in = &insns[f->first + i];
+        if (!in->m) {
+            leader[i] = leader[i + 1] = 1;
+            continue;
+        }
+        switch (in->m->kind) {
+        case K_BRANCH: case K_RJMP: case K_JMP:
+            t = index_of(c, in->target);
+            if (t >= 0)
+                leader[t - f->first] = 1;
+            leader[i + 1] = 1;
+            break;
+        case K_SKIP:
+            leader[i + 1] = 1;
+            if (i + 2 <= f->count)
+                leader[i + 2] = 1;
+            break;
+        case K_RET: case K_RETI: case K_IJMP:
+            leader[i + 1] = 1;
+            break;
+        }
+    }
+    for (i = 0; i < f->count; i++)
+        nb += leader[i];
+    c->b = calloc(nb, sizeof(*c->b));
+    c->block_of = calloc(f->count + 1, sizeof(int));
+    if (!c->b || !c->block_of) {
+        free(leader);
+        return -1;
+    }
+    c->nb = nb;
+    for (i = 0, j = -1; i < f->count; i++) {
+        if (leader[i]) {
+            j++;
+            c->b[j].first = f->first + i;
+        }
+        c->b[j].last = f->first + i;
+        c->block_of[i] = j;
+    }
+    free(leader);
+
+    // A block that can't be costed only fails the function if it is reached
+    error = c->error;
+    error_len = c->error_len;
+    c->error_len = sizeof(b->bad);
+    for (j = 0; j < nb; j++) {
+        b = &c->b[j];
+        b->loop = -1;
+        c->error = b->bad;
+        cost = 0;
+        for (i = b->first; i <= b->last; i++) {
+            in = &insns[i];
+            if (!in->m) {
+                fail(c, "don't know \"%s\" at 0x%x", in->text, in->addr);
+                break;
+            }
+            if (i == b->last)
+                break;
+            cost += in->m->cycles;
+            if (in->m->kind == K_RCALL || in->m->kind == K_CALL || in->m->kind == K_ICALL) {
+                w = call_cost(c, in);
+                if (w == NEVER)
+                    break;
+                cost += w;
+            }
+        }
+        if (b->bad[0])
+            continue;
+        last = &insns[b->last];
+        t = -1;
+        switch (last->m->kind) {
+        case K_BRANCH:
+            t = index_of(c, last->target);
+            add_edge(b, j + 1 < nb ? j + 1 : -1, cost + 1, -1);
+            if (t < 0) {
+                fail(c, "branch out of the function at 0x%x", last->addr);
+                break;
+            }
+            add_edge(b, c->block_of[t - f->first], cost + 2, -1);
+            break;
+        case K_SKIP:
+            add_edge(b, j + 1 < nb ? j + 1 : -1, cost + 1, -1);
+            if (b->last + 1 < f->first + f->count) {
+                t = b->last + 2 - f->first;
+                add_edge(b, t < f->count ? c->block_of[t] : -1,
+                         cost + 1 + insns[b->last + 1].words, -1);
+            }
+            break;
+        case K_RJMP: case K_JMP:
+            t = index_of(c, last->target);
+            if (t >= 0) {
+                add_edge(b, c->block_of[t - f->first], cost + last->m->cycles, -1);
+                break;
+            }
+            // A tail call
+            fi = func_at(last->target);
+            w = fi >= 0 ? func_wcet(fi) : NEVER;
+            if (w == NEVER) {
+                if (fi < 0)
+                    fail(c, "jump at 0x%x to 0x%x, no function starts there",
+                         last->addr, last->target);
+                else
+                    fail(c, "jumps to %s: %s", funcs[fi].name, funcs[fi].error);
+                break;
+            }
+            add_edge(b, -1, cost + last->m->cycles + w, fi);
+            break;
+        case K_IJMP:
+            w = call_cost(c, last);
+            if (w == NEVER)
+                break;
+            add_edge(b, -1, cost + last->m->cycles + w, -1);
+            break;
+        case K_RET: case K_RETI:
+            add_edge(b, -1, cost + last->m->cycles, -1);
+            break;
+        default:
+            cost += last->m->cycles;
+            if (last->m->kind == K_RCALL || last->m->kind == K_CALL || last->m->kind == K_ICALL) {
+                w = call_cost(c, last);
+                if (w == NEVER)
+                    break;
+                cost += w;
+            }
+            if (j + 1 < nb) {
+                add_edge(b, j + 1, cost, -1);
+            } else {
+                // Falls off the end into whatever comes next
+                fi = func_at(last->addr + 2 * last->words);
+                w = fi >= 0 ? func_wcet(fi) : NEVER;
+                if (w == NEVER) {
+                    if (fi < 0)
+                        fail(c, "runs off its end at 0x%x", last->addr);
+                    else
+                        fail(c, "runs into %s: %s", funcs[fi].name, funcs[fi].error);
+                    break;
+                }
+                add_edge(b, -1, cost + w, fi);
+            }
+            break;
+        }
+        if (b->bad[0])
+            b->ne = 0;
+    }
+    c->error = error;
+    c->error_len = error_len;
+    return 0;
+}
+
+static void meet(struct values *into, const struct values *v)
+{
+    uint32_t same = 0;
+    int i;
+
+    if (!into->reached) {
+        *into = *v;
+        return;
+    }
+    for (i = 0; i < 32; i++) {
+        if (into->r[i] == v->r[i])
+            same |= 1u << i;
+    }
+    into->known &= v->known & same;
+    into->sreg_known &= v->sreg_known & ~(into->sreg ^ v->sreg);
+    into->assumed &= v->assumed;
+}
+
+static int values_equal(const struct values *a, const struct values *b)
+{
+    uint32_t i;
+
+    if (a->reached != b->reached || a->known != b->known || a->assumed != b->assumed
+        || a->sreg_known != b->sreg_known || ((a->sreg ^ b->sreg) & a->sreg_known))
+        return 0;
+    for (i = 0; i < 32; i++) {
+        if ((a->known >> i & 1) && a->r[i] != b->r[i])
+            return 0;
+    }
+    return 1;
+}
+
+// Runs the block's instructions but the last, which decides where it goes
+static void block_out(const struct cfg *c, const struct block *b, struct values *v)
+{
+    int i;
+
+    *v = b->in;
+    for (i = b->first; i < b->last && insns[i].m; i++)
+        transfer(v, &insns[i], c->as);
+}
+
+// Which edges the last instruction can take, given the values before it
+static void decide(const struct block *b, const struct values *v, int *go)
+{
+    const struct insn *in = &insns[b->last];
+    int taken = -1;
+
+    go[0] = go[1] = 1;
+    if (in->m->kind == K_BRANCH && (v->sreg_known >> in->m->bit & 1))
+        taken = ((v->sreg >> in->m->bit & 1) == in->m->set);
+    if (in->m->kind == K_SKIP && !strcmp(in->m->name, "cpse") && known(v, in->rd) && known(v, in->rr))
+        taken = v->r[in->rd] == v->r[in->rr];
+    if (in->m->kind == K_SKIP && in->m->name[2] == 'r' && known(v, in->rd))
+        taken = ((v->r[in->rd] >> in->k) & 1) == in->m->set;
+    if (taken >= 0 && b->ne == 2) {
+        go[0] = !taken;
+        go[1] = taken;
+    }
+}
+
+/**
+ * find_values()
+ *
+ * \brief Forward data flow to a fixed point. Blocks no feasible edge gets
+ *        to are left unreached.
+ */
+static void find_values(struct cfg *c)
+{
+    int *work = malloc(sizeof(int) * (c->nb + 1));
+    uint8_t *queued = calloc(c->nb, 1);
+    int nwork = 0, j, k, go[2 + 8];
+    struct values out, before;
+    struct block *b;
+
+    if (!work || !queued) {
+        free(work);
+        free(queued);
+        return;
+    }
+    memset(&c->b[0].in, 0, sizeof(c->b[0].in));
+    c->b[0].in.reached = 1;
+    c->b[0].in.assumed = 1;
+    set_reg(&c->b[0].in, 1, 0);    // the zero register
+    work[nwork++] = 0;
+    queued[0] = 1;
+    while (nwork > 0) {
+        j = work[--nwork];
+        queued[j] = 0;
+        b = &c->b[j];
+        block_out(c, b, &out);
+        for (k = 0; k < b->ne; k++)
+            go[k] = 1;
+        decide(b, &out, go);
+        transfer(&out, &insns[b->last], c->as);
+        for (k = 0; k < b->ne; k++) {
+            if (!go[k])
+                continue;
+            b->e[k].feasible = 1;
+            if (b->e[k].to < 0)
+                continue;
+            before = c->b[b->e[k].to].in;
+            meet(&c->b[b->e[k].to].in, &out);
+            if (!values_equal(&before, &c->b[b->e[k].to].in) && !queued[b->e[k].to]) {
+                queued[b->e[k].to] = 1;
+                work[nwork++] = b->e[k].to;
+            }
+        }
+    }
+    free(work);
+    free(queued);
+}
+
+// Dominators over the reached blocks, as bitsets
+static uint8_t *dominators(const struct cfg *c)
+{
+    int nb = c->nb, changed = 1, j, k, p, i;
+    uint8_t *dom = malloc((size_t)nb * nb), *tmp = malloc(nb);
+
+    if (!dom || !tmp) {
+        free(dom);
+        free(tmp);
+        return NULL;
+    }
+    memset(dom, 1, (size_t)nb * nb);
+    memset(dom, 0, nb);
+    dom[0] = 1;
+    while (changed) {
+        changed = 0;
+        for (j = 1; j < nb; j++) {
+            if (!c->b[j].in.reached)
+                continue;
+            memset(tmp, 1, nb);
+            for (p = 0; p < nb; p++) {
+                if (!c->b[p].in.reached)
+                    continue;
+                for (k = 0; k < c->b[p].ne; k++) {
+                    if (c->b[p].e[k].to == j && c->b[p].e[k].feasible) {
+                        for (i = 0; i < nb; i++)
+                            tmp[i] &= dom[(size_t)p * nb + i];
+                    }
+                }
+            }
+            tmp[j] = 1;
+            if (memcmp(tmp, dom + (size_t)j * nb, nb)) {
+                memcpy(dom + (size_t)j * nb, tmp, nb);
+                changed = 1;
+            }
+        }
+    }
+    free(tmp);
+    return dom;
+}
+
+static void mark_body(struct cfg *c, struct loop *l, int j)
+{
+    int p, k;
+
+    if (l->body[j])
+        return;
+    l->body[j] = 1;
+    l->size++;
+    if (j == l->header)
+        return;
+    for (p = 0; p < c->nb; p++) {
+        for (k = 0; k < c->b[p].ne; k++) {
+            if (c->b[p].e[k].to == j && c->b[p].e[k].feasible && c->b[p].in.reached)
+                mark_body(c, l, p);
+        }
+    }
+}
+
+static int loop_cmp(const void *a, const void *b)
+{
+    const struct loop *x = a, *y = b;
+
+    return x->size != y->size ? x->size - y->size : x->header - y->header;
+}
+
+static int find_loops(struct cfg *c)
+{
+    uint8_t *dom = dominators(c);
+    int j, k, h, i, n = 0;
+    struct loop *l;
+
+    if (!dom)
+        return -1;
+    c->loops = calloc(c->nb, sizeof(*c->loops));
+    if (!c->loops) {
+        free(dom);
+        return -1;
+    }
+    for (j = 0; j < c->nb; j++) {
+        for (k = 0; k < c->b[j].ne; k++) {
+            h = c->b[j].e[k].to;
+            if (h < 0 || !c->b[j].e[k].feasible || !c->b[j].in.reached
+                || !dom[(size_t)j * c->nb + h])
+                continue;
+            for (i = 0; i < n && c->loops[i].header != h; i++)
+                ;
+            l = &c->loops[i];
+            if (i == n) {
+                l->header = h;
+                l->body = calloc(c->nb, 1);
+                l->bound = -1;
+                l->parent = -1;
+                if (!l->body) {
+                    free(dom);
+                    return -1;
+                }
+                n++;
+                l->body[h] = 1;
+                l->size = 1;
+            }
+            mark_body(c, l, j);
+        }
+    }
+    free(dom);
+    c->nloops = n;
+    qsort(c->loops, n, sizeof(*c->loops), loop_cmp);
+    // Innermost first, so the first loop a block is in is its innermost
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < c->nb; j++) {
+            if (c->loops[i].body[j] && c->b[j].loop < 0)
+                c->b[j].loop = i;
+        }
+        for (k = i + 1; k < n; k++) {
+            if (c->loops[k].body[c->loops[i].header]) {
+                c->loops[i].parent = k;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Loop bounds
+ */
+
+static int loop_contains(const struct cfg *c, int outer, int inner)
+{
+    while (inner >= 0 && inner != outer)
+        inner = c->loops[inner].parent;
+    return inner == outer;
+}
+
+// The loop the note names, -1 if none; several can match a source text
+static int note_matches(const struct cfg *c, const struct note *n, int li)
+{
+    const struct loop *l = &c->loops[li];
+    uint32_t addr;
+    int j, i, ordinal = 0, best = -1;
+
+    if (fnmatch(n->func, c->f->name, 0))
+        return 0;
+    if (n->where[0] == '@') {
+        for (i = 0; i < c->nloops; i++) {
+            if (insns[c->b[c->loops[i].header].first].addr <
+                insns[c->b[l->header].first].addr)
+                ordinal++;
+        }
+        return ordinal + 1 == atoi(n->where + 1);
+    }
+    if (isdigit((unsigned char)n->where[0])) {
+        addr = strtoul(n->where, NULL, 0);
+        return insns[c->b[l->header].first].addr == addr;
+    }
+    // "text": the innermost loop around an instruction from a matching line
+    for (j = 0; j < c->nb; j++) {
+        if (!c->b[j].in.reached)
+            continue;
+        for (i = c->b[j].first; i <= c->b[j].last; i++) {
+            const char *s;
+            char text[96];
+            size_t len = strlen(n->where);
+
+            if (insns[i].source < 0 || len < 2)
+                continue;
+            snprintf(text, sizeof(text), "%.*s", (int)(len - 2), n->where + 1);
+            s = sources[insns[i].source];
+            if (strstr(s, text)) {
+                if (c->b[j].loop >= 0 && (best < 0 || loop_contains(c, best, c->b[j].loop)))
+                    best = c->b[j].loop;
+                break;
+            }
+        }
+    }
+    return best == li;
+}
+
+// Whether anything in the loop but the count itself can change reg
+static int touches(const struct cfg *c, const struct loop *l, int reg, int from, int to)
+{
+    const struct insn *in;
+    int j, i;
+
+    for (j = 0; j < c->nb; j++) {
+        if (!l->body[j] || !c->b[j].in.reached)
+            continue;
+        for (i = c->b[j].first; i <= c->b[j].last; i++) {
+            in = &insns[i];
+            if (i >= from && i <= to)
+                continue;
+            if (in->m->val == V_NONE || in->m->val == V_CP || in->m->val == V_CPI
+                || in->m->val == V_CPC || in->m->val == V_STS || in->m->val == V_ST
+                || in->m->val == V_BSET || in->m->val == V_BCLR)
+                continue;
+            if (in->m->val == V_CALL) {
+                // Calls keep r2-r17 and r28-r29
+                if (reg < 2 || (reg > 17 && reg < 28) || reg > 29)
+                    return 1;
+                continue;
+            }
+            if (in->rd == reg || ((in->m->val == V_MOVW || in->m->val == V_ADIW
+                                   || in->m->val == V_SBIW) && in->rd + 1 == reg)
+                || (in->ptr_step && (in->ptr == reg || in->ptr + 1 == reg))
+                || (in->m->val == V_LPM && in->rd < 0 && reg == 0))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * counted_loop()
+ *
+ * \brief The loops avr-gcc and avr-libc count with: a register (or two or
+ *        three) that holds a known value coming in is counted down by one
+ *        to 0, with brne to go round again, once a turn (at the end of the
+ *        header, or of the one block that goes back to it) and nowhere else.
+ *        The delay loops _delay_ms() and _delay_us() expand to are such.
+ *        Returns how many times the header runs, or -1.
+ */
+static int64_t counted_loop(const struct cfg *c, int li)
+{
+    const struct loop *l = &c->loops[li];
+    const struct block *b = NULL;
+    const struct insn *last, *in;
+    struct values entry, out;
+    int regs[3], nregs = 0, chain = 1, i, j, k, p, latches = 0, latch = -1;
+    int64_t value = 0;
+
+    // The block that decides: the header if it can leave, or the only latch
+    for (j = 0; j < c->nb; j++) {
+        if (!l->body[j] || !c->b[j].in.reached)
+            continue;
+        for (k = 0; k < c->b[j].ne; k++) {
+            if (c->b[j].e[k].to == l->header && c->b[j].e[k].feasible) {
+                latches++;
+                latch = j;
+            }
+        }
+    }
+    b = &c->b[l->header];
+    last = &insns[b->last];
+    if (strcmp(last->m->name, "brne") || b->ne != 2
+        || (b->e[0].to >= 0 && l->body[b->e[0].to])) {
+        if (latches != 1)
+            return -1;
+        b = &c->b[latch];
+        last = &insns[b->last];
+        if (strcmp(last->m->name, "brne") || b->ne != 2 || b->e[1].to != l->header)
+            return -1;
+    }
+    if (!b->e[1].feasible || b->e[1].to < 0 || !l->body[b->e[1].to])
+        return -1;
+
+    // The flags brne looks at come from the instruction before it
+    i = b->last - 1;
+    if (i < b->first)
+        return -1;
+    in = &insns[i];
+    if (!strcmp(in->m->name, "dec")) {
+        regs[nregs++] = in->rd;
+    } else if (!strcmp(in->m->name, "sbiw") && in->k == 1) {
+        regs[nregs++] = in->rd;
+        regs[nregs++] = in->rd + 1;
+    } else if (!strcmp(in->m->name, "sbci") && in->k == 0) {
+        // subi a, 1 / sbci b, 0 [/ sbci c, 0]
+        for (k = i; k >= b->first && nregs < 3; k--) {
+            if (!strcmp(insns[k].m->name, "sbci") && insns[k].k == 0) {
+                regs[nregs++] = insns[k].rd;
+            } else if (!strcmp(insns[k].m->name, "subi") && insns[k].k == 1) {
+                regs[nregs++] = insns[k].rd;
+                break;
+            } else {
+                return -1;
+            }
+        }
+        if (k < b->first || nregs < 2)
+            return -1;
+        chain = nregs;
+        // Lowest byte first
+        for (k = 0; k < nregs / 2; k++) {
+            p = regs[k];
+            regs[k] = regs[nregs - 1 - k];
+            regs[nregs - 1 - k] = p;
+        }
+    } else {
+        return -1;
+    }
+    for (j = 0; j < nregs; j++) {
+        if (touches(c, l, regs[j], i - chain + 1, i))
+            return -1;
+    }
+
+    // What the counter holds coming in
+    memset(&entry, 0, sizeof(entry));
+    for (p = 0; p < c->nb; p++) {
+        if (l->body[p] || !c->b[p].in.reached)
+            continue;
+        for (k = 0; k < c->b[p].ne; k++) {
+            if (c->b[p].e[k].to == l->header && c->b[p].e[k].feasible) {
+                block_out(c, &c->b[p], &out);
+                transfer(&out, &insns[c->b[p].last], c->as);
+                meet(&entry, &out);
+            }
+        }
+    }
+    if (!entry.reached)
+        return -1;
+    for (j = 0; j < nregs; j++) {
+        if (!known(&entry, regs[j]))
+            return -1;
+        value |= (int64_t)entry.r[regs[j]] << (8 * j);
+    }
+    return value ? value : (int64_t)1 << (8 * nregs);
+}
+
+static void bound_loops(struct cfg *c)
+{
+    int i, k;
+
+    for (i = 0; i < c->nloops; i++) {
+        for (k = 0; k < nnotes; k++) {
+            if (notes[k].kind == N_LOOP && note_matches(c, &notes[k], i)) {
+                // The header runs once more than the body, to leave
+                c->loops[i].bound = notes[k].value + 1;
+                notes[k].used = 1;
+                break;
+            }
+        }
+        if (c->loops[i].bound < 0)
+            c->loops[i].bound = counted_loop(c, i);
+    }
+}
+
+/*
+ * Longest paths
+ */
+
+enum mode { TO_EXIT, TO_BACK_EDGE, OUT_OF_LOOP };
+
+static int64_t longest(struct cfg *c, int region, int j, enum mode mode);
+
+static int64_t loop_total(struct cfg *c, int li);
+
+// Carrying on from block j inside region, or leaving it, for mode
+static int64_t onwards(struct cfg *c, int region, int to, enum mode mode)
+{
+    if (to < 0)
+        return mode == TO_EXIT ? 0 : NEVER;
+    if (region >= 0) {
+        if (to == c->loops[region].header)
+            return mode == TO_BACK_EDGE ? 0 : NEVER;
+        if (!c->loops[region].body[to])
+            return mode == OUT_OF_LOOP ? 0 : NEVER;
+    }
+    return longest(c, region, to, mode);
+}
+
+/**
+ * longest()
+ *
+ * \brief Longest path from block j to where mode wants to get to, within
+ *        region (a loop, or -1 for the function). A nested loop is one step,
+ *        all its turns at once, and carries on from any of its ways out.
+ */
+static int64_t longest(struct cfg *c, int region, int j, enum mode mode)
+{
+    size_t slot = ((size_t)(region + 1) * c->nb + j) * 3 + mode;
+    const struct block *b = &c->b[j];
+    int64_t best = NEVER, v, total;
+    int inner = b->loop, k, x, y;
+
+    if (c->state[slot] == 2)
+        return c->memo[slot];
+    if (c->state[slot] == 1) {
+        fail(c, "a loop at 0x%x that isn't a natural loop", insns[b->first].addr);
+        return NEVER;
+    }
+    c->state[slot] = 1;
+    if (b->bad[0])
+        fail(c, "%s", b->bad);
+
+    // The outermost loop within region that j is in, if it is not region
+    while (inner >= 0 && c->loops[inner].parent != region)
+        inner = c->loops[inner].parent;
+    if (inner >= 0 && inner != region) {
+        total = loop_total(c, inner);
+        if (total != NEVER) {
+            for (x = 0; x < c->nb; x++) {
+                if (!c->loops[inner].body[x] || !c->b[x].in.reached)
+                    continue;
+                for (k = 0; k < c->b[x].ne; k++) {
+                    y = c->b[x].e[k].to;
+                    if (!c->b[x].e[k].feasible || (y >= 0 && c->loops[inner].body[y]))
+                        continue;
+                    v = onwards(c, region, y, mode);
+                    if (v != NEVER && total + v > best)
+                        best = total + v;
+                }
+            }
+        }
+    } else {
+        for (k = 0; k < b->ne; k++) {
+            if (!b->e[k].feasible)
+                continue;
+            v = onwards(c, region, b->e[k].to, mode);
+            if (v != NEVER && b->e[k].cost + v > best)
+                best = b->e[k].cost + v;
+        }
+    }
+    c->state[slot] = 2;
+    c->memo[slot] = best;
+    return best;
+}
+
+/**
+ * loop_total()
+ *
+ * \brief All of a loop's turns from coming in at its header to leaving it,
+ *        including the cost of the edge out. The edge out's cost is in
+ *        OUT_OF_LOOP, so where it goes carries on from 0.
+ */
+static int64_t loop_total(struct cfg *c, int li)
+{
+    struct loop *l = &c->loops[li];
+    const struct block *h = &c->b[l->header];
+    int64_t k;
+
+    if (l->done)
+        return l->total;
+    l->done = 1;
+    l->total = NEVER;
+    if (l->bound < 0) {
+        fail(c, "no bound for the loop at 0x%x%s%s%s", insns[h->first].addr,
+             insns[h->first].source >= 0 ? " (" : "",
+             source_line(insns[h->first].source),
+             insns[h->first].source >= 0 ? ")" : "");
+        return NEVER;
+    }
+    l->iter = longest(c, li, l->header, TO_BACK_EDGE);
+    l->out = longest(c, li, l->header, OUT_OF_LOOP);
+    if (l->out == NEVER) {
+        fail(c, "the loop at 0x%x never ends", insns[h->first].addr);
+        return NEVER;
+    }
+    k = l->bound - 1;
+    l->total = (l->iter == NEVER ? 0 : k * l->iter) + l->out;
+    return l->total;
+}
+
+static void free_cfg(struct cfg *c)
+{
+    int i;
+
+    for (i = 0; i < c->nloops; i++)
+        free(c->loops[i].body);
+    free(c->loops);
+    free(c->b);
+    free(c->block_of);
+    free(c->memo);
+    free(c->state);
+}
+
+static void show_loops(const struct cfg *c)
+{
+    int i;
+    const struct insn *in;
+
+    for (i = 0; i < c->nloops; i++) {
+        in = &insns[c->b[c->loops[i].header].first];
+        printf("    loop at 0x%04x: header %lld times, %lld cycles a turn, %lld in all%s%s\n",
+               in->addr, (long long)c->loops[i].bound,
+               (long long)(c->loops[i].iter == NEVER ? 0 : c->loops[i].iter),
+               (long long)c->loops[i].total, in->source >= 0 ? "  " : "",
+               source_line(in->source));
+    }
+}
+
+/**
+ * analyse()
+ * \param  int                    fi  Function.
+ * \param  const struct assume *  as  State it starts in, or NULL.
+ * \return int64_t  Worst case in cycles, or NEVER with error set.
+ */
+static int64_t analyse(int fi, const struct assume *as, char *error, size_t len, int show)
+{
+    struct func *f = &funcs[fi];
+    struct cfg c;
+    int64_t w = NEVER;
+    size_t slots;
+
+    memset(&c, 0, sizeof(c));
+    c.f = f;
+    c.as = as;
+    c.error = error;
+    c.error_len = len;
+    error[0] = 0;
+    if (f->count == 0) {
+        fail(&c, "no code");
+        return NEVER;
+    }
+    if (build_blocks(&c) < 0 || error[0])
+        goto out;
+    find_values(&c);
+    if (find_loops(&c) < 0)
+        goto out;
+    bound_loops(&c);
+    slots = ((size_t)c.nloops + 1) * c.nb * 3;
+    c.memo = calloc(slots, sizeof(int64_t));
+    c.state = calloc(slots, 1);
+    if (!c.memo || !c.state) {
+        fail(&c, "out of memory");
+        goto out;
+    }
+    w = longest(&c, -1, 0, TO_EXIT);
+    if (error[0])
+        w = NEVER;
+    else if (w == NEVER)
+        fail(&c, "never returns");
+    else if (f->isr)
+        w += WCET_IRQ_CYCLES;
+    if (show && !error[0])
+        show_loops(&c);
+out:
+    free_cfg(&c);
+    return error[0] ? NEVER : w;
+}
+
+static int64_t func_wcet(int fi)
+{
+    struct func *f = &funcs[fi];
+
+    if (f->done)
+        return f->wcet;
+    if (f->visiting) {
+        snprintf(f->error, sizeof(f->error), "recursion");
+        return NEVER;
+    }
+    f->visiting = 1;
+    f->wcet = analyse(fi, NULL, f->error, sizeof(f->error), 0);
+    f->visiting = 0;
+    f->done = 1;
+    return f->wcet;
+}
+
+/*
+ * The report
+ */
+
+static const struct note *budget_for(const char *name)
+{
+    int i;
+
+    for (i = 0; i < nnotes; i++) {
+        if (notes[i].kind == N_BUDGET && !strcmp(notes[i].func, name))
+            return &notes[i];
+    }
+    return NULL;
+}
+
+// One line of the report, returns 1 if over budget
+static int report(const char *name, int64_t w, const char *error)
+{
+    const struct note *budget = budget_for(name);
+    int over = 0;
+
+    if (w == NEVER)
+        printf("%-28s %12s %12s  %s", name, "-", "-", error);
+    else
+        printf("%-28s %12lld %12.1f", name, (long long)w, w * 1e6 / hz);
+    if (budget) {
+        ((struct note *)budget)->used = 1;
+        over = w == NEVER || w > budget->value;
+        printf("  budget %lld (%.1f us) %s", (long long)budget->value,
+               budget->value * 1e6 / hz, over ? "OVER" : "ok");
+    }
+    printf("\n");
+    return over;
+}
+
+int main(int argc, char **argv)
+{
+    const char *notes_path = NULL, *only = NULL;
+    char name[160], error[160], *eq;
+    struct define *d;
+    struct assume as;
+    int opt, piped, i, k, fi, failed = 0;
+    int64_t w;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "a:D:F:f:v")) != -1) {
+        switch (opt) {
+        case 'a':
+            notes_path = optarg;
+            break;
+        case 'D':
+            eq = strchr(optarg, '=');
+            if (!eq || eq == optarg || eq - optarg >= (int)sizeof(d->name) ||
+                ndefines == WCET_MAX_DEFINES) {
+                fprintf(stderr, "%s: -D %s: not name=value\n", argv[0], optarg);
+                return 2;
+            }
+            d = &defines[ndefines];
+            snprintf(d->name, sizeof(d->name), "%.*s", (int)(eq - optarg), optarg);
+            if (number(eq + 1, &d->value)) {
+                fprintf(stderr, "%s: -D %s: not a number\n", argv[0], optarg);
+                return 2;
+            }
+            ndefines++;
+            break;
+        case 'F':
+            hz = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            only = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind + 1 != argc || hz == 0)
+        goto usage;
+
+    if (notes_path)
+        read_notes(notes_path);
+    f = open_listing(argv[optind], &piped);
+    read_listing(f, argv[optind]);
+    if (piped ? pclose(f) != 0 : fclose(f) != 0) {
+        fprintf(stderr, "%s: couldn't read the listing\n", argv[optind]);
+        return 2;
+    }
+    if (nfuncs == 0) {
+        fprintf(stderr, "%s: no functions in the listing\n", argv[optind]);
+        return 2;
+    }
+
+    printf("%-28s %12s %12s\n", "function", "cycles", "us");
+    for (i = 0; i < nfuncs; i++) {
+        if (only && strcmp(funcs[i].name, only))
+            continue;
+        w = func_wcet(i);
+        failed |= report(funcs[i].name, w, funcs[i].error);
+        if (verbose && w != NEVER)
+            analyse(i, NULL, error, sizeof(error), 1);
+    }
+
+    for (k = 0; k < nnotes; k++) {
+        if (notes[k].kind != N_STATE || (only && strcmp(notes[k].func, only)))
+            continue;
+        notes[k].used = 1;
+        fi = find_func(notes[k].func);
+        snprintf(name, sizeof(name), "%s:%s", notes[k].func, notes[k].where);
+        as.addr = resolve(notes[k].symbol);
+        as.bytes = notes[k].bytes;
+        as.value = notes[k].value;
+        if (fi < 0) {
+            failed |= report(name, NEVER, "no such function");
+            continue;
+        }
+        if (as.addr < 0) {
+            failed |= report(name, NEVER, "no symbol for it in the listing");
+            continue;
+        }
+        w = analyse(fi, &as, error, sizeof(error), verbose);
+        failed |= report(name, w, error);
+    }
+
+    for (k = 0; k < nnotes; k++) {
+        if (!notes[k].used && !only) {
+            fprintf(stderr, "%s:%d: not used\n", notes_path, notes[k].line);
+            if (notes[k].kind == N_BUDGET)
+                failed = 1;
+        }
+    }
+    return failed;
+
+usage:
+    fprintf(stderr, "usage: %s [-a annotations] [-D name=value] [-F hz] "
+            "[-f function] [-v] image.lst|image.elf\n", argv[0]);
+    return 2;
+}
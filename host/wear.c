@@ -0,0 +1,364 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * EEPROM wear projection for a fleet of units. Each unit runs the host build
+ * of the game, with its own usage profile, through a number of simulated
+ * days, and every EEPROM write it makes is counted per cell. The per-day
+ * counts are then projected over months and years against the EEPROM's
+ * rated endurance, for the fleet average and its worst units.
+ *
+ *   wear [-u units] [-d days] [-i idle_hours] [-g games] [-l slots]
+ *        [-s seed] [-j threads]
+ *
+ *   -u  units in the fleet (default 1000)
+ *   -d  days simulated per unit (default 1)
+ *   -i  mean hours a day a unit sits switched on in IDLE (default 4)
+ *   -g  mean games a day (default 10)
+ *   -l  also project each cell as if its writes were levelled over this
+ *       many cells, to size a wear-levelling scheme
+ *   -s  seed for the profiles
+ *   -j  threads (default one per core)
+ *
+ * A unit's idle hours and games are drawn from 0.5 to 1.5 times the means.
+ * Its day is that many games, each after an idle gap drawn from an
+ * exponential distribution, so the gaps add up to its idle hours. The
+ * player gets a round drawn from 1 to 2 * WEAR_MEAN_ROUNDS - 1 right and
+ * then misses. Once the firmware has powered down the time until the next
+ * game is skipped, so a long gap costs no more to simulate than a short one.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "sim.h"
+#include "../nomis-memory-game.h"
+
+#define WEAR_ENDURANCE   100000  // write/erase cycles per cell, ATtiny85 datasheet
+#define WEAR_MEAN_ROUNDS 8
+
+enum wear_phase {
+    WEAR_WAITING,       // idle until idle_until, then press to start a game
+    WEAR_STARTING,      // pressed, the game hasn't left IDLE yet
+    WEAR_PLAYING,       // the game is on, IDLE again means it ended
+};
+
+struct unit {
+    uint64_t rng;
+    double gap_mean_us;
+    uint32_t games;         // games this unit plays in all
+    uint32_t played;
+    enum wear_phase phase;
+    uint64_t idle_until;
+    uint16_t lose_round;
+    uint8_t released;
+    uint64_t idle_us;       // time spent in IDLE, awake or powered down
+    uint64_t idle_from;
+};
+
+struct wear {
+    uint32_t units;
+    uint32_t days;
+    double idle_hours;
+    double games;
+    uint32_t slots;
+    uint64_t seed;
+    unsigned nthreads;
+
+    uint32_t next;          // next unit to simulate
+    pthread_mutex_t lock;
+
+    // Writes per cell per unit, over all its days
+    uint32_t *writes;
+    uint64_t games_played;
+    uint64_t idle_us;
+    uint64_t steps;
+};
+
+static struct wear wear;
+
+static uint64_t wear_rand(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double wear_uniform(uint64_t *state)
+{
+    return (wear_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint8_t wear_move_button(uint8_t move)
+{
+    uint8_t button = 0;
+    while (move >>= 1)
+        button++;
+    return button;
+}
+
+static void wear_next_gap(struct unit *u)
+{
+    u->idle_until = sim.time_us + (uint64_t)(-log(1.0 - wear_uniform(&u->rng)) *
+                                             u->gap_mean_us);
+    u->idle_from = sim.time_us;
+    u->phase = WEAR_WAITING;
+}
+
+static uint16_t wear_next_sample(void *ctx)
+{
+    struct unit *u = ctx;
+    uint8_t button;
+
+    if (game.gamestate != IDLE) {
+        if (u->phase == WEAR_STARTING)
+            u->phase = WEAR_PLAYING;
+        if (game.gamestate != PLAYER)
+            return 0;
+        // Release first, so the press is always seen as a new edge
+        u->released = !u->released;
+        if (u->released)
+            return 0;
+        button = wear_move_button(get_move(game.player_counter));
+        if (game.cpu_counter >= u->lose_round)
+            button += 1;
+        return BUTTON_ADC(button % NUM_BUTTONS);
+    }
+
+    if (u->phase == WEAR_PLAYING) {
+        u->played += 1;
+        if (u->played == u->games) {
+            sim.exhausted = 1;
+            return 0;
+        }
+        wear_next_gap(u);
+    }
+    if (u->phase == WEAR_WAITING) {
+        if (sim.time_us < u->idle_until) {
+            if (WDTCR & (1 << WDIE))
+                return 0;
+            // Powered down, nothing happens until the next press
+            sim_skip(u->idle_until - sim.time_us);
+        }
+        u->idle_us += sim.time_us - u->idle_from;
+        u->phase = WEAR_STARTING;
+        u->lose_round = 1 + wear_rand(&u->rng) % (2 * WEAR_MEAN_ROUNDS - 1);
+        u->released = 0;
+    }
+    // Held until the game leaves IDLE, it may take one to wake it up
+    return BUTTON_ADC(1 % NUM_BUTTONS);
+}
+
+/**
+ * wear_unit()
+ * \param  uint32_t  n  Unit number.
+ *
+ * \brief Simulates unit n from power on through all of its days and keeps
+ *        its per cell write counts in wear.writes.
+ */
+static uint64_t wear_unit(uint32_t n)
+{
+    struct unit u;
+    double idle_hours, games;
+    uint64_t steps = 0;
+
+    memset(&u, 0, sizeof(u));
+    u.rng = wear.seed ^ ((uint64_t)n * 0xD1B54A32D192ED03ULL);
+    idle_hours = wear.idle_hours * (0.5 + wear_uniform(&u.rng));
+    games = wear.games * (0.5 + wear_uniform(&u.rng));
+    u.games = (uint32_t)(games * wear.days + 0.5);
+    if (u.games < 1)
+        u.games = 1;
+    u.gap_mean_us = idle_hours * 3600e6 * wear.days / u.games;
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+    memset(sim.eeprom_writes, 0, sizeof(sim.eeprom_writes));
+    sim.eeprom[SEED_ADDR] = wear_rand(&u.rng);
+    sim.eeprom[SEED_ADDR + 1] = wear_rand(&u.rng);
+    sim_reset(wear_next_sample, &u);
+    io_init();
+    settings_load();
+    game_init();
+    wear_next_gap(&u);
+
+    while (!sim.exhausted) {
+        game_step();
+        steps += 1;
+    }
+
+    memcpy(&wear.writes[(size_t)n * SIM_EEPROM_SIZE], sim.eeprom_writes,
+           sizeof(sim.eeprom_writes));
+    pthread_mutex_lock(&wear.lock);
+    wear.games_played += u.played;
+    wear.idle_us += u.idle_us;
+    wear.steps += steps;
+    pthread_mutex_unlock(&wear.lock);
+    return steps;
+}
+
+static void *wear_worker(void *arg)
+{
+    uint32_t n;
+
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&wear.lock);
+        n = wear.next++;
+        pthread_mutex_unlock(&wear.lock);
+        if (n >= wear.units)
+            return NULL;
+        wear_unit(n);
+    }
+}
+
+static int wear_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void wear_years(char *buf, size_t len, double per_day)
+{
+    if (per_day <= 0)
+        snprintf(buf, len, "never");
+    else
+        snprintf(buf, len, "%.2f", WEAR_ENDURANCE / per_day / 365.0);
+}
+
+/**
+ * wear_report()
+ *
+ * \brief One line per EEPROM cell that any unit wrote: writes a day for the
+ *        fleet mean, the 99th percentile and the worst unit, the worst
+ *        unit's writes after a month and a year, and the years until the
+ *        mean and the worst unit wear the cell out.
+ */
+static void wear_report(void)
+{
+    double *per_day = malloc(wear.units * sizeof(double));
+    double mean, p99, max;
+    char mean_years[16], max_years[16];
+    uint32_t cell, n;
+
+    printf("%5s %10s %10s %10s %12s %12s %10s %10s\n", "cell", "mean/day",
+           "p99/day", "max/day", "max 1 month", "max 1 year", "years mean",
+           "years max");
+    for (cell = 0; cell < SIM_EEPROM_SIZE; cell++) {
+        mean = 0;
+        for (n = 0; n < wear.units; n++) {
+            per_day[n] = (double)wear.writes[(size_t)n * SIM_EEPROM_SIZE + cell] /
+                         wear.days;
+            mean += per_day[n];
+        }
+        if (mean == 0)
+            continue;
+        mean /= wear.units;
+        qsort(per_day, wear.units, sizeof(double), wear_compare);
+        p99 = per_day[(size_t)((wear.units - 1) * 0.99)];
+        max = per_day[wear.units - 1];
+        wear_years(mean_years, sizeof(mean_years), mean);
+        wear_years(max_years, sizeof(max_years), max);
+        printf("%5u %10.0f %10.0f %10.0f %12.0f %12.0f %10s %10s\n", cell,
+               mean, p99, max, max * 365.0 / 12, max * 365.0, mean_years,
+               max_years);
+        if (wear.slots > 1) {
+            wear_years(mean_years, sizeof(mean_years), mean / wear.slots);
+            wear_years(max_years, sizeof(max_years), max / wear.slots);
+            printf("%5s %10.0f %10.0f %10.0f %12.0f %12.0f %10s %10s\n", "  /l",
+                   mean / wear.slots, p99 / wear.slots, max / wear.slots,
+                   max / wear.slots * 365.0 / 12, max / wear.slots * 365.0,
+                   mean_years, max_years);
+        }
+    }
+    free(per_day);
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec t0, t1;
+    pthread_t *threads;
+    double seconds;
+    unsigned i;
+    int opt;
+
+    wear.units = 1000;
+    wear.days = 1;
+    wear.idle_hours = 4;
+    wear.games = 10;
+    wear.seed = 1;
+    wear.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "u:d:i:g:l:s:j:")) != -1) {
+        switch (opt) {
+        case 'u':
+            wear.units = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            wear.days = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            wear.idle_hours = atof(optarg);
+            break;
+        case 'g':
+            wear.games = atof(optarg);
+            break;
+        case 'l':
+            wear.slots = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            wear.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'j':
+            wear.nthreads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-u units] [-d days] [-i idle_hours] "
+                    "[-g games] [-l slots] [-s seed] [-j threads]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (wear.units < 1 || wear.days < 1 || wear.idle_hours < 0 ||
+        wear.idle_hours > 24 || wear.games <= 0) {
+        fprintf(stderr, "need at least one unit, one day and one game, and at "
+                "most 24 idle hours a day\n");
+        return 2;
+    }
+    if (wear.nthreads < 1)
+        wear.nthreads = 1;
+
+    wear.writes = calloc((size_t)wear.units * SIM_EEPROM_SIZE, sizeof(uint32_t));
+    threads = calloc(wear.nthreads, sizeof(*threads));
+    if (!wear.writes || !threads) {
+        perror("calloc");
+        return 2;
+    }
+    pthread_mutex_init(&wear.lock, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < wear.nthreads; i++)
+        pthread_create(&threads[i], NULL, wear_worker, NULL);
+    for (i = 0; i < wear.nthreads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%u units, %u days each, %.1f idle hours and %.1f games a day "
+           "(means), %u threads\n", wear.units, wear.days, wear.idle_hours,
+           wear.games, wear.nthreads);
+    printf("%llu games, %.0f idle hours, %llu steps in %.2f s\n",
+           (unsigned long long)wear.games_played, wear.idle_us / 3600e6,
+           (unsigned long long)wear.steps, seconds);
+    printf("endurance %u writes per cell%s\n\n", WEAR_ENDURANCE,
+           wear.slots > 1 ? ", /l rows levelled over -l cells" : "");
+    wear_report();
+    return 0;
+}
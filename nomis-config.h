@@ -0,0 +1,176 @@
+/**
+ * Project: Memory Game
+ * Version: 01
+ * Creator(s): Christopher Woodall
+ * License: MIT License
+ *
+ * Per device configuration. Picks the size of the move buffer, how moves are
+ * stored and which optional features get built for the MCU being compiled
+ * for (-mmcu). Anything here can still be overridden from the command line,
+ * e.g. make DEFS=-DMAX_MOVES=50.
+ *
+ * The flash and SRAM budgets that each device is checked against live in the
+ * Makefile, next to the device list for `make matrix`.
+ *
+ * MAX_MOVES     Longest sequence the game can hold.
+ * MOVES_PACKED  1: store four moves to a byte (needs NUM_BUTTONS <= 4),
+ *               0: one byte per move, which is smaller and faster code.
+ * ADC_MUX       ADMUX value selecting the button ladder's ADC channel, with
+ *               VCC as the reference.
+ * VBG_MUX       ADMUX value selecting the 1.1V bandgap, with VCC as the
+ *               reference.
+ * SAVE_SEED     1: keep the LCG seed in the EEPROM across resets.
+ * PWM_LEDS      1: Timer0 (OC0A/OC0B on PB0/PB1) drives the LEDs instead of
+ *               the CPU setting pins, with LED_BRIGHTNESS as the duty cycle
+ *               (0-255). Needs the ATTiny x5 pin out.
+ * TONE          1: play a tone for every move on a piezo on PB3, with
+ *               Timer1 and the watchdog interrupt. Needs the ATTiny x5
+ *               Timer1.
+ * SLEEP_IDLE    1: between the frames of the idle cascade the MCU sleeps in
+ *               power-down, woken by the watchdog or a button. Needs the
+ *               ATTiny x5 pin change interrupt.
+ * IDLE_TIMEOUT  Seconds of idle cascade before SLEEP_IDLE powers down until
+ *               a button is pressed, 0 to never.
+ * BATTERY       1: now and then while idle, measure VCC against the 1.1V
+ *               bandgap. Below BATTERY_LOW_MV the LEDs are dimmed to
+ *               LED_BRIGHTNESS_LOW, the idle cascade flashes shorter and it
+ *               powers down after IDLE_TIMEOUT_LOW seconds instead.
+ * STACK_MONITOR 1: paint the free SRAM at boot and keep the stack's high
+ *               water mark in the EEPROM at STACK_ADDR. AVR builds only.
+ */
+#ifndef NOMIS_CONFIG_H
+#define NOMIS_CONFIG_H
+
+#if defined(__AVR_ATtiny25__)
+// 2K flash, 128 bytes of SRAM and EEPROM. Byte per move would leave no room
+// for the stack.
+#define DEVICE_MAX_MOVES    100
+#define DEVICE_MOVES_PACKED 1
+#define DEVICE_ADC_MUX      0b00000010
+#define DEVICE_VBG_MUX      0b00001100
+#define DEVICE_PWM_LEDS     0
+#define DEVICE_TONE         0
+#define DEVICE_SLEEP_IDLE   0
+#define DEVICE_BATTERY      0
+#define DEVICE_STACK_MONITOR 0
+#elif defined(__AVR_ATtiny45__)
+// 4K flash, 256 bytes of SRAM and EEPROM
+#define DEVICE_MAX_MOVES    100
+#define DEVICE_MOVES_PACKED 0
+#define DEVICE_ADC_MUX      0b00000010
+#define DEVICE_VBG_MUX      0b00001100
+#define DEVICE_PWM_LEDS     1
+#define DEVICE_TONE         1
+#define DEVICE_SLEEP_IDLE   1
+#define DEVICE_BATTERY      1
+#define DEVICE_STACK_MONITOR 1
+#elif defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__)
+// 32K flash, 2K SRAM, 1K EEPROM. ADC2 is PC2, and REFS0 is needed to get
+// AVCC as the reference instead of the AREF pin. OC0A/OC0B are on PORTD and
+// Timer1 is a different (16 bit) timer.
+#define DEVICE_MAX_MOVES    1000
+#define DEVICE_MOVES_PACKED 0
+#define DEVICE_ADC_MUX      0b01000010
+#define DEVICE_VBG_MUX      0b01001110
+#define DEVICE_PWM_LEDS     0
+#define DEVICE_TONE         0
+#define DEVICE_SLEEP_IDLE   0
+#define DEVICE_BATTERY      0
+#define DEVICE_STACK_MONITOR 1
+#else
+// ATTiny85 (and host builds): 8K flash, 512 bytes of SRAM and EEPROM
+#define DEVICE_MAX_MOVES    100
+#define DEVICE_MOVES_PACKED 0
+#define DEVICE_ADC_MUX      0b00000010
+#define DEVICE_VBG_MUX      0b00001100
+#define DEVICE_PWM_LEDS     1
+#define DEVICE_TONE         1
+#define DEVICE_SLEEP_IDLE   1
+#define DEVICE_BATTERY      1
+#define DEVICE_STACK_MONITOR 1
+#endif
+
+#ifndef MAX_MOVES
+#define MAX_MOVES    DEVICE_MAX_MOVES
+#endif
+
+#ifndef MOVES_PACKED
+#define MOVES_PACKED DEVICE_MOVES_PACKED
+#endif
+
+#ifndef ADC_MUX
+#define ADC_MUX      DEVICE_ADC_MUX
+#endif
+
+#ifndef SAVE_SEED
+#define SAVE_SEED    1
+#endif
+
+#ifndef PWM_LEDS
+#define PWM_LEDS     DEVICE_PWM_LEDS
+#endif
+
+#ifndef LED_BRIGHTNESS
+#define LED_BRIGHTNESS 255
+#endif
+
+#ifndef TONE
+#define TONE         DEVICE_TONE
+#endif
+
+#ifndef SLEEP_IDLE
+#define SLEEP_IDLE   DEVICE_SLEEP_IDLE
+#endif
+
+#ifndef IDLE_TIMEOUT
+#define IDLE_TIMEOUT 600
+#endif
+
+#ifndef BATTERY
+#define BATTERY      DEVICE_BATTERY
+#endif
+
+#ifndef VBG_MUX
+#define VBG_MUX      DEVICE_VBG_MUX
+#endif
+
+#ifndef BATTERY_LOW_MV
+#define BATTERY_LOW_MV 2600
+#endif
+
+#ifndef LED_BRIGHTNESS_LOW
+#define LED_BRIGHTNESS_LOW (LED_BRIGHTNESS / 4)
+#endif
+
+#ifndef IDLE_TIMEOUT_LOW
+#define IDLE_TIMEOUT_LOW 60
+#endif
+
+// The watchdog interrupt is a 16ms tick for whatever needs one
+#define WDT_TICK     (TONE || SLEEP_IDLE)
+
+#ifndef STACK_MONITOR
+#ifdef __AVR__
+#define STACK_MONITOR DEVICE_STACK_MONITOR
+#else
+#define STACK_MONITOR 0 // Host builds have no SRAM of their own to paint
+#endif
+#endif
+
+#if PWM_LEDS && (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__))
+#error "PWM_LEDS needs OC0A/OC0B on PB0/PB1"
+#endif
+
+#if TONE && (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__))
+#error "TONE needs the ATTiny x5 Timer1"
+#endif
+
+#if SLEEP_IDLE && (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__))
+#error "SLEEP_IDLE needs the ATTiny x5 pin change interrupt"
+#endif
+
+#if MOVES_PACKED && NUM_BUTTONS > 4
+#error "MOVES_PACKED only has room for 4 buttons"
+#endif
+
+#endif
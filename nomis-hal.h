@@ -0,0 +1,113 @@
+/**
+ * Project: Memory Game
+ * Version: 01
+ * Creator(s): Christopher Woodall
+ * License: MIT License
+ *
+ * Pins and the ADC by name. A pin is a port letter and a bit number, e.g.
+ * PIN_PIEZO is B, 3, and moving something to another pin is a change to its
+ * #define here and nothing else.
+ *
+ * Everything is a macro of compile time constants that expands to the
+ * register expression it names, e.g. pin_high(PIN_PIEZO) to
+ * PORTB |= (1 << (3)). The host build gets the shim registers in
+ * host/include through the same names.
+ */
+#ifndef NOMIS_HAL_H
+#define NOMIS_HAL_H
+
+#include <avr/io.h>
+
+// The charlieplexed LEDs are on bits 0-2 of this port
+#define LED_BANK      B
+#define LED_BANK_MASK 0x07
+
+/**
+ * Charlieplexed LEDs, anode and cathode of each one in move order. The first
+ * four are wired the way the V01 board is, all of them share PB1. Five or
+ * six LEDs use all three pairs of pins.
+ */
+#define LED0_ANODE   PB1
+#define LED0_CATHODE PB2
+#define LED1_ANODE   PB2
+#define LED1_CATHODE PB1
+#define LED2_ANODE   PB1
+#define LED2_CATHODE PB0
+#define LED3_ANODE   PB0
+#define LED3_CATHODE PB1
+#define LED4_ANODE   PB0
+#define LED4_CATHODE PB2
+#define LED5_ANODE   PB2
+#define LED5_CATHODE PB0
+
+#define PIN_PIEZO     B, 3  // /OC1B
+#define PIN_BUTTONS   B, 4  // ADC2, the button ladder
+
+/**
+ * pin_output(pin), pin_input(pin), pin_high(pin), pin_low(pin)
+ *
+ * \brief Set a single pin's direction or level.
+ */
+#define pin_output(pin)        HAL_PIN_OUTPUT(pin)
+#define pin_input(pin)         HAL_PIN_INPUT(pin)
+#define pin_high(pin)          HAL_PIN_HIGH(pin)
+#define pin_low(pin)           HAL_PIN_LOW(pin)
+#define pin_bit(pin)           HAL_PIN_BIT(pin)
+
+/**
+ * port_write(port, value), port_set(port, bits), port_clear(port, bits),
+ * ddr_write(port, value), ddr_set(port, bits), ddr_update(port, mask, bits)
+ *
+ * \brief Whole port access by port letter. ddr_update() replaces the bits
+ *        in mask with bits and leaves the rest of the port alone.
+ */
+#define port_write(port, value)      HAL_REG(PORT, port) = (value)
+#define port_set(port, bits)         HAL_REG(PORT, port) |= (bits)
+#define port_clear(port, bits)       HAL_REG(PORT, port) &= ~(bits)
+#define ddr_write(port, value)       HAL_REG(DDR, port) = (value)
+#define ddr_set(port, bits)          HAL_REG(DDR, port) |= (bits)
+#define ddr_update(port, mask, bits) HAL_REG(DDR, port) = (HAL_REG(DDR, port) & ~(mask)) | (bits)
+
+/**
+ * ADC_PRESCALER(div)
+ *
+ * \brief ADPS2:0 for an ADC clock of F_CPU / div, div a power of two from 2
+ *        to 128.
+ */
+#define ADC_PRESCALER(div) ((div) <= 2 ? 1 : (div) == 4 ? 2 : (div) == 8 ? 3 : \
+                            (div) == 16 ? 4 : (div) == 32 ? 5 : (div) == 64 ? 6 : 7)
+
+/**
+ * adc_init(mux, div), adc_select(mux), adc_enable(), adc_disable(),
+ * adc_start(), adc_done(), adc_clear(), adc_result()
+ *
+ * \brief Single conversions on the channel (and reference) picked by mux,
+ *        an ADMUX value, which adc_select() changes. adc_done() is true
+ *        once the conversion started by adc_start() is in adc_result(),
+ *        and adc_clear() makes it false again.
+ *
+ * The firmware unit tests (test/) define HAL_ADC_STUB and their own versions
+ * of these, to feed the game readings without an analog input.
+ */
+#ifndef HAL_ADC_STUB
+#define adc_init(mux, div) { ADMUX = (mux); ADCSRA = (1 << ADEN) | ADC_PRESCALER(div); }
+#define adc_select(mux)    ADMUX = (mux)
+#define adc_enable()       ADCSRA |= (1 << ADEN)
+#define adc_disable()      ADCSRA &= ~(1 << ADEN)
+#define adc_start()        ADCSRA |= (1 << ADSC)
+#define adc_done()         (ADCSRA & (1 << ADIF))
+#define adc_clear()        ADCSRA |= (1 << ADIF)
+#define adc_result()       ADC
+#endif
+
+// The pin macros above go through these, so that a pin's #define is
+// expanded into its port and bit before they are pasted together.
+#define HAL_REG_(reg, port)     reg##port
+#define HAL_REG(reg, port)      HAL_REG_(reg, port)
+#define HAL_PIN_OUTPUT(port, n) HAL_REG(DDR, port) |= (1 << (n))
+#define HAL_PIN_INPUT(port, n)  HAL_REG(DDR, port) &= ~(1 << (n))
+#define HAL_PIN_HIGH(port, n)   HAL_REG(PORT, port) |= (1 << (n))
+#define HAL_PIN_LOW(port, n)    HAL_REG(PORT, port) &= ~(1 << (n))
+#define HAL_PIN_BIT(port, n)    (n)
+
+#endif
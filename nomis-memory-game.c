@@ -17,218 +17,1002 @@
  */
 #define F_CPU 1000000 /* 1MHz Internal Oscillator */
 
+#include <stddef.h>
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
 
-#define MAX_PERIOD 32768 // 2^15
-#define MULTIPLIER 513   // 2^9 + 1 (A-1 is divisible by all prime factors of M)
-#define C          1     // We know 1 is relatively prime with M
-#define MAX_MOVES  100   // Maximum number of moves
+#include "nomis-memory-game.h"
+#include "nomis-hal.h"
+#include "nomis-ring.h"
 
-#define clear_display() PORTB &= 0xF0;
-#define set_display(state) PORTB |= led_display(state);
+#define LED_PINS(n) ((1 << LED##n##_ANODE) | (1 << LED##n##_CATHODE))
+
+#if PWM_LEDS
+// Timer0 drives the LED: every pair has PB0 (OC0A) or PB1 (OC0B) in it. If
+// the anode is one of them it gets the PWM, otherwise the anode (PB2) is
+// held high and the cathode gets the inverted PWM. The pin that is not part
+// of the pair floats. The CPU only touches the pins when an LED is switched.
+#define LED_TRISTATE
+#define LED_INVERTED(n) (LED##n##_ANODE == PB2)
+#define LED_OC_PIN(n)   (LED_INVERTED(n) ? LED##n##_CATHODE : LED##n##_ANODE)
+#define LED_PORT(n)     (LED_INVERTED(n) ? 1 << LED##n##_ANODE : 0)
+#define LED_COM(n)      (LED_OC_PIN(n) == PB0 ? \
+                         (1 << COM0A1) | (LED_INVERTED(n) << COM0A0) : \
+                         (1 << COM0B1) | (LED_INVERTED(n) << COM0B0))
+#define LED_COM_MASK    ((1 << COM0A1) | (1 << COM0A0) | (1 << COM0B1) | (1 << COM0B0))
+
+// Restarting the timer lines the PWM up with the start of every frame
+#define clear_display() { TCCR0A &= ~LED_COM_MASK; port_clear(LED_BANK, 0x0F); }
+#define set_display(state) { ddr_update(LED_BANK, LED_BANK_MASK, led_direction(state)); port_set(LED_BANK, led_display(state)); TCNT0 = 0; TCCR0A |= led_pwm(state); }
+#elif NUM_BUTTONS > 4
+// The pin that is not part of the pair floats, so only the anode is driven
+// high and DDRB has to change with every LED.
+#define LED_TRISTATE
+#define LED_PORT(n) (1 << LED##n##_ANODE)
+
+#define clear_display() port_clear(LED_BANK, 0x0F);
+#define set_display(state) { ddr_update(LED_BANK, LED_BANK_MASK, led_direction(state)); port_set(LED_BANK, led_display(state)); }
+#else
+// All three pins always drive. The pin that is not part of the pair follows
+// PB1, the pin every LED shares, so that no second LED lights up.
+#define LED_PORT(n) ((1 << LED##n##_ANODE) | \
+                     (LED##n##_ANODE == PB1 ? 0x07 & ~LED_PINS(n) : 0))
+
+#define clear_display() port_clear(LED_BANK, 0x0F);
+#define set_display(state) port_set(LED_BANK, led_display(state));
+#endif
 
 /**
- * enum STATE gamestates: IDLE, CPU, PLAYER, LOSE
- *  
- * \breif Define state names for the finite state machine that runs the game flow.
- *         
- * IDLE: The MCU waits for an input from the user to play the game. In this state
- *       the MCU cascades the LEDS, signifying that it is on and ready to go. While
- *       this is happening the MCU is incrementing the random variable to
- *       continuously change the seed. Exits into the CPU state if a button is
- *       pressed.
+ * A move is drawn from the top of the LCG state, its best bits, by
+ * multiply-shift: the state times NUM_BUTTONS, shifted down by RANDOM_BITS.
+ * That splits the states into NUM_BUTTONS runs that differ in length by at
+ * most one, so no button is more likely than another by more than one state
+ * in MAX_PERIOD (exactly even for a power of two), and it costs the same
+ * whatever the state. LCG_NEXT() is rand_lcg() with the constants folded
+ * in, a shift, an add and a mask rather than a multiply and a divide.
+ */
+#define LCG_NEXT(x) (((uint16_t)(x) * (uint16_t)MULTIPLIER + C) & (MAX_PERIOD - 1))
+
+static const uint8_t move_bits[6] PROGMEM = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20 };
+
+#ifdef __AVR__
+// Not cleared by the C runtime, so a game can survive a reset
+#define GAME_NOINIT __attribute__((section(".noinit")))
+
+_Static_assert(offsetof(struct game, player_counter) == GAME_AVR_PLAYER_COUNTER &&
+               offsetof(struct game, gamestate) == GAME_AVR_GAMESTATE &&
+               sizeof(struct game) == GAME_AVR_SIZE,
+               "GAME_AVR_* do not match struct game");
+#else
+#define GAME_NOINIT
+#endif
+
+GAME_STORAGE struct game game GAME_NOINIT;
+GAME_STORAGE struct settings settings GAME_NOINIT;
+
+// Used when the EEPROM holds no valid settings
+static const struct settings settings_default PROGMEM = {
+    .version = SETTINGS_VERSION,
+    .play_ms = 500,
+    .gap_ms = 100,
+    .flash_ms = 50,
+    .pause_ms = 1000,
+    .idle_threshold = 200,
+    .window = LADDER_WINDOW,
+    .button_adc = {
+        BUTTON_ADC(0), BUTTON_ADC(1), BUTTON_ADC(2),
+        BUTTON_ADC(3), BUTTON_ADC(4), BUTTON_ADC(5),
+    },
+};
+
+#if MOVES_PACKED
+#define MOVES_USED(n) (((n) + 3) / 4)
+#else
+#define MOVES_USED(n) (n)
+#endif
+
+#define NOTE_REST 0x00
+#define NOTE_LOSE 0x80
+
+// Ticks of the watchdog tick (16ms) a note lasts
+#define TONE_TICKS(ms) (((ms) + 8) / 16)
+
+#if TONE
+/**
+ * Tones, played on the piezo on PB3 by Timer1. Each note is one hot encoded
+ * like a move, so a move is played as is. NOTE_REST is silence.
  *
- * CPU: The CPU's turn. The CPU (well MCU) generates a random number and,
- *        adds that as a move to the moves[] array. Then the CPU returns the game
- *        to the PLAYER state. Ignores input from player.
- * 
- * PLAYER: The player's turn, in this state the MCU will wait for a string of 
- *           inputs from the player. Once the Player presses a button that is not
- *           in the array moves[], the player looses the game and the game goes to
- *           the LOSE state. Otherwise the game goes to the CPU state and the 
- *           computer adds another move to the moves array.
- *
- * LOSE: Cleans up the game and returns to the IDLE state. Just for house keeping.
- */
-enum STATE {
-    IDLE,
-    CPU,
-    PLAYER,
-    LOSE,
-} gamestates;
-
-/** Function Headers */
-uint16_t read_adc();
-uint8_t led_display(uint8_t state);
-uint16_t rand_lcg(uint16_t lcg_previous, uint16_t m, uint16_t a, uint16_t c);
-void cascade_leds();
-void blink_leds();
-uint8_t get_player_move();
-
-enum STATE gamestate = IDLE;
+ * Timer1 runs in PWM mode with OCR1C as TOP and OCR1B at half of it, and
+ * COM1B1:0 = 01 connects /OC1B, which is PB3. OC1B is PB4 as well, but that
+ * pin stays an input for the ADC, so it is never driven.
+ *
+ * CK/32 reaches down to 123Hz at 1MHz, below that CK/256 is used.
+ */
+#define TONE_CS(hz)  ((F_CPU / 32 / (hz)) <= 256 ? 6 : 9)
+#define TONE_TOP(hz) (F_CPU / ((hz) * (TONE_CS(hz) == 6 ? 32UL : 256UL)) - 1)
+
+/**
+ * The note queue. The main loop adds notes with tone_play() and the tick
+ * interrupt takes them off, so the game never waits for a note to finish.
+ */
+struct tone_note {
+    uint8_t note;
+    uint8_t ticks;
+};
+
+RING(tone_ring, struct tone_note, 8);
+
+static GAME_STORAGE struct tone_ring tone_queue;
+static GAME_STORAGE volatile uint8_t tone_left;
+#else
+#define tone_play(note, ticks)
+#endif
+
+#if SLEEP_IDLE
+/**
+ * Idle cascade timing, in 16ms ticks. The LED is lit for IDLE_LIT_TICKS and
+ * the MCU then sleeps IDLE_DARK_TICKS before the next one, about the 150ms
+ * the cascade always took.
+ */
+#define IDLE_LIT_TICKS     2
+#define IDLE_LIT_TICKS_LOW 1 // On a low battery
+#define IDLE_DARK_TICKS    8
+
+// Watchdog prescaler while powered down, a tick every 250ms
+#define POWER_DOWN_WDP (1 << WDP2)
+
+// Idle cascade frames in s seconds
+#define IDLE_FRAMES(s) ((s) * 1000UL / ((IDLE_LIT_TICKS + IDLE_DARK_TICKS) * 16))
+
+static GAME_STORAGE volatile uint8_t idle_ticks;
+static GAME_STORAGE volatile uint8_t idle_woken;
+#endif
+
+#ifdef RAMEND
+// Leave at least this much SRAM for the stack
+#define STACK_RESERVE 48
+_Static_assert(sizeof(struct game) <= RAMEND - RAMSTART + 1 - STACK_RESERVE,
+               "MAX_MOVES does not fit in this device's SRAM");
+#endif
+
+#if BATTERY
+/**
+ * Battery. VCC is worked out from a reading of the 1.1V bandgap against VCC,
+ * every BATTERY_PERIOD idle frames (about 10s). battery_low is set below
+ * BATTERY_LOW_MV and cleared again 100mV above it.
+ */
+#define BATTERY_PERIOD 64
+#define BATTERY_HYSTERESIS_MV 100
+
+GAME_STORAGE uint16_t battery_mv;
+static GAME_STORAGE uint8_t battery_low;
+#else
+#define battery_low 0
+#endif
+
+#if STACK_MONITOR
+/**
+ * Stack high water mark. Before anything else runs, the SRAM between the
+ * end of the variables (_end) and the top of the stack is painted with
+ * STACK_CANARY. The stack, interrupts included, overwrites the paint as it
+ * grows, so the paint left over from _end up is SRAM that has never been
+ * used. stack_check() keeps the least of it ever seen in the EEPROM at
+ * STACK_ADDR, read it back with avrdude -U eeprom:r:eeprom.hex:i.
+ */
+#define STACK_CANARY 0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+
+#define STR_(x) #x
+#define STR(x)  STR_(x)
+
+// .init1 runs before the stack pointer and r1 are set up, so no C here. A
+// naked function may only hold basic asm, hence the canary pasted in as text.
+void stack_paint() __attribute__((naked, used, section(".init1")));
+void stack_paint()
+{
+    __asm__ volatile (
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, " STR(STACK_CANARY) "\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n");
+}
+#else
+#define stack_check()
+#endif
 
 int main (void)
 {
-    /**
-     * \var  uint8_t   moves  tracks the computers moves which the player 
-     *                          must match.
-     *
-     * \var  uint8_t   player_moves  tracks the players moves, gets reset after 
-     *                                 every turn.
-     *
-     * \var  uint16_t  i  predefine looping variable for future loops
-     * 
-     * \var  uint16_t  counter  Generic counting variable, used to count the number
-     *                            of moves the computer has made, and the player 
-     *                            has made.
-     *
-     * \var  uint16_t  random  Seed random with whatever junk is in the eeprom 
-     *                           region at 46. We store future random generations
-     *                           there to be used as future seeds, on future 
-     *                           bootup or resets.
-     *
-     * \var  STATE  gamestate  Keep track of where the game is. 4 possible states,
-     *                           IDLE (0), CPU (1), PLAYER (2), or LOSE (4).
-     */
-    uint8_t moves[MAX_MOVES]; 
-    uint16_t i; 
-    uint16_t cpu_counter = 0; 
-    uint16_t player_counter = 0;
-    uint16_t random = eeprom_read_word((uint16_t *) 46);
-    uint16_t player_move;
-    //    enum STATE gamestate = CPU;
-    // Set up PortB pins 0, 1, and 2 to be outputs.
-    DDRB = 0x07;
-    // Set pull down resistors and all pins off.
-    PORTB = 0x00;
-   
-    // Setup the ADC
-
-    // Select ADC2
-    ADMUX = 0b00000010; 
-    // ADCSRA[7]: Set ADEN on.
-    // ADCSRA[2:0]: Set to 011 for a divide by 8 clock division. 
-    //                (125 kHz ADC clock)
-    ADCSRA = 0b10000011;
-
-    // And now the games begin!
+    // Why we were reset. MCUSR has to be cleared before the watchdog can be
+    // set up again.
+    uint8_t reset_flags = MCUSR;
+    MCUSR = 0;
+
+    io_init();
+    // After a watchdog, brown-out or external reset the SRAM usually still
+    // holds the settings and the game, so carry on with them. A power on
+    // always starts over.
+    if ((reset_flags & (1 << PORF)) || !settings_valid()) {
+        settings_load();
+    }
+    if ((reset_flags & (1 << PORF)) || !game_resume()) {
+        game_init();
+    }
+
+    // And now the games begin! game_step() seals the game itself.
     while (1) {
-        if (gamestate == CPU) {
-            // Get a new random number from the lcg
-            random = rand_lcg(random, MAX_PERIOD, MULTIPLIER, C ); 
-            eeprom_write_word((uint16_t *)46, random); // Store last random value in the EEPROM for next seed, if reset occurs
-            // Store this move into memory. First shift rand over and only take the
-            // two most significant bits.
-            moves[cpu_counter] = 0x01 << (random >> 13);
-            
-            for (i = 0; i <= cpu_counter; i++) {
-                // Translate the move into something that we can send to the 
-                // charlieplexed LEDs
-                PORTB |= led_display(moves[i]); 
-                _delay_ms(500);
-                PORTB &= 0xF0;
-                _delay_ms(100);
+        game_step();
+    }
+    return 0;
+}
+
+/**
+ * io_init()
+ *
+ * \brief Set up the LED pins and the ADC used to read the button ladder.
+ */
+void io_init()
+{
+    // Set up the LED pins to be outputs.
+    ddr_write(LED_BANK, LED_BANK_MASK);
+    // Set pull down resistors and all pins off.
+    port_write(LED_BANK, 0x00);
+
+    // Setup the ADC on the button ladder's channel (ADC_MUX), with a divide
+    // by 8 clock division (125 kHz ADC clock).
+    adc_init(ADC_MUX, 8);
+
+#if PWM_LEDS
+    // Timer0 in fast PWM mode at the full 1MHz clock (3.9kHz PWM). The
+    // outputs only get connected when an LED is lit.
+    OCR0A = LED_BRIGHTNESS;
+    OCR0B = LED_BRIGHTNESS;
+    TCCR0A = (1 << WGM01) | (1 << WGM00);
+    TCCR0B = (1 << CS00);
+#endif
+
+#if TONE
+    // PB3 drives the piezo
+    pin_output(PIN_PIEZO);
+#endif
+
+#if BATTERY
+    // Full brightness until the first battery_check() says otherwise
+    battery_low = 0;
+#endif
+
+#if WDT_TICK
+    // The watchdog interrupt is the tick that plays the note queue and wakes
+    // up the idle cascade, every 16ms. It never resets the chip.
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = (1 << WDIE);
+    sei();
+#endif
+}
+
+/**
+ * game_init()
+ *
+ * \brief Put the game into the IDLE state, as if the MCU had just been reset.
+ *        The seed is picked back up from the EEPROM.
+ */
+void game_init()
+{
+    game.cpu_counter = 0;
+    game.player_counter = 0;
+#if SAVE_SEED
+    game.random = eeprom_read_word((uint16_t *) SEED_ADDR);
+#else
+    game.random = 0;
+#endif
+    game.gamestate = IDLE;
+    game.prev_move = 0;
+    game.move_ready = 0;
+    game.cascade_i = 0;
+    game.cascade_up = 1;
+    game.idle_frames = 0;
+    game_seal();
+}
+
+/**
+ * game_crc()
+ * \return  uint16_t  CRC-16 of the game, the moves that have been made
+ *                     (and a prefetched one) and everything after them up
+ *                     to crc.
+ *
+ * \brief The moves past those are never looked at, so they are left out,
+ *        which keeps the CRC cheap early in a game.
+ */
+uint16_t game_crc()
+{
+    const uint8_t *p;
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+
+    for (i = 0; i < MOVES_USED(game.cpu_counter + game.move_ready); i++) {
+        crc = _crc16_update(crc, game.moves[i]);
+    }
+    for (p = (const uint8_t *) &game.cpu_counter; p < (const uint8_t *) &game.crc; p++) {
+        crc = _crc16_update(crc, *p);
+    }
+    return crc;
+}
+
+/**
+ * game_seal()
+ *
+ * \brief Marks the game as whole. game_step() calls this once it has changed
+ *        the game and before anything that takes a while (a delay, a sleep,
+ *        a tune), so a reset, which most likely lands in one of those, finds
+ *        the game sealed. Only the few instructions between a change and the
+ *        seal are unprotected.
+ */
+void game_seal()
+{
+    game.magic = GAME_MAGIC;
+    game.crc = game_crc();
+}
+
+/**
+ * game_resume()
+ * \return  uint8_t  1 if the game in SRAM was sealed and is intact, and can
+ *                    be carried on with. 0 if game_init() is needed.
+ *
+ * \brief No EEPROM access and no replay of the moves, the game just picks up
+ *        in the state it was in.
+ */
+uint8_t game_resume()
+{
+    if (game.magic != GAME_MAGIC || game.cpu_counter > MAX_MOVES ||
+        game.move_ready > 1 || game.cpu_counter + game.move_ready > MAX_MOVES) {
+        return 0;
+    }
+    return game.crc == game_crc();
+}
+
+/**
+ * settings_crc()
+ * \return  uint16_t  CRC-16 of the settings in SRAM, up to their crc.
+ */
+uint16_t settings_crc()
+{
+    const uint8_t *p;
+    uint16_t crc = 0xFFFF;
+
+    for (p = (const uint8_t *) &settings; p < (const uint8_t *) &settings.crc; p++) {
+        crc = _crc16_update(crc, *p);
+    }
+    return crc;
+}
+
+/**
+ * settings_valid()
+ * \return  uint8_t  1 if the settings in SRAM are this version's, whole and
+ *                    in range.
+ *
+ * \brief A play_ms past PLAY_MS_MAX would cut its note short, and a button
+ *        window that goes below 0 or past ADC_MAX would wrap in on_button()'s
+ *        16 bit int on the AVR where the host build does not.
+ */
+uint8_t settings_valid()
+{
+    uint8_t n;
+
+    if (settings.version != SETTINGS_VERSION || settings.crc != settings_crc()) {
+        return 0;
+    }
+    if (settings.play_ms > PLAY_MS_MAX) {
+        return 0;
+    }
+    for (n = 0; n < NUM_BUTTONS; n++) {
+        if (settings.button_adc[n] < settings.window ||
+            settings.button_adc[n] > ADC_MAX - settings.window) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * settings_load()
+ *
+ * \brief Copies the settings from the EEPROM into SRAM, or the defaults if
+ *        the EEPROM holds none (a blank EEPROM reads 0xFF). Called once at
+ *        boot, everything else only looks at the SRAM copy.
+ */
+void settings_load()
+{
+    eeprom_read_block(&settings, (const void *) SETTINGS_ADDR, sizeof(settings));
+    if (!settings_valid()) {
+        memcpy_P(&settings, &settings_default, sizeof(settings));
+        settings.crc = settings_crc();
+    }
+}
+
+/**
+ * delay_ms()
+ * \param  uint16_t  ms  Milliseconds to wait.
+ *
+ * \brief _delay_ms() needs a constant, this takes one from the settings.
+ */
+void delay_ms(uint16_t ms)
+{
+    while (ms--) {
+        _delay_ms(1);
+    }
+}
+
+/**
+ * game_step()
+ *
+ * \brief One pass of the game's finite state machine. main() calls this
+ *        forever. The game is sealed (game_seal()) whenever it waits, and
+ *        when it returns.
+ */
+void game_step()
+{
+    uint16_t i;
+    uint16_t player_move;
+    uint8_t prev_move, move_ready;
+
+    if (game.gamestate == CPU) {
+        if (game.cpu_counter == MAX_MOVES) {
+            // The player has matched every move we have room for, so there is
+            // nowhere left to store the next one. Call it a win and start over.
+            game.cpu_counter = 0;
+            game.move_ready = 0;
+            game.gamestate = IDLE;
+            game_seal();
+            blink_leds();
+            _delay_ms(100);
+            blink_leds();
+            _delay_ms(500);
+            return;
+        }
+        // The new move was drawn while the player was busy, unless a reset
+        // came in between. It stays ready, and under the CRC, until it has
+        // been shown, so a reset during the playback plays it all again.
+        move_prefetch();
+        game_seal();
+
+        for (i = 0; i <= game.cpu_counter; i++) {
+            // Translate the move into something that we can send to the
+            // charlieplexed LEDs
+            tone_play(get_move(i), TONE_TICKS(settings.play_ms));
+            set_display(get_move(i));
+            delay_ms(settings.play_ms);
+            clear_display();
+            delay_ms(settings.gap_ms);
+        }
+        game.move_ready = 0;
+        game.cpu_counter += 1;
+        game.gamestate = PLAYER;
+        game_seal();
+        _delay_ms(10);
+    } else if (game.gamestate == PLAYER) {
+        prev_move = game.prev_move;
+        move_ready = game.move_ready;
+        player_move = get_player_move();
+        if (player_move == 0) {
+            clear_display();
+            // Nothing pressed, so there is time for the next turn's move
+            move_prefetch();
+            // This runs every poll, so the CRC is only worked out again
+            // when something changed
+            if (game.prev_move != prev_move || game.move_ready != move_ready) {
+                game_seal();
             }
-            cpu_counter += 1;
-            gamestate = PLAYER;
-            _delay_ms(10);
-        } else if (gamestate == PLAYER) {
-            player_move = get_player_move(); 
-            if (player_move == 0) {
-                clear_display();
-            } else {
-                set_display(player_move);               
-                _delay_ms(50);
-                clear_display();
-                _delay_ms(50);
-                set_display(player_move);
-                _delay_ms(50);
-                clear_display();
-                if (player_move == moves[player_counter]) {
-                    if (player_counter == (cpu_counter-1)) {
-                        player_counter = 0;
-                        _delay_ms(1000);
-                        gamestate = CPU;
-                    } else {   
-                        player_counter += 1;
-                    }
+        } else {
+            // The move counts before it is shown, so a reset during the
+            // flashes keeps it
+            if (player_move == get_move(game.player_counter)) {
+                if (game.player_counter == (game.cpu_counter-1)) {
+                    game.player_counter = 0;
+                    game.gamestate = CPU;
                 } else {
-                    player_counter = 0;
-                    cpu_counter = 0;
-                    
-                    gamestate = IDLE;
-                    blink_leds();
-                    _delay_ms(100);
-                    blink_leds();
-                    _delay_ms(500);
-
+                    game.player_counter += 1;
                 }
+            } else {
+                game.gamestate = LOSE;
             }
-        } else if (gamestate == IDLE) {
-            // When the game is IDLE (not being played), increment the seed.
-            // Once random is done being incremented store that value at location
-            // 46 in the EEPROM so it can be accessed later.
-            random += 0x0001;
-            eeprom_write_word((uint16_t *)46, random);
-            cascade_leds();
-            if (read_adc() > 200) {
-                gamestate = CPU;
-                blink_leds();
-                _delay_ms(100);
-                blink_leds();
-                _delay_ms(500);
+            game_seal();
+            tone_play(player_move, TONE_TICKS(3 * settings.flash_ms));
+            set_display(player_move);
+            delay_ms(settings.flash_ms);
+            clear_display();
+            delay_ms(settings.flash_ms);
+            set_display(player_move);
+            delay_ms(settings.flash_ms);
+            clear_display();
+            if (game.gamestate == CPU) {
+                move_prefetch();
+                game_seal();
+                delay_ms(settings.pause_ms);
             }
-        } else {
-            // Flash LED 1 and 4 if there is an error
-            PORTB |= led_display(0x01);
-            _delay_ms(100);
-            PORTB &= 0xF0;
-            _delay_ms(100);
-            PORTB |= led_display(0x08);
-            _delay_ms(100);
-            PORTB &= 0xF0;
+        }
+    } else if (game.gamestate == IDLE) {
+        // When the game is IDLE (not being played), increment the seed.
+        // Once random is done being incremented store that value at location
+        // 46 in the EEPROM so it can be accessed later.
+        game.random += 0x0001;
+#if SAVE_SEED
+        eeprom_write_word((uint16_t *)SEED_ADDR, game.random);
+#endif
+        game_seal();
+        stack_check();
+#if BATTERY
+        // Now and then a battery reading takes the place of a button one
+        if (game.idle_frames % BATTERY_PERIOD == 0) {
+            battery_check();
+        }
+#endif
+        cascade_leds();
+        game.idle_frames += 1;
+        game_seal();
+#if SLEEP_IDLE && IDLE_TIMEOUT
+        // Nobody is playing, so stop the cascade until a button is pressed
+        if (game.idle_frames >= (battery_low ? IDLE_FRAMES(IDLE_TIMEOUT_LOW) :
+                                               IDLE_FRAMES(IDLE_TIMEOUT))) {
+            idle_power_down();
+            game_seal();
+        }
+#endif
+        if (read_adc() > settings.idle_threshold) {
+            game.idle_frames = 0;
+            // get_player_move() has not looked at the buttons since the last
+            // game ended, so forget the button that ended it. Otherwise the
+            // first move is swallowed if it happens to be the same button.
+            game.prev_move = 0;
+            game.gamestate = CPU;
+            move_prefetch();
+            game_seal();
+            blink_leds();
             _delay_ms(100);
+            blink_leds();
+            _delay_ms(500);
         }
+    } else if (game.gamestate == LOSE) {
+        // Wrong move. Clean up the game and go back to waiting for a player.
+        tone_play(NOTE_LOSE, TONE_TICKS(500));
+        game.player_counter = 0;
+        game.cpu_counter = 0;
+        game.move_ready = 0;
+
+        game.gamestate = IDLE;
+        game_seal();
+        blink_leds();
+        _delay_ms(100);
+        blink_leds();
+        _delay_ms(500);
+    } else {
+        // Flash the first and last LED if there is an error
+        set_display(0x01);
+        _delay_ms(100);
+        clear_display();
+        _delay_ms(100);
+        set_display(0x01 << (NUM_BUTTONS - 1));
+        _delay_ms(100);
+        clear_display();
+        _delay_ms(100);
     }
-    return 0;
 }
 
 
 /**
  * led_display()
- * \param   uint8_t  state  The 4-bit one hot encoding of the current game move.
+ * \param   uint8_t  state  The NUM_BUTTONS-bit one hot encoding of the current game move.
  * \return  uint8_t  encoded_state  The encodign for our charlieplexed LED display.
  *
- * \breif Converts a 4-but one hot encoded gamestate into an encoding appropriate for 
+ * \breif Converts a one hot encoded gamestate into an encoding appropriate for 
  *        the charlieplexed LED display on PORTB pins 0, 1 and 2.
  *
  * LEDS, MUST be on pins 0, 1 and 2 on any PORT. However, this can be changed by
- * changing the encodings.
+ * changing the LEDn_ANODE and LEDn_CATHODE pins in nomis-hal.h.
  */
 uint8_t led_display(uint8_t state)
 {
     switch (state) {
     case 0x01:
-        return 0x03;
+        return LED_PORT(0);
         break;
     case 0x02:
-        return 0x04;
+        return LED_PORT(1);
         break;
+#if NUM_BUTTONS > 2
     case 0x04:
-        return 0x06;
+        return LED_PORT(2);
         break;
+#endif
+#if NUM_BUTTONS > 3
     case 0x08:
-        return 0x01;
+        return LED_PORT(3);
+        break;
+#endif
+#if NUM_BUTTONS > 4
+    case 0x10:
+        return LED_PORT(4);
+        break;
+#endif
+#if NUM_BUTTONS > 5
+    case 0x20:
+        return LED_PORT(5);
+        break;
+#endif
+    default:
+        return 0x00;
         break;
+    }
+}
+
+/**
+ * led_direction()
+ * \param   uint8_t  state  One hot encoded game move.
+ * \return  uint8_t  The DDRB bits for that move's LED.
+ *
+ * \brief Only needed with more than four LEDs or PWM_LEDS, where the pin
+ *        that is not part of an LED's pair has to be made an input.
+ */
+#ifdef LED_TRISTATE
+uint8_t led_direction(uint8_t state)
+{
+    switch (state) {
+    case 0x01:
+        return LED_PINS(0);
+    case 0x02:
+        return LED_PINS(1);
+#if NUM_BUTTONS > 2
+    case 0x04:
+        return LED_PINS(2);
+#endif
+#if NUM_BUTTONS > 3
+    case 0x08:
+        return LED_PINS(3);
+#endif
+#if NUM_BUTTONS > 4
+    case 0x10:
+        return LED_PINS(4);
+#endif
+#if NUM_BUTTONS > 5
+    case 0x20:
+        return LED_PINS(5);
+#endif
+    default:
+        return 0x07;
+    }
+}
+#endif
+
+/**
+ * led_pwm()
+ * \param   uint8_t  state  One hot encoded game move.
+ * \return  uint8_t  The TCCR0A output compare mode bits for that move's LED.
+ *
+ * \brief Connects Timer0 to whichever pin of the LED's pair it can drive.
+ */
+#if PWM_LEDS
+uint8_t led_pwm(uint8_t state)
+{
+    switch (state) {
+    case 0x01:
+        return LED_COM(0);
+    case 0x02:
+        return LED_COM(1);
+#if NUM_BUTTONS > 2
+    case 0x04:
+        return LED_COM(2);
+#endif
+#if NUM_BUTTONS > 3
+    case 0x08:
+        return LED_COM(3);
+#endif
+#if NUM_BUTTONS > 4
+    case 0x10:
+        return LED_COM(4);
+#endif
+#if NUM_BUTTONS > 5
+    case 0x20:
+        return LED_COM(5);
+#endif
     default:
         return 0x00;
+    }
+}
+#endif
+
+#if TONE
+/**
+ * tone_play()
+ * \param   uint8_t  note   One hot encoded move, NOTE_LOSE or NOTE_REST.
+ * \param   uint8_t  ticks  How long to play it for, see TONE_TICKS().
+ *
+ * \brief Queues a note and returns straight away. The note starts once the
+ *        ones before it have finished. If the queue is full the note is
+ *        dropped.
+ */
+void tone_play(uint8_t note, uint8_t ticks)
+{
+    struct tone_note n = { note, ticks };
+
+    if (ring_full(&tone_queue))
+        return;
+    ring_push(&tone_queue, n);
+}
+
+/**
+ * tone_start()
+ * \param   uint8_t  note  One hot encoded move, NOTE_LOSE or NOTE_REST.
+ *
+ * \brief Sets Timer1 up for a note. From here on the timer makes the sound
+ *        by itself.
+ */
+void tone_start(uint8_t note)
+{
+    uint8_t cs, top;
+
+    switch (note) {
+    case 0x01:
+        cs = TONE_CS(415); top = TONE_TOP(415);
         break;
+    case 0x02:
+        cs = TONE_CS(310); top = TONE_TOP(310);
+        break;
+    case 0x04:
+        cs = TONE_CS(252); top = TONE_TOP(252);
+        break;
+    case 0x08:
+        cs = TONE_CS(209); top = TONE_TOP(209);
+        break;
+    case 0x10:
+        cs = TONE_CS(523); top = TONE_TOP(523);
+        break;
+    case 0x20:
+        cs = TONE_CS(165); top = TONE_TOP(165);
+        break;
+    case NOTE_LOSE:
+        cs = TONE_CS(42); top = TONE_TOP(42);
+        break;
+    default:
+        // Rest: stop the timer and let go of PB3
+        TCCR1 = 0;
+        GTCCR &= ~((1 << COM1B1) | (1 << COM1B0));
+        return;
+    }
+    TCCR1 = 0;
+    TCNT1 = 0;
+    OCR1C = top;
+    OCR1B = top >> 1;
+    GTCCR = (GTCCR & ~(1 << COM1B1)) | (1 << PWM1B) | (1 << COM1B0);
+    TCCR1 = cs;
+}
+
+/**
+ * tone_tick()
+ *
+ * \brief Called from the 16ms tick. Counts down the note that is playing and
+ *        starts the next one from the queue when it is done.
+ */
+void tone_tick()
+{
+    if (tone_left && --tone_left)
+        return;
+
+    if (ring_empty(&tone_queue)) {
+        // Nothing more to play, stop the last note if it is still going
+        if (TCCR1)
+            tone_start(NOTE_REST);
+        return;
+    }
+    tone_start(ring_peek(&tone_queue).note);
+    tone_left = ring_peek(&tone_queue).ticks;
+    ring_drop(&tone_queue);
+}
+#endif
+
+#if WDT_TICK
+/**
+ * ISR(WDT_vect)
+ *
+ * \brief The 16ms tick.
+ */
+ISR(WDT_vect)
+{
+#if SLEEP_IDLE
+    idle_ticks += 1;
+#endif
+#if TONE
+    tone_tick();
+#endif
+}
+#endif
+
+#if SLEEP_IDLE
+/**
+ * ISR(PCINT0_vect)
+ *
+ * \brief A button changed the level on PB4 while the idle cascade slept.
+ */
+ISR(PCINT0_vect)
+{
+    idle_woken = 1;
+}
+
+/**
+ * idle_sleep()
+ * \param   uint8_t  ticks  How many 16ms ticks to sleep for.
+ * \return  uint8_t  1 if a button woke the MCU up before that, 0 if not.
+ *
+ * \brief Sleeps in power-down, or in idle while Timer0 drives a lit LED or
+ *        Timer1 a note, as neither runs without the I/O clock. The ADC is
+ *        turned off while asleep, it would draw more than all the rest.
+ *
+ * A press pulls PB4 up to at least half of VCC, which wakes the MCU through
+ * the pin change interrupt for the upper buttons straight away. Button 0 sits
+ * at the logic threshold, so it may only be seen at the next ADC read.
+ */
+uint8_t idle_sleep(uint8_t ticks)
+{
+    uint8_t start = idle_ticks;
+
+#if PWM_LEDS
+    if (TCCR0A & LED_COM_MASK) {
+        set_sleep_mode(SLEEP_MODE_IDLE);
+    } else
+#endif
+#if TONE
+    if (TCCR1) {
+        set_sleep_mode(SLEEP_MODE_IDLE);
+    } else
+#endif
+    {
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    }
+
+    adc_disable();
+    idle_woken = 0;
+    PCMSK = (1 << pin_bit(PIN_BUTTONS));
+    GIFR = (1 << PCIF);
+    GIMSK |= (1 << PCIE);
+
+    while (!idle_woken && (uint8_t)(idle_ticks - start) < ticks) {
+        // Interrupts stay off until the sleep instruction, so a wake up can
+        // not slip in between the check and going to sleep
+        cli();
+        if (!idle_woken && (uint8_t)(idle_ticks - start) < ticks) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
     }
+
+    GIMSK &= ~(1 << PCIE);
+    adc_enable();
+    return idle_woken;
 }
 
+/**
+ * idle_power_down()
+ *
+ * \brief Sleeps in power-down with the watchdog slowed to POWER_DOWN_WDP,
+ *        until a button is pressed. The upper buttons wake the MCU through
+ *        the pin change interrupt, button 0 may not trip it (see
+ *        idle_sleep()) and is caught by an ADC read on each watchdog tick.
+ */
+void idle_power_down()
+{
+    clear_display();
+    cli();
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = (1 << WDIE) | POWER_DOWN_WDP;
+    sei();
+    while (!idle_sleep(1) && read_adc() <= settings.idle_threshold)
+        ;
+    cli();
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = (1 << WDIE);
+    sei();
+    game.idle_frames = 0;
+}
+#endif
+
+#if BATTERY
+/**
+ * battery_read()
+ * \return  uint16_t  VCC in mV.
+ *
+ * \brief The bandgap reads 1.1V * 1024 / VCC. It needs about 1ms to settle
+ *        once selected, and the first conversion after a channel change is
+ *        thrown away.
+ */
+uint16_t battery_read()
+{
+    uint16_t raw;
+
+    adc_select(VBG_MUX);
+    _delay_ms(1);
+    read_adc();
+    raw = read_adc();
+    adc_select(ADC_MUX);
+    if (raw == 0) {
+        return 0xFFFF;
+    }
+    return 1126400UL / raw;
+}
+
+/**
+ * battery_check()
+ *
+ * \brief Measures VCC and switches between the normal and the low battery
+ *        power policy: LED duty, idle flash length and power down timeout.
+ */
+void battery_check()
+{
+    uint8_t low;
+
+    battery_mv = battery_read();
+    if (battery_low) {
+        low = battery_mv < BATTERY_LOW_MV + BATTERY_HYSTERESIS_MV;
+    } else {
+        low = battery_mv < BATTERY_LOW_MV;
+    }
+    if (low == battery_low) {
+        return;
+    }
+    battery_low = low;
+#if PWM_LEDS
+    OCR0A = low ? LED_BRIGHTNESS_LOW : LED_BRIGHTNESS;
+    OCR0B = low ? LED_BRIGHTNESS_LOW : LED_BRIGHTNESS;
+#endif
+}
+#endif
+
+#if STACK_MONITOR
+/**
+ * stack_unused()
+ * \return  uint16_t  Bytes of SRAM above the variables that the stack has
+ *                     never reached since the last reset.
+ */
+uint16_t stack_unused()
+{
+    const uint8_t *p = &_end;
+
+    while (p <= &__stack && *p == STACK_CANARY) {
+        p++;
+    }
+    return p - &_end;
+}
+
+/**
+ * stack_check()
+ *
+ * \brief Saves stack_unused() to the EEPROM at STACK_ADDR if it is the lowest
+ *        yet. A blank EEPROM reads 0xFFFF, so the first check always saves.
+ *        Called from IDLE, where the stack is shallow, so the check itself
+ *        does not count.
+ */
+void stack_check()
+{
+    uint16_t unused = stack_unused();
+
+    if (unused < eeprom_read_word((uint16_t *) STACK_ADDR)) {
+        eeprom_write_word((uint16_t *) STACK_ADDR, unused);
+    }
+}
+#endif
+
 /**
  * cascade_leds()
  * 
@@ -238,31 +1022,39 @@ uint8_t led_display(uint8_t state)
  */
 void cascade_leds()
 {
-    /// Predefinition of the for loop variable... Saves memory
-    static uint16_t i = 0;
-    static uint8_t up = 1;
-   
-    PORTB |= led_display(0x01 << i);
+#if SLEEP_IDLE
+    uint8_t woken;
+
+    set_display(0x01 << game.cascade_i);
+    woken = idle_sleep(battery_low ? IDLE_LIT_TICKS_LOW : IDLE_LIT_TICKS);
+    clear_display();
+    // A button press is looked at straight away
+    if (!woken) {
+        idle_sleep(IDLE_DARK_TICKS);
+    }
+#else
+    set_display(0x01 << game.cascade_i);
     _delay_ms(100);
-    PORTB &= 0xF0;
+    clear_display();
     _delay_ms(50);
+#endif
 
-    if (i == 3)
-        up = 0;
-    else if (i == 0)
-        up = 1;
+    if (game.cascade_i == NUM_BUTTONS - 1)
+        game.cascade_up = 0;
+    else if (game.cascade_i == 0)
+        game.cascade_up = 1;
 
-    if (up)
-        i += 1;
+    if (game.cascade_up)
+        game.cascade_i += 1;
     else
-        i -= 1;
+        game.cascade_i -= 1;
 }
 
 void blink_leds() {
     uint16_t j;
     uint16_t i;
     for( i = 0; i < 100; i++) {
-        for (j = 0; j <= 3; j++) {
+        for (j = 0; j < NUM_BUTTONS; j++) {
             set_display(0x01 << j);
             _delay_us(100);
             clear_display();
@@ -271,6 +1063,101 @@ void blink_leds() {
     }
 }
 
+/**
+ * next_move()
+ * \return  uint8_t  A new one hot encoded move.
+ *
+ * \brief Steps the LCG in game.random and turns it into a move, with every
+ *        button equally likely, in the same cycles for any state.
+ */
+uint8_t next_move()
+{
+    game.random = LCG_NEXT(game.random);
+    return pgm_read_byte(&move_bits[draw_button(game.random)]);
+}
+
+/**
+ * move_prefetch()
+ *
+ * \brief Draws the move the next CPU turn adds and saves the seed, unless
+ *        that is done already. Called while the game waits for the player,
+ *        so the EEPROM write's few ms are not a stall before the CPU turn.
+ */
+void move_prefetch()
+{
+    if (game.move_ready || game.cpu_counter == MAX_MOVES) {
+        return;
+    }
+    set_move(game.cpu_counter, next_move());
+#if SAVE_SEED
+    eeprom_write_word((uint16_t *)SEED_ADDR, game.random); // Store last random value in the EEPROM for next seed, if reset occurs
+#endif
+    game.move_ready = 1;
+}
+
+/**
+ * draw_button()
+ * \param   uint16_t  random  A generator output, RANDOM_BITS bits wide.
+ * \return  uint8_t  A button, 0 to NUM_BUTTONS - 1.
+ *
+ * \brief Multiply-shift range reduction, with no rejection. Another
+ *        generator only has to set RANDOM_BITS to its width.
+ *
+ * The ATTiny has no MUL, and __mulsi3 takes longer the more bits of random
+ * are set, so the multiply is a shift and add for each bit of the constant
+ * NUM_BUTTONS. The branches only depend on NUM_BUTTONS.
+ */
+uint8_t draw_button(uint16_t random)
+{
+    uint32_t product = 0;
+    uint32_t term = random;
+    uint8_t k;
+
+    for (k = 0; NUM_BUTTONS >> k; k++) {
+        if ((NUM_BUTTONS >> k) & 1)
+            product += term;
+        term <<= 1;
+        // Keeps the compiler from folding the sum back into a multiply
+        __asm__ ("" : "+r" (term));
+    }
+    return product >> RANDOM_BITS;
+}
+
+/**
+ * get_move()
+ * \param   uint16_t  i  Which move, 0 is the first.
+ * \return  uint8_t  The one hot encoded move.
+ */
+uint8_t get_move(uint16_t i)
+{
+#if MOVES_PACKED
+    return 0x01 << ((game.moves[i >> 2] >> ((i & 0x03) << 1)) & 0x03);
+#else
+    return game.moves[i];
+#endif
+}
+
+/**
+ * set_move()
+ * \param   uint16_t  i  Which move, 0 is the first.
+ * \param   uint8_t   move  The one hot encoded move.
+ *
+ * \brief Packed moves are kept as the button number, two bits each.
+ */
+void set_move(uint16_t i, uint8_t move)
+{
+#if MOVES_PACKED
+    uint8_t button = 0;
+    uint8_t shift = (i & 0x03) << 1;
+
+    while (move >>= 1)
+        button++;
+    game.moves[i >> 2] = (game.moves[i >> 2] & ~(0x03 << shift)) | (button << shift);
+#else
+    game.moves[i] = move;
+#endif
+}
+
 // rand_lcg generates a random number from some set of parameters, where the result
 // is constantly fedback into the function when a new random number is desired. 
 // Needs some initial seed value.
@@ -284,43 +1171,59 @@ uint16_t rand_lcg(uint16_t lcg_previous, uint16_t m, uint16_t a, uint16_t c)
 uint16_t read_adc() {
     // TODO: Make more general and allow channel selection
 
-    // ADCSRA[6]: start single conversion
-    ADCSRA |= 0b01000000;
+    // Start a single conversion
+    adc_start();
     
     // Loop until ADIF interrupt occurs
-    while(!(ADCSRA & (1 << ADIF)));
+    while(!adc_done());
     
     // Clear ADIF by writing 1 to it
-    ADCSRA |= (1<<ADIF);
+    adc_clear();
 
     // Return the ADC data
-    return ADC;
+    return adc_result();
 }
 
 
+// Is an ADC reading inside button n's window on the ladder?
+#define on_button(raw, n) (((raw) >= settings.button_adc[n] - settings.window) & \
+                           ((raw) <= settings.button_adc[n] + settings.window))
+
 uint8_t get_player_move() {
     uint16_t raw_move = read_adc();
     uint8_t move;
-    static uint8_t prev_move = 0;
-    if ((raw_move >= 500) & (raw_move <= 520)) {
+    if (on_button(raw_move, 0)) {
         move = 0x01;
-    } else if ((raw_move >= 600) & (raw_move <= 620)) {
+    } else if (on_button(raw_move, 1)) {
         move = 0x02;
-    } else if ((raw_move >= 660) & (raw_move <= 680)) {
+#if NUM_BUTTONS > 2
+    } else if (on_button(raw_move, 2)) {
         move = 0x04;
-    } else if ((raw_move >= 710) & (raw_move <= 730)) {
+#endif
+#if NUM_BUTTONS > 3
+    } else if (on_button(raw_move, 3)) {
         move = 0x08;
+#endif
+#if NUM_BUTTONS > 4
+    } else if (on_button(raw_move, 4)) {
+        move = 0x10;
+#endif
+#if NUM_BUTTONS > 5
+    } else if (on_button(raw_move, 5)) {
+        move = 0x20;
+#endif
     } else {
         move = 0x00;
     }
     
+    // Try to prevent bouncing. Before prev_move changes, so that the game
+    // is still sealed while waiting.
+    _delay_us(1000);
+
     // Make the reading edge sensitive
-    if (move == prev_move)
+    if (move == game.prev_move)
         move = 0;
     else
-        prev_move = move;
-    
-    // Try to prevent bouncing
-    _delay_us(1000);
+        game.prev_move = move;
     return move;
 }
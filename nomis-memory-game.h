@@ -0,0 +1,238 @@
+/**
+ * Project: Memory Game
+ * Version: 01
+ * Creator(s): Christopher Woodall
+ * License: MIT License
+ *
+ * Shared definitions for the game core. The firmware (nomis-memory-game.c)
+ * and the host tools in host/ both include this header, so the host tools
+ * always exercise the same state machine that runs on the ATTiny85.
+ */
+#ifndef NOMIS_MEMORY_GAME_H
+#define NOMIS_MEMORY_GAME_H
+
+#include <stdint.h>
+
+#define MAX_PERIOD 32768 // 2^15
+#define RANDOM_BITS 15   // log2(MAX_PERIOD), the bits draw_button() takes
+#define MULTIPLIER 513   // 2^9 + 1 (A-1 is divisible by all prime factors of M)
+#define C          1     // We know 1 is relatively prime with M
+
+#define SEED_ADDR  46    // EEPROM address of the saved LCG seed
+#define STACK_ADDR 48    // EEPROM address of the stack high water mark
+
+#define GAME_MAGIC 0x5A17 // struct game holds a sealed game, see game_seal()
+
+#define SETTINGS_ADDR    64 // EEPROM address of struct settings
+#define SETTINGS_VERSION 1
+
+#define ADC_MAX     1023       // Highest reading of the 10 bit ADC
+#define PLAY_MS_MAX (255 * 16) // Longest play_ms a note's uint8_t ticks cover
+
+#ifndef NUM_BUTTONS
+#define NUM_BUTTONS 4    // Buttons (and LEDs), 2 to 6 on 3 charlieplex pins
+#endif
+
+#if NUM_BUTTONS < 2 || NUM_BUTTONS > 6
+#error "NUM_BUTTONS must be between 2 and 6"
+#endif
+
+#include "nomis-config.h"
+
+#if MOVES_PACKED
+#define MOVES_BYTES ((MAX_MOVES + 3) / 4)
+#else
+#define MOVES_BYTES MAX_MOVES
+#endif
+
+/**
+ * BUTTON_ADC(n)
+ *
+ * \brief ADC reading of button n (0 based) on the resistor ladder. Readings
+ *        within LADDER_WINDOW either side count as a press.
+ *
+ * The first four were measured on the V01 board. More buttons extend the
+ * ladder by another 1K/2.2K stage each, and stage k reads
+ * 1023 * (2.2K + k * 1K) / (4.4K + k * 1K).
+ */
+#define LADDER_WINDOW 10
+#define LADDER_ADC(k) (1023L * (22 + 10 * (k)) / (44 + 10 * (k)))
+#define BUTTON_ADC(n) ((n) == 0 ? 510 : (n) == 1 ? 610 : (n) == 2 ? 670 : \
+                       (n) == 3 ? 720 : LADDER_ADC(n))
+
+/**
+ * enum STATE gamestates: IDLE, CPU, PLAYER, LOSE
+ *
+ * \breif Define state names for the finite state machine that runs the game flow.
+ *
+ * IDLE: The MCU waits for an input from the user to play the game. In this state
+ *       the MCU cascades the LEDS, signifying that it is on and ready to go. While
+ *       this is happening the MCU is incrementing the random variable to
+ *       continuously change the seed. Exits into the CPU state if a button is
+ *       pressed.
+ *
+ * CPU: The CPU's turn. The CPU (well MCU) generates a random number and,
+ *        adds that as a move to the moves[] array. Then the CPU returns the game
+ *        to the PLAYER state. Ignores input from player.
+ *
+ * PLAYER: The player's turn, in this state the MCU will wait for a string of
+ *           inputs from the player. Once the Player presses a button that is not
+ *           in the array moves[], the player looses the game and the game goes to
+ *           the LOSE state. Otherwise the game goes to the CPU state and the
+ *           computer adds another move to the moves array.
+ *
+ * LOSE: Cleans up the game and returns to the IDLE state. Just for house keeping.
+ */
+enum STATE {
+    IDLE,
+    CPU,
+    PLAYER,
+    LOSE,
+};
+
+/**
+ * struct game
+ *
+ * \brief Everything the game needs to remember between two passes of the
+ *        main loop. Kept in one place so that a host build can reset it.
+ *
+ * \var  uint8_t   moves  tracks the computers moves which the player
+ *                          must match. Use get_move() and set_move(), with
+ *                          MOVES_PACKED four moves share a byte.
+ *
+ * \var  uint16_t  cpu_counter  number of moves the computer has made.
+ *
+ * \var  uint16_t  player_counter  number of moves the player has matched
+ *                                   this turn.
+ *
+ * \var  uint16_t  random  Seed random with whatever junk is in the eeprom
+ *                           region at 46. We store future random generations
+ *                           there to be used as future seeds, on future
+ *                           bootup or resets.
+ *
+ * \var  STATE  gamestate  Keep track of where the game is. 4 possible states,
+ *                           IDLE (0), CPU (1), PLAYER (2), or LOSE (3).
+ *
+ * \var  uint8_t  prev_move  last button seen by get_player_move(), used to
+ *                             make the buttons edge sensitive.
+ *
+ * \var  uint8_t  move_ready  1 once move_prefetch() has drawn the next
+ *                              CPU turn's move into moves[cpu_counter].
+ *
+ * \var  uint8_t  cascade_i, cascade_up  position and direction of the idle
+ *                                         LED cascade.
+ *
+ * \var  uint16_t  idle_frames  idle cascade frames since the game went
+ *                                IDLE, for the power down timeout.
+ *
+ * \var  uint16_t  magic, crc  GAME_MAGIC and a CRC of the game, set by
+ *                               game_seal(). On the ATTiny the struct is
+ *                               not cleared on reset, so these tell
+ *                               game_resume() whether it survived.
+ */
+struct game {
+    uint8_t moves[MOVES_BYTES];
+    uint16_t cpu_counter;
+    uint16_t player_counter;
+    uint16_t random;
+    enum STATE gamestate;
+    uint8_t prev_move;
+    uint8_t move_ready;
+    uint8_t cascade_i;
+    uint8_t cascade_up;
+    uint16_t idle_frames;
+    uint16_t magic;
+    uint16_t crc;
+};
+
+/**
+ * GAME_AVR_*
+ *
+ * \brief Offsets into struct game as avr-gcc lays it out, for the host tools
+ *        that read it out of an image (host/emu, and host/wcet through
+ *        `make wcet`). An int, and with it the enum, is 2 bytes there and
+ *        nothing is padded. The firmware checks them when built for the AVR.
+ */
+#define GAME_AVR_PLAYER_COUNTER (MOVES_BYTES + 2)
+#define GAME_AVR_GAMESTATE      (MOVES_BYTES + 6)
+#define GAME_AVR_SIZE           (MOVES_BYTES + 18)
+
+/**
+ * struct settings
+ *
+ * \brief Timings and thresholds that can be tuned per game without a new
+ *        firmware image. Kept in the EEPROM at SETTINGS_ADDR and copied to
+ *        SRAM once at boot; scripts/settings.py writes a new block. A block
+ *        with the wrong version or CRC is ignored and the defaults are used.
+ *        The layout is packed and little endian, the same on every build.
+ *
+ * \var  uint8_t   version         SETTINGS_VERSION.
+ * \var  uint16_t  play_ms         How long the CPU shows each move, at
+ *                                   most PLAY_MS_MAX.
+ * \var  uint16_t  gap_ms          Pause between two of the CPU's moves.
+ * \var  uint8_t   flash_ms        On and off time of the player's flashes.
+ * \var  uint16_t  pause_ms        Pause after the player matched a round.
+ * \var  uint16_t  idle_threshold  ADC reading that starts a game from IDLE.
+ * \var  uint8_t   window          Readings within this much of a button's
+ *                                   button_adc count as that button. The
+ *                                   window has to stay within 0 to ADC_MAX.
+ * \var  uint16_t  button_adc      Ladder reading of each button, 6 always
+ *                                   so the layout does not change with
+ *                                   NUM_BUTTONS.
+ * \var  uint16_t  crc             CRC-16 of everything before it.
+ */
+struct settings {
+    uint8_t version;
+    uint16_t play_ms;
+    uint16_t gap_ms;
+    uint8_t flash_ms;
+    uint16_t pause_ms;
+    uint16_t idle_threshold;
+    uint8_t window;
+    uint16_t button_adc[6];
+    uint16_t crc;
+} __attribute__((packed));
+
+// Host builds that run several games side by side make this _Thread_local.
+#ifndef GAME_STORAGE
+#define GAME_STORAGE
+#endif
+
+extern GAME_STORAGE struct game game;
+extern GAME_STORAGE struct settings settings;
+
+/** Function Headers */
+void io_init();
+void game_init();
+void game_step();
+void game_seal();
+uint8_t game_resume();
+uint16_t game_crc();
+void settings_load();
+uint8_t settings_valid();
+uint16_t settings_crc();
+void delay_ms(uint16_t ms);
+uint16_t read_adc();
+uint8_t led_display(uint8_t state);
+uint8_t led_direction(uint8_t state);
+uint8_t led_pwm(uint8_t state);
+uint8_t next_move();
+void move_prefetch();
+uint8_t draw_button(uint16_t random);
+void tone_play(uint8_t note, uint8_t ticks);
+void tone_start(uint8_t note);
+void tone_tick();
+uint8_t idle_sleep(uint8_t ticks);
+void idle_power_down();
+uint16_t battery_read();
+void battery_check();
+uint8_t get_move(uint16_t i);
+void set_move(uint16_t i, uint8_t move);
+uint16_t rand_lcg(uint16_t lcg_previous, uint16_t m, uint16_t a, uint16_t c);
+void cascade_leds();
+void blink_leds();
+uint8_t get_player_move();
+uint16_t stack_unused();
+void stack_check();
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * Project: Memory Game
+ * Version: 01
+ * Creator(s): Christopher Woodall
+ * License: MIT License
+ *
+ * Single producer, single consumer ring buffer, for passing data between an
+ * interrupt and the main loop. One side only ever calls the producer macros
+ * and the other only the consumer ones; then neither side has to turn
+ * interrupts off.
+ *
+ *   RING(tone_ring, struct tone_note, 8);
+ *   static struct tone_ring queue;
+ *
+ *   // Producer                    // Consumer
+ *   if (!ring_full(&queue))        if (!ring_empty(&queue)) {
+ *       ring_push(&queue, note);       note = ring_peek(&queue);
+ *                                      ring_drop(&queue);
+ *                                  }
+ *
+ * head and tail are free running 8-bit counters, so the size has to be a
+ * power of two no bigger than 128 and an index is a mask away. Only the
+ * producer writes head and only the consumer writes tail, and a side
+ * publishes its counter only after it is done with the slot.
+ */
+#ifndef NOMIS_RING_H
+#define NOMIS_RING_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+// A byte can't be read or written half way on the AVR, so all that is
+// needed is to keep the compiler from moving the slot accesses past the
+// counters.
+#define RING_LOAD(x)     ({ uint8_t ring_v_ = *(volatile uint8_t *) &(x); \
+                            __asm__ volatile ("" ::: "memory"); ring_v_; })
+#define RING_STORE(x, v) do { __asm__ volatile ("" ::: "memory"); \
+                              *(volatile uint8_t *) &(x) = (v); } while (0)
+#else
+// Host builds run the two sides on threads
+#define RING_LOAD(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RING_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#endif
+
+/**
+ * RING(name, type, size)
+ *
+ * \brief Declares struct name, a ring of size elements of type.
+ */
+#define RING(name, type, size)                                              \
+    _Static_assert((size) >= 2 && (size) <= 128 && ((size) & ((size) - 1)) == 0, \
+                   "ring size must be a power of two from 2 to 128");       \
+    struct name {                                                           \
+        type slot[size];                                                    \
+        uint8_t head;                                                       \
+        uint8_t tail;                                                       \
+    }
+
+#define RING_SIZE(r) ((uint8_t) (sizeof((r)->slot) / sizeof((r)->slot[0])))
+
+/**
+ * ring_full(r), ring_push(r, value)
+ *
+ * \brief Producer side. ring_push() must only be called when ring_full() is
+ *        false.
+ */
+#define ring_full(r) ((uint8_t) ((r)->head - RING_LOAD((r)->tail)) == RING_SIZE(r))
+#define ring_push(r, value) do {                                            \
+        (r)->slot[(r)->head & (RING_SIZE(r) - 1)] = (value);                \
+        RING_STORE((r)->head, (uint8_t) ((r)->head + 1));                   \
+    } while (0)
+
+/**
+ * ring_empty(r), ring_peek(r), ring_drop(r)
+ *
+ * \brief Consumer side. ring_peek() is the oldest element, and ring_drop()
+ *        hands its slot back to the producer. Both must only be called when
+ *        ring_empty() is false.
+ */
+#define ring_empty(r) (RING_LOAD((r)->head) == (r)->tail)
+#define ring_peek(r)  ((r)->slot[(r)->tail & (RING_SIZE(r) - 1)])
+#define ring_drop(r)  RING_STORE((r)->tail, (uint8_t) ((r)->tail + 1))
+
+/**
+ * ring_count(r)
+ *
+ * \brief Elements in the ring. The other side may change it straight after.
+ */
+#define ring_count(r) ((uint8_t) (RING_LOAD((r)->head) - RING_LOAD((r)->tail)))
+
+#endif
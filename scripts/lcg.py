@@ -1,21 +1,50 @@
+#!/usr/bin/env python3
+"""A look at the game's Linear Congruential Generator, through the firmware's
+own code (see nomis.py): its period from a seed, and how evenly the moves
+come out over every seed. Build the library first:
+
+    make -C host libnomis.so
+    scripts/lcg.py [seed] [-n moves]
+"""
+import argparse
 import random
-seed = random.randint(0,0xFFFF)
-lcg = seed
-a = 257
-m = 32768
-print lcg
 
-period = 0
-lcg = (a * lcg + 1) % m
-print lcg >> 13
-period += 1
+import nomis
+
+
+def period(seed):
+    """Steps until the LCG comes back to seed."""
+    states = nomis.lcg(seed, nomis.MAX_PERIOD)
+    for i, state in enumerate(states):
+        if state == seed:
+            return i + 1
+    return None
+
 
+def main():
+    p = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    p.add_argument('seed', nargs='?', type=lambda s: int(s, 0),
+                   default=random.randint(0, nomis.MAX_PERIOD - 1))
+    p.add_argument('-n', '--moves', type=int, default=nomis.MAX_MOVES)
+    args = p.parse_args()
 
-while (period < 1000):
-	lcg = (a * lcg + 1) % m
-	print lcg >> 13
-	period += 1
+    print('seed %d, period %s' % (args.seed, period(args.seed)))
+    print('moves: %s' % ''.join(str(b) for b in
+                                nomis.moves([args.seed], args.moves)[0]))
 
-print period
+    # Every seed is equally likely to start a game, so over all of them
+    # each button should be every move equally often
+    counts = nomis.move_counts(range(nomis.MAX_PERIOD), args.moves)
+    expected = nomis.MAX_PERIOD / nomis.NUM_BUTTONS
+    worst = max(range(args.moves), key=lambda i: sum(
+        (int(c) - expected) ** 2 / expected for c in counts[i]))
+    chi2 = sum((int(c) - expected) ** 2 / expected for c in counts[worst])
+    print('over %d seeds, move 0: %s' % (nomis.MAX_PERIOD,
+                                         ' '.join(str(int(c)) for c in counts[0])))
+    print('least even move %d: %s, chi-squared %.2f with %d degrees of freedom'
+          % (worst, ' '.join(str(int(c)) for c in counts[worst]), chi2,
+             nomis.NUM_BUTTONS - 1))
 
 
+if __name__ == '__main__':
+    main()
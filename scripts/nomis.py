@@ -0,0 +1,87 @@
+"""ctypes bindings for the game core in host/libnomis.so, e.g.
+
+    make -C host libnomis.so
+    python3 -c "import nomis; print(nomis.moves([0x1234], 8))"
+
+moves() and lcg() run the firmware's own next_move() and rand_lcg(). With
+numpy installed they return arrays, and numpy arrays can be passed straight
+in; without it they return lists. Set NOMIS_LIB to load another build, e.g.
+one made with make -C host libnomis.so DEFS=-DNUM_BUTTONS=6.
+"""
+import ctypes
+import os
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+_HERE = os.path.dirname(os.path.abspath(__file__))
+_lib = ctypes.CDLL(os.environ.get(
+    'NOMIS_LIB', os.path.join(_HERE, '..', 'host', 'libnomis.so')))
+
+_u16p = ctypes.POINTER(ctypes.c_uint16)
+_u8p = ctypes.POINTER(ctypes.c_uint8)
+_u64p = ctypes.POINTER(ctypes.c_uint64)
+
+_lib.nomis_num_buttons.restype = ctypes.c_uint32
+_lib.nomis_max_moves.restype = ctypes.c_uint32
+_lib.nomis_max_period.restype = ctypes.c_uint32
+_lib.nomis_lcg.restype = ctypes.c_uint16
+_lib.nomis_lcg.argtypes = [ctypes.c_uint16, ctypes.c_uint32, _u16p]
+_lib.nomis_moves.restype = None
+_lib.nomis_moves.argtypes = [_u16p, ctypes.c_uint32, ctypes.c_uint32, _u8p]
+_lib.nomis_move_counts.restype = None
+_lib.nomis_move_counts.argtypes = [_u16p, ctypes.c_uint32, ctypes.c_uint32,
+                                   _u64p]
+
+NUM_BUTTONS = _lib.nomis_num_buttons()
+MAX_MOVES = _lib.nomis_max_moves()
+MAX_PERIOD = _lib.nomis_max_period()
+
+
+def _seeds(seeds):
+    """A ctypes uint16 array (or the numpy array itself) and its length."""
+    if numpy is not None:
+        arr = numpy.ascontiguousarray(seeds, dtype=numpy.uint16)
+        return arr, arr.ctypes.data_as(_u16p), len(arr)
+    seeds = list(seeds)
+    arr = (ctypes.c_uint16 * len(seeds))(*seeds)
+    return arr, arr, len(seeds)
+
+
+def lcg(seed, n):
+    """The n LCG states after seed."""
+    if numpy is not None:
+        out = numpy.empty(n, dtype=numpy.uint16)
+        _lib.nomis_lcg(seed, n, out.ctypes.data_as(_u16p))
+        return out
+    out = (ctypes.c_uint16 * n)()
+    _lib.nomis_lcg(seed, n, out)
+    return list(out)
+
+
+def moves(seeds, n):
+    """The first n moves (buttons, 0 based) the game makes from each seed, a
+    row per seed."""
+    keep, ptr, count = _seeds(seeds)
+    if numpy is not None:
+        out = numpy.empty((count, n), dtype=numpy.uint8)
+        _lib.nomis_moves(ptr, count, n, out.ctypes.data_as(_u8p))
+        return out
+    out = (ctypes.c_uint8 * (count * n))()
+    _lib.nomis_moves(ptr, count, n, out)
+    return [list(out[i * n:(i + 1) * n]) for i in range(count)]
+
+
+def move_counts(seeds, n):
+    """How often each button is move i over all the seeds, as rows of
+    NUM_BUTTONS counts, a row per move."""
+    keep, ptr, count = _seeds(seeds)
+    if numpy is not None:
+        out = numpy.zeros((n, NUM_BUTTONS), dtype=numpy.uint64)
+        _lib.nomis_move_counts(ptr, count, n, out.ctypes.data_as(_u64p))
+        return out
+    out = (ctypes.c_uint64 * (n * NUM_BUTTONS))()
+    _lib.nomis_move_counts(ptr, count, n, out)
+    return [list(out[i * NUM_BUTTONS:(i + 1) * NUM_BUTTONS]) for i in range(n)]
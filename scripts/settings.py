@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Write a struct settings block (see nomis-memory-game.h) as an Intel HEX
+file for the EEPROM, e.g.
+
+    scripts/settings.py --play-ms 400 --pause-ms 700 -o settings.hex
+    avrdude -p t85 -c avrispv2 -U eeprom:w:settings.hex:i
+
+Anything not given keeps the firmware's default. The firmware reads the
+block once at power on, and ignores it if the version or CRC is wrong.
+"""
+import argparse
+import struct
+import sys
+
+SETTINGS_ADDR = 64
+SETTINGS_VERSION = 1
+ADC_MAX = 1023
+PLAY_MS_MAX = 255 * 16
+
+
+def ladder_adc(k):
+    return 1023 * (22 + 10 * k) // (44 + 10 * k)
+
+
+DEFAULTS = {
+    'play_ms': 500,
+    'gap_ms': 100,
+    'flash_ms': 50,
+    'pause_ms': 1000,
+    'idle_threshold': 200,
+    'window': 10,
+    'button_adc': [510, 610, 670, 720, ladder_adc(4), ladder_adc(5)],
+}
+
+
+def check(s):
+    """The range checks settings_valid() makes, which would otherwise throw
+    the block away on the device."""
+    if s['play_ms'] > PLAY_MS_MAX:
+        return 'play_ms is over %d' % PLAY_MS_MAX
+    for n, adc in enumerate(s['button_adc']):
+        if adc < s['window'] or adc + s['window'] > ADC_MAX:
+            return 'button %d window goes outside 0 to %d' % (n, ADC_MAX)
+    return None
+
+
+def crc16(data):
+    """_crc16_update() from avr-libc, starting from 0xFFFF."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def pack(s):
+    body = struct.pack('<BHHBHHB6H', SETTINGS_VERSION, s['play_ms'],
+                       s['gap_ms'], s['flash_ms'], s['pause_ms'],
+                       s['idle_threshold'], s['window'], *s['button_adc'])
+    return body + struct.pack('<H', crc16(body))
+
+
+def ihex(data, addr):
+    lines = []
+    for i in range(0, len(data), 16):
+        chunk = data[i:i + 16]
+        rec = bytes([len(chunk), (addr + i) >> 8, (addr + i) & 0xFF, 0]) + chunk
+        lines.append(':%s%02X' % (rec.hex().upper(), -sum(rec) & 0xFF))
+    lines.append(':00000001FF')
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    p.add_argument('--play-ms', type=int)
+    p.add_argument('--gap-ms', type=int)
+    p.add_argument('--flash-ms', type=int)
+    p.add_argument('--pause-ms', type=int)
+    p.add_argument('--idle-threshold', type=int)
+    p.add_argument('--window', type=int)
+    p.add_argument('--button-adc', type=int, nargs='+', metavar='ADC',
+                   help='ladder reading of buttons 0, 1, ...')
+    p.add_argument('-o', '--output', help='output file (default stdout)')
+    args = p.parse_args()
+
+    s = dict(DEFAULTS, button_adc=list(DEFAULTS['button_adc']))
+    for key in ('play_ms', 'gap_ms', 'flash_ms', 'pause_ms',
+                'idle_threshold', 'window'):
+        if getattr(args, key) is not None:
+            s[key] = getattr(args, key)
+    if args.button_adc:
+        s['button_adc'][:len(args.button_adc)] = args.button_adc
+
+    error = check(s)
+    if error:
+        sys.exit('settings out of range: %s' % error)
+    try:
+        out = ihex(pack(s), SETTINGS_ADDR)
+    except struct.error as e:
+        sys.exit('settings out of range: %s' % e)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(out)
+    else:
+        sys.stdout.write(out)
+
+
+if __name__ == '__main__':
+    main()
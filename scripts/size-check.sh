@@ -0,0 +1,34 @@
+#!/bin/sh
+# Check that a firmware image fits its device.
+#
+# Usage: size-check.sh <elf> <flash bytes> <sram bytes> <stack reserve>
+#
+# Flash is .text + .data (the initial values of .data live in flash too).
+# SRAM is .data + .bss + .noinit, and has to leave the stack reserve free.
+
+ELF=$1
+FLASH=$2
+SRAM=$3
+STACK=$4
+SIZE=${SIZE:-avr-size}
+
+$SIZE -A "$ELF" | awk -v elf="$ELF" -v flash="$FLASH" -v sram="$SRAM" \
+    -v stack="$STACK" '
+    $1 == ".text"   { text = $2 }
+    $1 == ".data"   { data = $2 }
+    $1 == ".bss"    { bss = $2 }
+    $1 == ".noinit" { noinit = $2 }
+    END {
+        used_flash = text + data
+        used_sram = data + bss + noinit
+        printf "%s: flash %d/%d, sram %d/%d (+%d stack)\n", elf,
+            used_flash, flash, used_sram, sram, stack
+        if (used_flash > flash) {
+            print elf ": too big for flash" > "/dev/stderr"
+            exit 1
+        }
+        if (used_sram + stack > sram) {
+            print elf ": not enough SRAM left for the stack" > "/dev/stderr"
+            exit 1
+        }
+    }'
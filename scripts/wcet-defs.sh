@@ -0,0 +1,31 @@
+#!/bin/sh
+# Print the -D options for host/wcet that give nomis-wcet.txt this build's
+# numbers and features: each name, as the compiler works it out from
+# nomis-memory-game.h with the build's flags.
+#
+# Usage: CC=avr-gcc CFLAGS="-mmcu=..." wcet-defs.sh <name>...
+#
+# A name that isn't a number in this build comes out as name=?, which
+# host/wcet refuses, rather than going missing.
+
+CC=${CC:-avr-gcc}
+
+for name in "$@"; do
+    # The quoted copy is left alone by the preprocessor
+    printf '"%s" %s\n' "$name" "$name"
+done | $CC $CFLAGS -E -P -x c -include nomis-memory-game.h - | grep '^"' |
+while read -r name value; do
+    name=${name#\"}
+    name=${name%\"}
+    # Integer suffixes (100U, 1023L) mean nothing to the shell
+    value=$(echo "$value" | sed 's/\([0-9]\)[uUlL]*/\1/g')
+    case $value in
+    *[!0-9\ \(\)+*/|\&!-]*|'')
+        echo "$name is not a number: $value" >&2
+        printf ' -D %s=?' "$name"
+        ;;
+    *)
+        printf ' -D %s=%s' "$name" "$(($value))"
+        ;;
+    esac
+done
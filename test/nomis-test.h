@@ -0,0 +1,213 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * Firmware unit tests. Each test/test-*.c is a test image of its own: it
+ * includes this header, which pulls in the whole of nomis-memory-game.c the
+ * way host/game.c does, and its main() runs the checks on the real part's
+ * instruction set under simulavr (make test).
+ *
+ *   CHECK(cond)                fails the test if cond is false
+ *   CHECK_CYCLES(budget, stmt) runs stmt and fails the test if it took more
+ *                              than budget CPU cycles
+ *   test_adc_feed(samples, n)  the next n readings read_adc() returns, then
+ *                              0 (no button) once they run out
+ *
+ * The ADC is stubbed through the HAL (HAL_ADC_STUB), as simulavr has no
+ * analog inputs to speak of. Cycles are counted with Timer1 running at the
+ * CPU clock. Its overflow interrupt, timed against _delay_loop_2() at the
+ * start, is taken out again, so a count is the cycles stmt would take on
+ * its own.
+ *
+ * Results go out a byte at a time through TEST_OUT, which the simulator
+ * copies to stdout, and the image ends by writing its exit status to
+ * TEST_EXIT. The run passes if the last line is PASS.
+ */
+#ifndef NOMIS_TEST_H
+#define NOMIS_TEST_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay_basic.h>
+
+// Unused I/O addresses the simulator is told to watch (-W and -e)
+#define TEST_OUT  (*(volatile uint8_t *) 0x20)
+#define TEST_EXIT (*(volatile uint8_t *) 0x21)
+
+#define TEST_ADC_MAX 32
+
+static uint16_t test_adc[TEST_ADC_MAX];
+static uint8_t test_adc_n, test_adc_pos;
+
+static uint16_t test_adc_next(void)
+{
+    if (test_adc_pos < test_adc_n)
+        return test_adc[test_adc_pos++];
+    return 0;
+}
+
+#define HAL_ADC_STUB
+#define adc_init(mux, div)
+#define adc_select(mux)
+#define adc_enable()
+#define adc_disable()
+#define adc_start()
+#define adc_done()   1
+#define adc_clear()
+#define adc_result() test_adc_next()
+
+#define main nomis_main
+#include "../nomis-memory-game.c"
+#undef main
+
+static volatile uint32_t test_overflows;
+static uint16_t test_checks, test_failures;
+static uint32_t test_overhead;
+static uint8_t test_isr_cycles;     // the overflow interrupt, once per 256
+
+ISR(TIMER1_OVF_vect)
+{
+    test_overflows += 1;
+}
+
+static void test_putc(char c)
+{
+    TEST_OUT = c;
+}
+
+static void test_puts_P(const char *s)
+{
+    char c;
+
+    while ((c = pgm_read_byte(s++)))
+        test_putc(c);
+}
+
+static void test_putu(uint32_t n)
+{
+    char buf[10];
+    uint8_t i = 0;
+
+    do {
+        buf[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    while (i)
+        test_putc(buf[--i]);
+}
+
+/**
+ * test_now()
+ * \return uint32_t  CPU cycles since test_begin(), less the interrupts.
+ */
+static uint32_t test_now(void)
+{
+    uint8_t sreg = SREG, low;
+    uint32_t high;
+
+    cli();
+    low = TCNT1;
+    high = test_overflows;
+    // An overflow that is pending but hasn't been taken yet
+    if ((TIFR & (1 << TOV1)) && low < 128)
+        high += 1;
+    SREG = sreg;
+    return (high << 8) + low - high * test_isr_cycles;
+}
+
+static void test_check(uint8_t ok, uint16_t line, const char *what)
+{
+    test_checks += 1;
+    if (ok)
+        return;
+    test_failures += 1;
+    test_puts_P(PSTR("FAIL line "));
+    test_putu(line);
+    test_puts_P(PSTR(": "));
+    test_puts_P(what);
+    test_putc('\n');
+}
+
+static void test_budget(uint32_t cycles, uint32_t budget, uint16_t line,
+                        const char *what)
+{
+    cycles = cycles > test_overhead ? cycles - test_overhead : 0;
+    test_puts_P(what);
+    test_puts_P(PSTR(": "));
+    test_putu(cycles);
+    test_puts_P(PSTR(" cycles, budget "));
+    test_putu(budget);
+    test_putc('\n');
+    test_check(cycles <= budget, line, PSTR("over the cycle budget"));
+}
+
+#define CHECK(cond) test_check((cond) != 0, __LINE__, PSTR(#cond))
+
+#define CHECK_CYCLES(budget, stmt) do {                                     \
+        uint32_t test_t_ = test_now();                                      \
+        stmt;                                                               \
+        test_budget(test_now() - test_t_, (budget), __LINE__, PSTR(#stmt)); \
+    } while (0)
+
+static void test_adc_feed(const uint16_t *samples, uint8_t n)
+{
+    uint8_t i;
+
+    for (i = 0; i < n && i < TEST_ADC_MAX; i++)
+        test_adc[i] = samples[i];
+    test_adc_n = i;
+    test_adc_pos = 0;
+}
+
+/**
+ * test_begin()
+ *
+ * \brief Starts and calibrates the cycle counter and sets the game up the
+ *        way main() does after a power on.
+ */
+static void test_begin(void)
+{
+    uint32_t t, overflows;
+
+    TCCR1 = (1 << CS10);
+    TIMSK |= (1 << TOIE1);
+    sei();
+    t = test_now();
+    test_overhead = test_now() - t;
+
+    // _delay_loop_2(n) takes 4n cycles, anything over is the interrupt
+    overflows = test_overflows;
+    t = test_now();
+    _delay_loop_2(25600);
+    t = test_now() - t - test_overhead - 4 * 25600UL;
+    test_isr_cycles = t / (test_overflows - overflows);
+
+    io_init();
+    settings_load();
+    game_init();
+}
+
+/**
+ * test_end()
+ *
+ * \brief Reports the result and stops the simulator. Never returns.
+ */
+static int test_end(void)
+{
+    if (test_failures) {
+        test_puts_P(PSTR("FAIL "));
+        test_putu(test_failures);
+        test_puts_P(PSTR(" of "));
+    } else {
+        test_puts_P(PSTR("PASS "));
+    }
+    test_putu(test_checks);
+    test_puts_P(PSTR(" checks\n"));
+    TEST_EXIT = test_failures != 0;
+    for (;;)
+        ;
+}
+
+#endif
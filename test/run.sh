@@ -0,0 +1,18 @@
+#!/bin/sh
+# Run one firmware test image under simulavr, see test/nomis-test.h.
+#
+# Usage: run.sh <elf> <device> <F_CPU>
+#
+# Passes if the simulator exits cleanly and the image's last line is PASS.
+# An image that never finishes is stopped after a minute of simulated time.
+
+ELF=$1
+DEVICE=$2
+HZ=$3
+SIMULAVR=${SIMULAVR:-simulavr}
+
+OUT=$($SIMULAVR -d "$DEVICE" -F "$HZ" -f "$ELF" -W 0x20,- -e 0x21 \
+    -m 60000000000 2>&1)
+STATUS=$?
+printf '%s\n' "$OUT"
+[ $STATUS -eq 0 ] && printf '%s\n' "$OUT" | tail -n 1 | grep -q '^PASS'
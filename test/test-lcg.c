@@ -0,0 +1,78 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * rand_lcg() and next_move(): known values, the full period of MAX_PERIOD
+ * from any seed, every button equally likely over all the seeds, and the
+ * cycles a move costs, which should be the same whatever the state.
+ */
+#include "nomis-test.h"
+
+int main(void)
+{
+    uint16_t counts[NUM_BUTTONS];
+    uint16_t seed, r;
+    uint32_t period, cycles, first_cycles;
+    uint8_t move, n, even, constant;
+
+    test_begin();
+
+    // (a * x + c) % m by hand
+    CHECK(rand_lcg(0x1234, MAX_PERIOD, MULTIPLIER, C) == 0x7A35);
+    CHECK(rand_lcg(0x7A35, MAX_PERIOD, MULTIPLIER, C) == 0x6436);
+    CHECK(rand_lcg(MAX_PERIOD - 1, MAX_PERIOD, MULTIPLIER, C) ==
+          (uint16_t)((MAX_PERIOD - 1UL) * MULTIPLIER + C) % MAX_PERIOD);
+
+    // The state comes back to the seed after exactly MAX_PERIOD steps
+    r = 0x1234;
+    period = 0;
+    do {
+        r = rand_lcg(r, MAX_PERIOD, MULTIPLIER, C);
+        period += 1;
+    } while (r != 0x1234 && period <= MAX_PERIOD);
+    CHECK(period == MAX_PERIOD);
+
+    // Every seed starts a game, so over all of them each button should come
+    // up as the first move as often as any other
+    for (n = 0; n < NUM_BUTTONS; n++)
+        counts[n] = 0;
+    seed = 0;
+    do {
+        game.random = seed;
+        move = next_move();
+        for (n = 0; move >>= 1; n++)
+            ;
+        counts[n] += 1;
+    } while (++seed < MAX_PERIOD);
+    even = 1;
+    for (n = 0; n < NUM_BUTTONS; n++) {
+        if (counts[n] < MAX_PERIOD / NUM_BUTTONS - 1 ||
+            counts[n] > MAX_PERIOD / NUM_BUTTONS + 1)
+            even = 0;
+    }
+    CHECK(even);
+
+    // draw_button() has no loop, so no seed should cost more than another
+    constant = 1;
+    first_cycles = 0;
+    for (seed = 0; seed < MAX_PERIOD; seed += 1021) {
+        game.random = seed;
+        cycles = test_now();
+        next_move();
+        cycles = test_now() - cycles;
+        if (seed == 0)
+            first_cycles = cycles;
+        else if (cycles != first_cycles)
+            constant = 0;
+    }
+    CHECK(constant);
+
+    game.random = 0x1234;
+    CHECK_CYCLES(150, move = next_move());
+    CHECK(move != 0 && (move & (move - 1)) == 0 && move < (1 << NUM_BUTTONS));
+    CHECK_CYCLES(150, set_move(0, move));
+    CHECK_CYCLES(50, r = get_move(0));
+    CHECK(r == move);
+
+    return test_end();
+}
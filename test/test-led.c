@@ -0,0 +1,85 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * led_display(), led_direction() and led_pwm(): for every move, the pins
+ * they set up light that move's LED and no other. Which LED a set of pin
+ * levels lights is worked out from the wiring, not from the firmware's
+ * tables, so a wrong table entry shows up as the wrong LED.
+ */
+#include "nomis-test.h"
+
+// Anode and cathode of each LED, the V01 board then the two extra pairs
+static const uint8_t wiring[6][2] = {
+    { PB1, PB2 }, { PB2, PB1 }, { PB1, PB0 },
+    { PB0, PB1 }, { PB0, PB2 }, { PB2, PB0 },
+};
+
+#define LEVEL_HIGH 1
+#define LEVEL_LOW  2
+
+// The levels a pin takes with these settings, 0 if it floats
+static uint8_t pin_levels(uint8_t pin, uint8_t ddr, uint8_t port, uint8_t com)
+{
+    uint8_t mode = 0;
+
+    if (!(ddr & (1 << pin)))
+        return 0;
+    if (pin == PB0)
+        mode = (com >> COM0A0) & 0x03;
+    else if (pin == PB1)
+        mode = (com >> COM0B0) & 0x03;
+    if (mode >= 2)
+        return LEVEL_HIGH | LEVEL_LOW;      // Timer0 PWM
+    return (port & (1 << pin)) ? LEVEL_HIGH : LEVEL_LOW;
+}
+
+static uint8_t lit_leds(uint8_t ddr, uint8_t port, uint8_t com)
+{
+    uint8_t n, leds = 0;
+
+    for (n = 0; n < NUM_BUTTONS; n++) {
+        if ((pin_levels(wiring[n][0], ddr, port, com) & LEVEL_HIGH) &&
+            (pin_levels(wiring[n][1], ddr, port, com) & LEVEL_LOW))
+            leds |= 1 << n;
+    }
+    return leds;
+}
+
+static uint8_t lit_by(uint8_t state)
+{
+    uint8_t ddr = 0x07, com = 0;
+
+#ifdef LED_TRISTATE
+    ddr = led_direction(state);
+#endif
+#if PWM_LEDS
+    com = led_pwm(state);
+#endif
+    return lit_leds(ddr, led_display(state), com);
+}
+
+int main(void)
+{
+    volatile uint8_t state = 0x04;
+    uint8_t n, out;
+
+    test_begin();
+
+    CHECK(lit_by(0) == 0);
+    for (n = 0; n < NUM_BUTTONS; n++)
+        CHECK(lit_by(1 << n) == (1 << n));
+
+    CHECK_CYCLES(50, out = led_display(state));
+    (void)out;
+#ifdef LED_TRISTATE
+    CHECK_CYCLES(50, out = led_direction(state));
+#endif
+#if PWM_LEDS
+    CHECK_CYCLES(50, out = led_pwm(state));
+#endif
+    CHECK_CYCLES(200, set_display(state));
+    CHECK_CYCLES(50, clear_display());
+
+    return test_end();
+}
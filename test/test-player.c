@@ -0,0 +1,76 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * get_player_move(): each button's ladder reading, the edges of its window,
+ * a held button and a release. Most of its time is the 1ms debounce delay.
+ * settings_valid() turns down windows that leave the ADC's range.
+ */
+#include "nomis-test.h"
+
+static uint8_t move_for(uint16_t sample)
+{
+    test_adc_feed(&sample, 1);
+    return get_player_move();
+}
+
+int main(void)
+{
+    uint16_t sample;
+    uint8_t n, move;
+
+    test_begin();
+
+    for (n = 0; n < NUM_BUTTONS; n++) {
+        game.prev_move = 0;
+        CHECK(move_for(BUTTON_ADC(n)) == (1 << n));
+    }
+
+    // Pressed, held, let go and pressed again
+    game.prev_move = 0;
+    CHECK(move_for(BUTTON_ADC(1)) == 0x02);
+    CHECK(move_for(BUTTON_ADC(1)) == 0);
+    CHECK(move_for(0) == 0);
+    CHECK(move_for(BUTTON_ADC(1)) == 0x02);
+
+    // Both edges of a window count, one step past them doesn't
+    game.prev_move = 0;
+    CHECK(move_for(BUTTON_ADC(1) + LADDER_WINDOW) == 0x02);
+    game.prev_move = 0;
+    CHECK(move_for(BUTTON_ADC(1) - LADDER_WINDOW) == 0x02);
+    game.prev_move = 0;
+    CHECK(move_for(BUTTON_ADC(1) + LADDER_WINDOW + 1) == 0);
+    game.prev_move = 0;
+    CHECK(move_for(BUTTON_ADC(1) - LADDER_WINDOW - 1) == 0);
+
+    // Nothing pressed reads near 0, and the top of the range is no button
+    CHECK(move_for(5) == 0);
+    CHECK(move_for(1023) == 0);
+
+    sample = BUTTON_ADC(0);
+    game.prev_move = 0;
+    test_adc_feed(&sample, 1);
+    CHECK_CYCLES(1100, move = get_player_move());
+    CHECK(move == 0x01);
+    CHECK_CYCLES(150, read_adc());
+
+    // A window past 0 or ADC_MAX, or a note longer than its ticks, is
+    // turned down
+    CHECK(settings_valid());
+    settings.button_adc[0] = LADDER_WINDOW - 1;
+    settings.crc = settings_crc();
+    CHECK(!settings_valid());
+    settings.button_adc[0] = BUTTON_ADC(0);
+    settings.button_adc[NUM_BUTTONS - 1] = ADC_MAX - LADDER_WINDOW + 1;
+    settings.crc = settings_crc();
+    CHECK(!settings_valid());
+    settings.button_adc[NUM_BUTTONS - 1] = BUTTON_ADC(NUM_BUTTONS - 1);
+    settings.play_ms = PLAY_MS_MAX + 1;
+    settings.crc = settings_crc();
+    CHECK(!settings_valid());
+    settings.play_ms = PLAY_MS_MAX;
+    settings.crc = settings_crc();
+    CHECK(settings_valid());
+
+    return test_end();
+}
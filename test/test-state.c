@@ -0,0 +1,102 @@
+/**
+ * Project: Memory Game
+ * License: MIT License
+ *
+ * game_step() through a whole game: the idle cascade, a press starting the
+ * game, the computer's move, the next one drawn while the player thinks, a
+ * round won, a wrong press and back to IDLE.
+ * The cycle budgets are the state's delays (settings_default) plus a little
+ * room for the work in between, so a slower step fails here first.
+ */
+#include "nomis-test.h"
+
+#define MS 1000UL   // cycles at 1MHz
+
+// blink_leds(): 100 passes over the LEDs, 110us each plus switching them
+#define BLINK (100UL * NUM_BUTTONS * 200)
+
+// Saving the seed: two EEPROM bytes of 3.4ms, the second waiting for the first
+#define SEED_WRITE (2 * 3400UL)
+
+static uint8_t button_of(uint8_t move)
+{
+    uint8_t n;
+
+    for (n = 0; move >>= 1; n++)
+        ;
+    return n;
+}
+
+static void feed(uint16_t sample)
+{
+    test_adc_feed(&sample, 1);
+}
+
+int main(void)
+{
+    uint16_t random;
+    uint8_t first;
+
+    test_begin();
+    CHECK(game.gamestate == IDLE);
+    CHECK(game.cpu_counter == 0);
+
+    // A cascade frame with nobody there: 150ms of LEDs and the seed saved
+    random = game.random;
+    feed(0);
+    CHECK_CYCLES(150 * MS + 10 * MS, game_step());
+    CHECK(game.gamestate == IDLE);
+    CHECK(game.random == (uint16_t)(random + 1));
+
+    // A press starts the game: the frame, the first move drawn, two blinks
+    // and 600ms of pauses
+    random = game.random;
+    feed(BUTTON_ADC(2));
+    CHECK_CYCLES(150 * MS + SEED_WRITE + 2 * BLINK + 600 * MS + 20 * MS,
+                 game_step());
+    CHECK(game.gamestate == CPU);
+    CHECK(game.move_ready);
+    CHECK(game.random == rand_lcg(random + 1, MAX_PERIOD, MULTIPLIER, C));
+
+    // The computer shows the move it has ready: 500ms on, 100ms off, 10ms
+    random = game.random;
+    CHECK_CYCLES(610 * MS + 10 * MS, game_step());
+    CHECK(game.gamestate == PLAYER);
+    CHECK(game.cpu_counter == 1);
+    CHECK(!game.move_ready);
+    CHECK(game.random == random);
+    first = get_move(0);
+
+    // Letting go only draws the next move, while the player thinks
+    feed(0);
+    CHECK_CYCLES(2 * MS + SEED_WRITE, game_step());
+    CHECK(game.gamestate == PLAYER);
+    CHECK(game.cpu_counter == 1);
+    CHECK(game.move_ready);
+
+    // The right button wins the round: three 50ms flashes and the pause
+    feed(BUTTON_ADC(button_of(first)));
+    CHECK_CYCLES(1 * MS + 150 * MS + 1000 * MS + 10 * MS, game_step());
+    CHECK(game.gamestate == CPU);
+    CHECK(game.player_counter == 0);
+
+    // Two moves this time, the first one the same as before, and straight
+    // into them as the second was drawn already
+    CHECK(game.move_ready);
+    CHECK_CYCLES(2 * 600 * MS + 10 * MS + 10 * MS, game_step());
+    CHECK(game.cpu_counter == 2);
+    CHECK(get_move(0) == first);
+
+    // A wrong button loses, and LOSE goes back to IDLE
+    feed(0);
+    game_step();
+    feed(BUTTON_ADC((button_of(first) + 1) % NUM_BUTTONS));
+    CHECK_CYCLES(1 * MS + 150 * MS + 10 * MS, game_step());
+    CHECK(game.gamestate == LOSE);
+    CHECK_CYCLES(2 * BLINK + 600 * MS + 10 * MS, game_step());
+    CHECK(game.gamestate == IDLE);
+    CHECK(game.cpu_counter == 0);
+    CHECK(game.player_counter == 0);
+
+    return test_end();
+}